@@ -1,14 +1,69 @@
 #include "AudioFileLoader.h"
+#include "MappedSampleSource.h"
+#include "StreamingSampleSource.h"
+
+AudioFileLoader::DecodeThreadPool::DecodeThreadPool()
+    : juce::ThreadPool(juce::jmax(1, juce::SystemStats::getNumCpus()))
+{
+}
+
+AudioFileLoader::LoadThreadPool::LoadThreadPool()
+    : juce::ThreadPool(maxConcurrentLoads)
+{
+}
+
+class AudioFileLoader::LoadJob : public juce::ThreadPoolJob
+{
+public:
+    explicit LoadJob(AudioFileLoader& loaderToRun)
+        : juce::ThreadPoolJob("PinkGrain File Loader"),
+          loader(loaderToRun)
+    {
+    }
+
+    JobStatus runJob() override
+    {
+        loader.processRequests();
+        return jobHasFinished;
+    }
+
+    AudioFileLoader& loader;
+};
 
 AudioFileLoader::AudioFileLoader()
-    : thumbnailCache(5),
-      thumbnail(512, formatManager, thumbnailCache)
 {
     formatManager.registerBasicFormats();
+
+    startTimer(poolCleanupIntervalMs);
 }
 
 AudioFileLoader::~AudioFileLoader()
 {
+    // Abandons the load in progress and waits for this loader's job, queued or running
+    stopping = true;
+
+    struct OwnJobs : public juce::ThreadPool::JobSelector
+    {
+        explicit OwnJobs(const AudioFileLoader& loaderToMatch) : loader(loaderToMatch) {}
+
+        bool isJobSuitable(juce::ThreadPoolJob* job) override
+        {
+            const auto* loadJob = dynamic_cast<LoadJob*>(job);
+            return loadJob != nullptr && &loadJob->loader == &loader;
+        }
+
+        const AudioFileLoader& loader;
+    };
+
+    OwnJobs ownJobs(*this);
+
+    // A job that outlived the loader would go on using it, so this waits for as long as it takes
+    const bool removed = loadPool->removeAllJobs(true, -1, &ownJobs);
+    jassert(removed);
+    juce::ignoreUnused(removed);
+
+    cancelPendingUpdate();
+    stopTimer();
 }
 
 bool AudioFileLoader::loadFile(const juce::File& file)
@@ -16,48 +71,75 @@ bool AudioFileLoader::loadFile(const juce::File& file)
     if (!file.existsAsFile())
         return false;
 
-    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
-
-    if (reader == nullptr)
-        return false;
-
-    // Read the entire file into the buffer
-    const int numSamples = static_cast<int>(reader->lengthInSamples);
-    const int numChannels = static_cast<int>(reader->numChannels);
-
-    audioBuffer.setSize(numChannels, numSamples);
-    reader->read(&audioBuffer, 0, numSamples, 0, true, true);
-
-    sampleRate = reader->sampleRate;
-    fileName = file.getFileName();
-    fileLoaded = true;
+    bool queueJob = false;
+    {
+        const juce::ScopedLock lock(requestLock);
+        requestedFile = file;
+        ++requestCount;
+        queueJob = !std::exchange(loadJobQueued, true);
+    }
 
-    // Update thumbnail
-    thumbnail.setSource(new juce::FileInputSource(file));
+    loadProgress = 0.0f;
 
-    // Notify listeners
-    listeners.call([this](Listener& l) { l.fileLoaded(fileName); });
+    if (queueJob)
+        loadPool->addJob(new LoadJob(*this), true);
 
     return true;
 }
 
 void AudioFileLoader::clear()
 {
-    audioBuffer.setSize(0, 0);
+    {
+        const juce::ScopedLock lock(requestLock);
+        requestedFile = juce::File();
+        decodedSource = nullptr;
+        currentFileKey = {};
+        ++requestCount;
+    }
+
+    loadProgress = -1.0f;
+    setCurrentSource(nullptr);
+
     sampleRate = 44100.0;
+    numChannels = 0;
+    numSamples = 0;
     fileLoaded = false;
     fileName = "";
-    thumbnail.clear();
 
     listeners.call([](Listener& l) { l.fileCleared(); });
 }
 
+juce::String AudioFileLoader::getFileKey() const
+{
+    const juce::ScopedLock lock(requestLock);
+    return currentFileKey;
+}
+
+SampleSource::Ptr AudioFileLoader::getSource() const
+{
+    const juce::SpinLock::ScopedLockType lock(sourceLock);
+    return currentSource;
+}
+
+void AudioFileLoader::setStorageMode(StorageMode newMode)
+{
+    storageMode = newMode;
+}
+
+void AudioFileLoader::prepareReversedBuffer()
+{
+    keepReversedBuffer = true;
+
+    if (auto source = getSource())
+        source->prepareReversed();
+}
+
 double AudioFileLoader::getLengthInSeconds() const
 {
     if (!fileLoaded || sampleRate <= 0.0)
         return 0.0;
 
-    return static_cast<double>(audioBuffer.getNumSamples()) / sampleRate;
+    return static_cast<double>(numSamples) / sampleRate;
 }
 
 void AudioFileLoader::addListener(Listener* listener)
@@ -69,3 +151,424 @@ void AudioFileLoader::removeListener(Listener* listener)
 {
     listeners.remove(listener);
 }
+
+void AudioFileLoader::processRequests()
+{
+    while (!shouldStop())
+    {
+        juce::File file;
+        int request = 0;
+        {
+            const juce::ScopedLock lock(requestLock);
+            std::swap(file, requestedFile);
+            request = requestCount;
+
+            // The next load queues a new job
+            if (file == juce::File())
+            {
+                loadJobQueued = false;
+                return;
+            }
+        }
+
+        // Instances loading the same file in the same storage mode share one source
+        const auto fileKey = SampleRegistry::makeFileKey(file);
+        const auto key = fileKey + "-" + juce::String(static_cast<int>(storageMode.load()));
+        bool loadedHere = false;
+
+        auto source = registry->findOrLoad(key,
+                                           [&] { loadedHere = true; return decode(file, fileKey, request); },
+                                           [this, request] { return !shouldStop() && isCurrentRequest(request); });
+
+        if (source == nullptr)
+        {
+            const juce::ScopedLock lock(requestLock);
+
+            if (request == requestCount)
+                loadProgress = -1.0f;
+
+            continue;
+        }
+
+        if (!publish(source, fileKey, request, true))
+            continue;
+
+        if (!loadedHere)
+            continue;
+
+        // Sources that were not decoded here, such as streamed files, get their peaks from a
+        // separate pass over the file, and a new pyramid is kept for the next load
+        if (!source->getPeakPyramid().isReady() && !scanPeaks(file, *source, request))
+            continue;
+
+        decodeCache.writePeaks(fileKey, *source);
+
+        // Once the decoded sample is playing, keep a copy for the next time the file is loaded
+        if (auto* decoded = dynamic_cast<MemorySampleSource*>(source.get()); decoded != nullptr)
+            decodeCache.addEntry(fileKey, *decoded, [this, request] { return !shouldStop() && isCurrentRequest(request); });
+    }
+}
+
+SampleSource::Ptr AudioFileLoader::decode(const juce::File& file, const juce::String& fileKey, int request)
+{
+    // Uncompressed files are played straight from a mapping of the file
+    if (auto mapped = createMappedSource(file, file.getFileName(), request))
+    {
+        if (!mapped->getPeakPyramid().isReady())
+            decodeCache.readPeaks(fileKey, *mapped);
+
+        return mapped;
+    }
+
+    if (shouldStop() || !isCurrentRequest(request))
+        return nullptr;
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
+
+    if (reader == nullptr || reader->lengthInSamples <= 0)
+        return nullptr;
+
+    // Files too large to hold decoded in memory are streamed from disk instead
+    const auto storageFormat = getStorageFormat(*reader);
+    const auto decodedBytes = reader->lengthInSamples * static_cast<juce::int64>(reader->numChannels)
+                              * static_cast<juce::int64>(SampleSource::getBytesPerSample(storageFormat));
+
+    if (reader->lengthInSamples > std::numeric_limits<int>::max() || decodedBytes > streamingThresholdBytes)
+    {
+        SampleSource::Ptr streaming = new StreamingSampleSource(std::move(reader), file.getFileName());
+        decodeCache.readPeaks(fileKey, *streaming);
+        return streaming;
+    }
+
+    // A file decoded before is mapped from the cache
+    const auto cachedFile = decodeCache.findEntry(fileKey, storageFormat);
+
+    if (cachedFile.existsAsFile())
+    {
+        if (auto cached = createMappedSource(cachedFile, file.getFileName(), request))
+        {
+            if (!cached->getPeakPyramid().isReady())
+                decodeCache.readPeaks(fileKey, *cached);
+
+            return cached;
+        }
+
+        if (shouldStop() || !isCurrentRequest(request))
+            return nullptr;
+    }
+
+    const int totalSamples = static_cast<int>(reader->lengthInSamples);
+    const int numFileChannels = static_cast<int>(reader->numChannels);
+    juce::ReferenceCountedObjectPtr<MemorySampleSource> source
+        = new MemorySampleSource(totalSamples, numFileChannels, reader->sampleRate, file.getFileName(), storageFormat);
+
+    // With the peaks cached, decoding skips building them
+    decodeCache.readPeaks(fileKey, *source);
+
+    // Published straight away, so grains start as soon as the span they read is decoded
+    if (totalSamples > decodeChunkSamples)
+        publish(source.get(), fileKey, request, false);
+
+    // Long files are decoded on a worker per core, each through its own reader
+    const int numWorkers = juce::jlimit(1, decodePool->getNumThreads(), totalSamples / minSamplesPerWorker);
+
+    if (!decodeChunks(std::move(reader), file, *source, numWorkers, request))
+        return nullptr;
+
+    source->finishLoading();
+
+    if (keepReversedBuffer.load())
+        source->prepareReversed();
+
+    return source.get();
+}
+
+bool AudioFileLoader::decodeChunks(std::unique_ptr<juce::AudioFormatReader> firstReader, const juce::File& file,
+                                   MemorySampleSource& source, int numWorkers, int request)
+{
+    const int totalSamples = static_cast<int>(source.getLengthInSamples());
+    const int numChunks = (totalSamples + decodeChunkSamples - 1) / decodeChunkSamples;
+    std::unique_ptr<std::atomic<bool>[]> claimed(new std::atomic<bool>[static_cast<size_t>(numChunks)]);
+
+    for (int chunk = 0; chunk < numChunks; ++chunk)
+        claimed[static_cast<size_t>(chunk)] = false;
+
+    const auto tryClaim = [&](int chunk) { return !claimed[static_cast<size_t>(chunk)].exchange(true); };
+
+    // The chunk a worker should decode next, or -1 once every chunk is taken
+    const auto claimNextChunk = [&](int previous)
+    {
+        // Chunks grains are about to read come first, from the middle of each read region out
+        std::array<ReadRegions::Region, ReadRegions::maxReaders> regions;
+        const int numRegions = source.getReadRegions(regions);
+        const auto lastChunk = static_cast<juce::int64>(numChunks - 1);
+
+        for (int r = 0; r < numRegions; ++r)
+        {
+            const auto& region = regions[static_cast<size_t>(r)];
+            const int first = static_cast<int>(juce::jlimit(static_cast<juce::int64>(0), lastChunk, region.start / decodeChunkSamples));
+            const int last = static_cast<int>(juce::jlimit(static_cast<juce::int64>(first), lastChunk, (region.end - 1) / decodeChunkSamples));
+            const int centre = (first + last) / 2;
+
+            for (int i = 0; i < 2 * (last - first + 1); ++i)
+            {
+                const int chunk = (i % 2 == 0) ? centre + i / 2 : centre - (i + 1) / 2;
+                if (chunk >= first && chunk <= last && tryClaim(chunk))
+                    return chunk;
+            }
+        }
+
+        // Then the chunk after the worker's last one, so its reader does not seek
+        if (previous + 1 < numChunks && tryClaim(previous + 1))
+            return previous + 1;
+
+        // Otherwise the middle of the longest run nobody has taken, so workers spread out
+        for (;;)
+        {
+            int gapStart = 0;
+            int gapLength = 0;
+
+            for (int start = 0; start < numChunks;)
+            {
+                int end = start;
+                while (end < numChunks && !claimed[static_cast<size_t>(end)].load())
+                    ++end;
+
+                if (end - start > gapLength)
+                {
+                    gapStart = start;
+                    gapLength = end - start;
+                }
+
+                start = end + 1;
+            }
+
+            if (gapLength == 0)
+                return -1;
+
+            const int chunk = gapStart == 0 ? 0 : gapStart + gapLength / 2;
+            if (tryClaim(chunk))
+                return chunk;
+        }
+    };
+
+    std::atomic<int> numRunning { numWorkers };
+    std::atomic<juce::int64> numDecoded { 0 };
+    std::atomic<bool> cancelled { false };
+    std::atomic<bool> failed { false };
+    juce::WaitableEvent allFinished;
+
+    for (int worker = 0; worker < numWorkers; ++worker)
+    {
+        decodePool->addJob([&, worker]
+        {
+            // The first worker takes over the reader already open
+            std::unique_ptr<juce::AudioFormatReader> ownReader(worker > 0 ? formatManager.createReaderFor(file) : nullptr);
+            auto* reader = worker > 0 ? ownReader.get() : firstReader.get();
+
+            if (reader == nullptr)
+                failed = true;
+
+            // Only one chunk per worker is ever held as float
+            juce::AudioBuffer<float> chunk(source.getNumChannels(), decodeChunkSamples);
+            int previous = -1;
+
+            while (reader != nullptr && !cancelled.load())
+            {
+                const int index = claimNextChunk(previous);
+                if (index < 0)
+                    break;
+
+                const int start = index * decodeChunkSamples;
+                const int length = juce::jmin(decodeChunkSamples, totalSamples - start);
+
+                // Decoders that carry state from frame to frame need some audio before a
+                // chunk they seek to; it is decoded and thrown away
+                const int preroll = index == previous + 1 ? 0 : juce::jmin(start, seekPrerollSamples);
+                if (preroll > 0)
+                    reader->read(&chunk, 0, preroll, start - preroll, true, true);
+
+                reader->read(&chunk, 0, length, start, true, true);
+                source.addChunk(start, chunk, length);
+
+                numDecoded += length;
+                previous = index;
+            }
+
+            if (--numRunning == 0)
+                allFinished.signal();
+
+            return juce::ThreadPoolJob::jobHasFinished;
+        });
+    }
+
+    // The jobs write into the source and use this frame's state, so wait for every one of
+    // them, even once the load has been abandoned
+    while (!allFinished.wait(progressIntervalMs))
+    {
+        loadProgress = static_cast<float>(numDecoded.load()) / static_cast<float>(totalSamples);
+
+        if (shouldStop() || !isCurrentRequest(request))
+            cancelled = true;
+    }
+
+    return !failed.load() && !cancelled.load() && isCurrentRequest(request);
+}
+
+bool AudioFileLoader::scanPeaks(const juce::File& file, SampleSource& source, int request)
+{
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
+    if (reader == nullptr)
+        return false;
+
+    auto& pyramid = source.getPeakPyramid();
+    const juce::int64 length = source.getLengthInSamples();
+    juce::AudioBuffer<float> chunk(source.getNumChannels(), decodeChunkSamples);
+
+    for (juce::int64 start = 0; start < length; start += decodeChunkSamples)
+    {
+        if (shouldStop() || !isCurrentRequest(request))
+            return false;
+
+        const int numSamples = static_cast<int>(juce::jmin(length - start, static_cast<juce::int64>(decodeChunkSamples)));
+        reader->read(&chunk, 0, numSamples, start, true, true);
+        pyramid.addChunk(start, chunk, numSamples);
+    }
+
+    pyramid.finish();
+    return true;
+}
+
+bool AudioFileLoader::publish(SampleSource::Ptr source, const juce::String& sourceFileKey, int request, bool complete)
+{
+    const juce::ScopedLock lock(requestLock);
+
+    if (request != requestCount)
+        return false;
+
+    decodedSource = source;
+    decodedFileKey = sourceFileKey;
+    decodedRequest = request;
+    decodedComplete = complete;
+    triggerAsyncUpdate();
+    return true;
+}
+
+SampleSource::SampleFormat AudioFileLoader::getStorageFormat(const juce::AudioFormatReader& reader) const
+{
+    switch (storageMode.load())
+    {
+        case StorageMode::float32:  return SampleSource::SampleFormat::float32;
+        case StorageMode::int16:    return SampleSource::SampleFormat::int16;
+        case StorageMode::float16:  return SampleSource::SampleFormat::float16;
+        case StorageMode::automatic:
+        default:                    break;
+    }
+
+    // 16-bit and narrower integer files fit in int16 without loss
+    return !reader.usesFloatingPointData && reader.bitsPerSample <= 16 ? SampleSource::SampleFormat::int16
+                                                                        : SampleSource::SampleFormat::float32;
+}
+
+SampleSource::Ptr AudioFileLoader::createMappedSource(const juce::File& file, const juce::String& name, int request)
+{
+    auto* format = formatManager.findFormatForFileExtension(file.getFileExtension());
+    if (format == nullptr)
+        return nullptr;
+
+    std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader(format->createMemoryMappedReader(file));
+
+    if (reader == nullptr || reader->lengthInSamples <= 0 || !reader->mapEntireFile()
+        || !MappedSampleSource::canReadDirectly(*reader))
+        return nullptr;
+
+    const auto decodedBytes = reader->lengthInSamples * static_cast<juce::int64>(reader->numChannels)
+                              * static_cast<juce::int64>(sizeof(float));
+
+    juce::ReferenceCountedObjectPtr<MappedSampleSource> source = new MappedSampleSource(std::move(reader), name);
+
+    // Files small enough to have been decoded are scanned for silence culling, which
+    // also faults them in; larger ones are paged in around the read region as they play
+    if (decodedBytes <= streamingThresholdBytes)
+    {
+        const bool analysed = source->analyse([this, request](float progress)
+        {
+            loadProgress = progress;
+            return !shouldStop() && isCurrentRequest(request);
+        });
+
+        if (!analysed)
+            return nullptr;
+    }
+
+    return source.get();
+}
+
+bool AudioFileLoader::isCurrentRequest(int request) const
+{
+    const juce::ScopedLock lock(requestLock);
+    return request == requestCount;
+}
+
+void AudioFileLoader::handleAsyncUpdate()
+{
+    SampleSource::Ptr source;
+    {
+        const juce::ScopedLock lock(requestLock);
+        std::swap(source, decodedSource);
+
+        if (source != nullptr)
+            currentFileKey = decodedFileKey;
+
+        // Still loading if the source is only partly decoded, or another file was requested since
+        if (source != nullptr && decodedRequest == requestCount && decodedComplete)
+            loadProgress = -1.0f;
+    }
+
+    // A source published while decoding is published again once complete
+    if (source == nullptr || source == getSource())
+        return;
+
+    // Reverse may have been switched on while the file was decoding
+    if (keepReversedBuffer.load())
+        source->prepareReversed();
+
+    setCurrentSource(source);
+
+    sampleRate = source->getSampleRate();
+    numChannels = source->getNumChannels();
+    numSamples = source->getLengthInSamples();
+    fileName = source->getFileName();
+    fileLoaded = true;
+
+    // Notify listeners
+    listeners.call([this](Listener& l) { l.fileLoaded(fileName); });
+}
+
+void AudioFileLoader::setCurrentSource(SampleSource::Ptr newSource)
+{
+    // Shared sources are kept alive by the registry instead
+    if (newSource != nullptr && !registry->contains(newSource.get()))
+        sourcePool.addIfNotAlreadyThere(newSource.get());
+
+    // The previous source stays in the pool, so the audio thread never drops the last reference
+    const juce::SpinLock::ScopedLockType lock(sourceLock);
+    std::swap(currentSource, newSource);
+}
+
+void AudioFileLoader::timerCallback()
+{
+    const auto current = getSource();
+
+    // Free sources that only the pool still references (not the engine, its grains or the freezer).
+    // A source published while it was decoding is handed over once the registry holds it.
+    for (int i = sourcePool.size(); --i >= 0;)
+    {
+        auto* source = sourcePool.getUnchecked(i);
+
+        if ((source != current.get() && source->getReferenceCount() == 1) || registry->contains(source))
+            sourcePool.remove(i);
+    }
+
+    registry->prune();
+}
@@ -1,28 +1,66 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "SampleSource.h"
+#include "DecodeCache.h"
+#include "SampleRegistry.h"
 
-class AudioFileLoader
+// Decodes audio files in the background and publishes each finished sample as a new
+// SampleSource. Loads run as jobs on a few threads shared by every loader in the process,
+// so zones and instances that each have a loader do not each hold a thread. Long files
+// are published as soon as decoding starts, then decoded in parallel on a second shared
+// pool, starting with the span grains are about to read. Instances that load the same
+// file share its source through the SampleRegistry, and the decoded result is kept in a
+// DecodeCache so the next load maps it instead, along with the peaks the waveform
+// displays draw from. Uncompressed WAV and AIFF files are memory-mapped rather than
+// decoded, and other files too large to hold in memory are streamed from disk instead.
+// The audio thread keeps playing the previous source until the swap, and old sources
+// are freed on the message thread once nothing references them.
+class AudioFileLoader : private juce::AsyncUpdater,
+                        private juce::Timer
 {
 public:
     AudioFileLoader();
-    ~AudioFileLoader();
+    ~AudioFileLoader() override;
 
+    // Queues the file for decoding, superseding any load in progress.
+    // Returns false if the file does not exist.
     bool loadFile(const juce::File& file);
     void clear();
 
+    // Safe to call from the audio thread
+    SampleSource::Ptr getSource() const;
+
+    // Keep a time-reversed copy of this and every later source
+    void prepareReversedBuffer();
+
+    // How decoded samples are held in memory. Automatic keeps 16-bit files as int16 and
+    // everything else as float32. Applies from the next load; mapped files are unaffected.
+    enum class StorageMode
+    {
+        automatic,
+        float32,
+        int16,
+        float16
+    };
+
+    void setStorageMode(StorageMode newMode);
+    StorageMode getStorageMode() const { return storageMode.load(); }
+
+    bool isLoading() const { return loadProgress.load() >= 0.0f; }
+    float getLoadProgress() const { return juce::jmax(0.0f, loadProgress.load()); }
+
+    // Details of the current source, for the message thread
     bool hasFile() const { return fileLoaded; }
-    const juce::AudioBuffer<float>& getBuffer() const { return audioBuffer; }
     double getSampleRate() const { return sampleRate; }
-    int getNumChannels() const { return audioBuffer.getNumChannels(); }
-    int getNumSamples() const { return audioBuffer.getNumSamples(); }
+    int getNumChannels() const { return numChannels; }
+    juce::int64 getNumSamples() const { return numSamples; }
     double getLengthInSeconds() const;
 
     juce::String getFileName() const { return fileName; }
 
-    // For waveform display
-    juce::AudioThumbnail& getThumbnail() { return thumbnail; }
-    juce::AudioThumbnailCache& getThumbnailCache() { return thumbnailCache; }
+    // SampleRegistry::makeFileKey() of the current file, or empty; safe to call from any thread
+    juce::String getFileKey() const;
 
     // Listener for file load events
     class Listener
@@ -37,16 +75,84 @@ public:
     void removeListener(Listener* listener);
 
 private:
+    class LoadJob;
+
+    // Runs on the load pool until no request is left
+    void processRequests();
+    bool shouldStop() const { return stopping.load(); }
+
+    void handleAsyncUpdate() override;
+    void timerCallback() override;
+
+    SampleSource::Ptr decode(const juce::File& file, const juce::String& fileKey, int request);
+    SampleSource::Ptr createMappedSource(const juce::File& file, const juce::String& name, int request);
+    bool decodeChunks(std::unique_ptr<juce::AudioFormatReader> firstReader, const juce::File& file,
+                      MemorySampleSource& source, int numWorkers, int request);
+    bool scanPeaks(const juce::File& file, SampleSource& source, int request);
+    bool publish(SampleSource::Ptr source, const juce::String& sourceFileKey, int request, bool complete);
+    SampleSource::SampleFormat getStorageFormat(const juce::AudioFormatReader& reader) const;
+    bool isCurrentRequest(int request) const;
+    void setCurrentSource(SampleSource::Ptr newSource);
+
     juce::AudioFormatManager formatManager;
-    juce::AudioBuffer<float> audioBuffer;
+
+    // One pool for the whole process, so restoring a session with many instances does
+    // not start a decoding thread per core for each of them
+    struct DecodeThreadPool : public juce::ThreadPool
+    {
+        DecodeThreadPool();
+    };
+
+    juce::SharedResourcePointer<DecodeThreadPool> decodePool;
+
+    // Loads wait on the decode pool's jobs, so they run on a pool of their own
+    struct LoadThreadPool : public juce::ThreadPool
+    {
+        LoadThreadPool();
+    };
+
+    juce::SharedResourcePointer<LoadThreadPool> loadPool;
+
+    DecodeCache decodeCache;
+    juce::SharedResourcePointer<SampleRegistry> registry;
+
+    // Published source, swapped on the message thread and copied by the audio thread
+    mutable juce::SpinLock sourceLock;
+    SampleSource::Ptr currentSource;
+
+    // Every unshared source that may still be referenced; pruned on the message thread
+    juce::ReferenceCountedArray<SampleSource> sourcePool;
+
+    // Hand-over between the message thread and the decoding thread
+    juce::CriticalSection requestLock;
+    int requestCount = 0;    // Bumped by every load or clear, so stale decodes are dropped
+    juce::File requestedFile;
+    bool loadJobQueued = false;  // Until the job finds no request left
+    juce::String decodedFileKey;
+    juce::String currentFileKey;
+    int decodedRequest = 0;
+    bool decodedComplete = false;
+    SampleSource::Ptr decodedSource;
+    std::atomic<float> loadProgress { -1.0f };
+    std::atomic<bool> keepReversedBuffer { false };
+    std::atomic<bool> stopping { false };
+    std::atomic<StorageMode> storageMode { StorageMode::automatic };
+
     double sampleRate = 44100.0;
+    int numChannels = 0;
+    juce::int64 numSamples = 0;
     bool fileLoaded = false;
     juce::String fileName;
 
-    juce::AudioThumbnailCache thumbnailCache;
-    juce::AudioThumbnail thumbnail;
-
     juce::ListenerList<Listener> listeners;
 
+    static constexpr int decodeChunkSamples = MemorySampleSource::validBlockSize;
+    static constexpr int minSamplesPerWorker = 16 * decodeChunkSamples;
+    static constexpr int seekPrerollSamples = 4096;  // Lets MP3's bit reservoir refill after a seek
+    static constexpr int progressIntervalMs = 20;
+    static constexpr juce::int64 streamingThresholdBytes = 512LL * 1024 * 1024;
+    static constexpr int poolCleanupIntervalMs = 1000;
+    static constexpr int maxConcurrentLoads = 4;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioFileLoader)
 };
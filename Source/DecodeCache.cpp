@@ -0,0 +1,135 @@
+#include "DecodeCache.h"
+
+DecodeCache::DecodeCache()
+    : directory(juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                    .getChildFile("PinkGrain")
+                    .getChildFile("DecodeCache"))
+{
+}
+
+juce::File DecodeCache::getEntryFile(const juce::String& fileKey, SampleSource::SampleFormat storageFormat) const
+{
+    return directory.getChildFile(fileKey + "-" + juce::String(static_cast<int>(storageFormat)) + ".wav");
+}
+
+juce::File DecodeCache::findEntry(const juce::String& fileKey, SampleSource::SampleFormat storageFormat) const
+{
+    auto entry = getEntryFile(fileKey, storageFormat);
+    if (!entry.existsAsFile())
+        return {};
+
+    // Entries are evicted by modification time, which unlike access time is always kept
+    entry.setLastModificationTime(juce::Time::getCurrentTime());
+    return entry;
+}
+
+bool DecodeCache::addEntry(const juce::String& fileKey, const MemorySampleSource& source, const std::function<bool()>& shouldContinue) const
+{
+    const auto entry = getEntryFile(fileKey, source.getStorageFormat());
+    const juce::int64 length = source.getLengthInSamples();
+    const int numChannels = source.getNumChannels();
+
+    if (!directory.createDirectory().wasOk() || length <= 0 || numChannels <= 0)
+        return false;
+
+    // Samples held as int16 are cached as 16-bit and everything else as float, both of which
+    // MappedSampleSource reads in place. Written to a temporary file and renamed, so other
+    // instances never map a partial entry.
+    const int bitsPerSample = source.getStorageFormat() == SampleSource::SampleFormat::int16 ? 16 : 32;
+    juce::TemporaryFile temporary(entry);
+    {
+        std::unique_ptr<juce::FileOutputStream> stream(temporary.getFile().createOutputStream());
+        if (stream == nullptr)
+            return false;
+
+        juce::WavAudioFormat wav;
+        std::unique_ptr<juce::AudioFormatWriter> writer(wav.createWriterFor(stream.get(), source.getSampleRate(),
+                                                                            static_cast<unsigned int>(numChannels), bitsPerSample, {}, 0));
+        if (writer == nullptr)
+            return false;
+
+        stream.release();  // Now owned by the writer
+
+        juce::AudioBuffer<float> chunk(numChannels, writeChunkSamples);
+
+        for (juce::int64 start = 0; start < length; start += writeChunkSamples)
+        {
+            if (!shouldContinue())
+                return false;
+
+            const int numSamples = static_cast<int>(juce::jmin(length - start, static_cast<juce::int64>(writeChunkSamples)));
+            source.readChunk(static_cast<int>(start), chunk, numSamples);
+
+            if (!writer->writeFromAudioSampleBuffer(chunk, 0, numSamples))
+                return false;
+        }
+    }
+
+    if (!temporary.overwriteTargetFileWithTemporary())
+        return false;
+
+    evict();
+    return true;
+}
+
+juce::File DecodeCache::getPeaksFile(const juce::String& fileKey) const
+{
+    return directory.getChildFile(fileKey + ".peaks");
+}
+
+bool DecodeCache::readPeaks(const juce::String& fileKey, SampleSource& source) const
+{
+    const auto peaksFile = getPeaksFile(fileKey);
+    juce::FileInputStream stream(peaksFile);
+
+    if (!stream.openedOk()
+        || !source.getPeakPyramid().readFrom(stream, source.getLengthInSamples(), source.getNumChannels()))
+        return false;
+
+    peaksFile.setLastModificationTime(juce::Time::getCurrentTime());
+    return true;
+}
+
+bool DecodeCache::writePeaks(const juce::String& fileKey, const SampleSource& source) const
+{
+    const auto peaksFile = getPeaksFile(fileKey);
+
+    if (!source.getPeakPyramid().isReady() || peaksFile.existsAsFile() || !directory.createDirectory().wasOk())
+        return false;
+
+    juce::TemporaryFile temporary(peaksFile);
+    {
+        juce::FileOutputStream stream(temporary.getFile());
+
+        if (!stream.openedOk() || !source.getPeakPyramid().writeTo(stream))
+            return false;
+    }
+
+    if (!temporary.overwriteTargetFileWithTemporary())
+        return false;
+
+    evict();
+    return true;
+}
+
+void DecodeCache::evict() const
+{
+    auto entries = directory.findChildFiles(juce::File::findFiles, false, "*.wav;*.peaks");
+
+    std::sort(entries.begin(), entries.end(), [](const juce::File& a, const juce::File& b)
+    {
+        return a.getLastModificationTime() > b.getLastModificationTime();
+    });
+
+    // Keep the most recently used entries that fit; an entry another instance still has
+    // mapped may refuse to be deleted, and goes on a later pass
+    juce::int64 totalBytes = 0;
+
+    for (const auto& entry : entries)
+    {
+        totalBytes += entry.getSize();
+
+        if (totalBytes > sizeLimitBytes)
+            entry.deleteFile();
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+// Decoded copies of compressed files, kept as WAV files under the app data directory so a
+// repeat load maps the copy instead of decoding the file again. Entries are keyed by the
+// file's SampleRegistry::makeFileKey() and the format the samples were stored in. Once the
+// cache grows past its size limit the least recently used entries are deleted. The peak
+// pyramid of every loaded file is kept alongside, so waveforms redraw without a rescan.
+// Several instances may share the directory.
+class DecodeCache
+{
+public:
+    DecodeCache();
+
+    // The entry for the file decoded to the given format, or a nonexistent file.
+    // Finding an entry counts as using it.
+    juce::File findEntry(const juce::String& fileKey, SampleSource::SampleFormat storageFormat) const;
+
+    // Writes the decoded source as the file's entry, then evicts old entries. Leaves no entry
+    // behind and returns false if writing fails or shouldContinue() asks to stop.
+    bool addEntry(const juce::String& fileKey, const MemorySampleSource& source, const std::function<bool()>& shouldContinue) const;
+
+    // Fills the source's peak pyramid from the file's sidecar, if there is a matching one
+    bool readPeaks(const juce::String& fileKey, SampleSource& source) const;
+
+    // Writes the source's finished peak pyramid as the file's sidecar, unless it has one
+    bool writePeaks(const juce::String& fileKey, const SampleSource& source) const;
+
+    static constexpr juce::int64 sizeLimitBytes = 4LL * 1024 * 1024 * 1024;
+
+private:
+    juce::File getEntryFile(const juce::String& fileKey, SampleSource::SampleFormat storageFormat) const;
+    juce::File getPeaksFile(const juce::String& fileKey) const;
+    void evict() const;
+
+    const juce::File directory;
+
+    static constexpr int writeChunkSamples = 65536;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DecodeCache)
+};
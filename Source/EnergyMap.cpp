@@ -0,0 +1,90 @@
+#include "EnergyMap.h"
+
+void EnergyMap::build(const juce::AudioBuffer<float>& buffer)
+{
+    prepare(buffer.getNumSamples());
+    addChunk(0, buffer, buffer.getNumSamples());
+    finish();
+}
+
+void EnergyMap::prepare(juce::int64 totalSamples)
+{
+    ready = false;
+    numSamples = totalSamples;
+    const auto numBlocks = static_cast<size_t>((numSamples + blockSize - 1) / blockSize);
+
+    peaks.assign(numBlocks, 0.0f);
+    rms.assign(numBlocks, 0.0f);
+    audibleBlocksBefore.assign(numBlocks + 1, 0);
+}
+
+void EnergyMap::addChunk(juce::int64 startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples)
+{
+    jassert(startSample % blockSize == 0);
+
+    const int numChannels = chunk.getNumChannels();
+    const int numBlocks = (numChunkSamples + blockSize - 1) / blockSize;
+
+    for (int chunkBlock = 0; chunkBlock < numBlocks; ++chunkBlock)
+    {
+        const auto block = static_cast<size_t>(startSample / blockSize + chunkBlock);
+        const int start = chunkBlock * blockSize;
+        const int length = juce::jmin(blockSize, numChunkSamples - start);
+
+        float peak = 0.0f;
+        float sumOfSquares = 0.0f;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const float* data = chunk.getReadPointer(channel, start);
+
+            for (int i = 0; i < length; ++i)
+            {
+                peak = juce::jmax(peak, std::abs(data[i]));
+                sumOfSquares += data[i] * data[i];
+            }
+        }
+
+        peaks[block] = peak;
+        rms[block] = numChannels > 0
+            ? std::sqrt(sumOfSquares / static_cast<float>(length * numChannels))
+            : 0.0f;
+    }
+}
+
+void EnergyMap::finish()
+{
+    for (size_t block = 0; block < peaks.size(); ++block)
+    {
+        const bool audible = peaks[block] >= silenceThreshold;
+        audibleBlocksBefore[block + 1] = audibleBlocksBefore[block] + (audible ? 1 : 0);
+    }
+
+    ready.store(true, std::memory_order_release);
+}
+
+void EnergyMap::clear()
+{
+    ready = false;
+    peaks.clear();
+    rms.clear();
+    audibleBlocksBefore.clear();
+    numSamples = 0;
+}
+
+bool EnergyMap::isSilent(juce::int64 startSample, juce::int64 endSample) const
+{
+    if (isEmpty())
+        return false;
+
+    startSample = juce::jmax(static_cast<juce::int64>(0), startSample);
+    endSample = juce::jmin(numSamples, endSample);
+
+    if (startSample >= endSample)
+        return true;
+
+    const auto firstBlock = static_cast<size_t>(startSample / blockSize);
+    const auto lastBlock = static_cast<size_t>((endSample - 1) / blockSize);
+
+    return audibleBlocksBefore[lastBlock + 1] == audibleBlocksBefore[firstBlock];
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Per-block peak and RMS levels of a source buffer, computed once at load.
+// Lets the engine answer "is this span of the source silent?" in constant time.
+class EnergyMap
+{
+public:
+    static constexpr int blockSize = 256;
+    static constexpr float silenceThreshold = 3.1623e-5f;  // -90 dBFS
+
+    EnergyMap() = default;
+
+    void build(const juce::AudioBuffer<float>& buffer);
+    void clear();
+
+    // Incremental form of build() for sources analysed in chunks. Chunks must start on a
+    // block boundary and must not overlap, but may be added in any order and from several
+    // threads at once. Until finish() the map reports no silence, so it may already be shared.
+    void prepare(juce::int64 totalSamples);
+    void addChunk(juce::int64 startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples);
+    void finish();
+
+    bool isEmpty() const { return !ready.load(std::memory_order_acquire); }
+    int getNumBlocks() const { return static_cast<int>(peaks.size()); }
+    float getPeak(int block) const { return peaks[static_cast<size_t>(block)]; }
+    float getRms(int block) const { return rms[static_cast<size_t>(block)]; }
+
+    // True when every sample in [startSample, endSample) is below the silence threshold.
+    // Samples outside the buffer count as silent; an empty map never reports silence.
+    bool isSilent(juce::int64 startSample, juce::int64 endSample) const;
+
+    // The same query for a span of the time-reversed copy of the buffer
+    bool isSilentReversed(juce::int64 startSample, juce::int64 endSample) const { return isSilent(numSamples - endSample, numSamples - startSample); }
+
+private:
+    std::vector<float> peaks;
+    std::vector<float> rms;
+    std::vector<int> audibleBlocksBefore;  // Prefix count of blocks above the threshold
+    std::atomic<bool> ready { false };
+    juce::int64 numSamples = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(EnergyMap)
+};
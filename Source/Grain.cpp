@@ -4,9 +4,9 @@ Grain::Grain()
 {
 }
 
-void Grain::start(const juce::AudioBuffer<float>& sourceBuffer,
-                  double srcSampleRate,
-                  int startSampleInSource,
+void Grain::start(const SampleSource& newSource,
+                  bool readReversedCopy,
+                  juce::int64 startSampleInSource,
                   int grainLengthSamples,
                   float pitch,
                   float pan,
@@ -14,12 +14,12 @@ void Grain::start(const juce::AudioBuffer<float>& sourceBuffer,
                   float decay,
                   float sustain,
                   float release,
-                  bool rev,
                   float vel,
                   int midiNoteNumber)
 {
-    source = &sourceBuffer;
-    sourceSampleRate = srcSampleRate;
+    sampleSource = &newSource;
+    energyMap = &newSource.getEnergyMap();
+    sourceSampleRate = newSource.getSampleRate();
     sourceSampleStart = startSampleInSource;
     grainLength = grainLengthSamples;
     pitchRatio = pitch;
@@ -27,7 +27,7 @@ void Grain::start(const juce::AudioBuffer<float>& sourceBuffer,
     decaySamples = decay;
     sustainLevel = sustain;
     releaseSamples = release;
-    reverse = rev;
+    reversedSource = readReversedCopy;
     velocity = vel;
     midiNote = midiNoteNumber;
 
@@ -36,7 +36,7 @@ void Grain::start(const juce::AudioBuffer<float>& sourceBuffer,
     panLeft = std::cos(panAngle + juce::MathConstants<float>::halfPi * 0.25f);
     panRight = std::sin(panAngle + juce::MathConstants<float>::halfPi * 0.25f);
 
-    currentPosition = reverse ? static_cast<double>(grainLength - 1) : 0.0;
+    currentPosition = 0.0;
     samplesProcessed = 0;
     currentEnvelopeLevel = 0.0f;
 
@@ -47,88 +47,33 @@ void Grain::start(const juce::AudioBuffer<float>& sourceBuffer,
     releasing = false;
     releaseSampleStart = 0;
     releaseStartLevel = 0.0f;
+
+    // Reset crossfade state
+    fadeGain = 1.0f;
+    fadeStep = 0.0f;
+
+    // Filter is configured separately through setFilter()
+    filterEnabled = false;
 }
 
-void Grain::process(juce::AudioBuffer<float>& outputBuffer,
-                    int startSample,
-                    int numSamples,
-                    double outputSampleRate)
+void Grain::setFilter(float cutoffHz, double outputSampleRate)
 {
-    if (!active || done || source == nullptr)
+    const float nyquistLimit = static_cast<float>(outputSampleRate) * 0.45f;
+    filterEnabled = cutoffHz < juce::jmin(maxFilterCutoffHz, nyquistLimit);
+
+    filterIc1[0] = filterIc1[1] = 0.0f;
+    filterIc2[0] = filterIc2[1] = 0.0f;
+
+    if (!filterEnabled)
         return;
 
-    const int numSourceChannels = source->getNumChannels();
-    const int sourceLength = source->getNumSamples();
-    const double sampleRateRatio = sourceSampleRate / outputSampleRate;
-    const double positionIncrement = pitchRatio * sampleRateRatio * (reverse ? -1.0 : 1.0);
+    // Butterworth response (k = 1/Q = sqrt(2))
+    const float g = std::tan(juce::MathConstants<float>::pi * juce::jmax(20.0f, cutoffHz) / static_cast<float>(outputSampleRate));
+    const float k = 1.41421356f;
 
-    for (int i = 0; i < numSamples; ++i)
-    {
-        // Check if we've reached the end of the grain or finished releasing
-        if (samplesProcessed >= grainLength)
-        {
-            active = false;
-            done = true;
-            return;
-        }
-
-        // Calculate envelope
-        currentEnvelopeLevel = getEnvelope();
-
-        // If releasing and envelope has reached zero, we're done
-        if (releasing && currentEnvelopeLevel <= 0.001f)
-        {
-            active = false;
-            done = true;
-            return;
-        }
-
-        // Get source position
-        int sourcePos = sourceSampleStart + static_cast<int>(currentPosition);
-
-        // Check bounds
-        if (sourcePos < 0 || sourcePos >= sourceLength)
-        {
-            currentPosition += positionIncrement;
-            ++samplesProcessed;
-            continue;
-        }
-
-        // Get samples from source (with interpolation)
-        float leftSample = 0.0f;
-        float rightSample = 0.0f;
-
-        double actualPos = sourceSampleStart + currentPosition;
-
-        if (numSourceChannels == 1)
-        {
-            // Mono source - use same sample for both channels
-            float sample = interpolateSample(*source, 0, actualPos);
-            leftSample = sample;
-            rightSample = sample;
-        }
-        else
-        {
-            // Stereo source
-            leftSample = interpolateSample(*source, 0, actualPos);
-            rightSample = interpolateSample(*source, 1, actualPos);
-        }
-
-        // Apply envelope, velocity, and panning
-        leftSample *= currentEnvelopeLevel * velocity * panLeft;
-        rightSample *= currentEnvelopeLevel * velocity * panRight;
-
-        // Mix into output buffer
-        int outputSample = startSample + i;
-        if (outputSample < outputBuffer.getNumSamples())
-        {
-            outputBuffer.addSample(0, outputSample, leftSample);
-            outputBuffer.addSample(1, outputSample, rightSample);
-        }
-
-        currentPosition += positionIncrement;
-        ++samplesProcessed;
-    }
+    filterA1 = 1.0f / (1.0f + g * (g + k));
+    filterA2 = g * filterA1;
+    filterA3 = g * filterA2;
 }
 
 void Grain::triggerRelease()
@@ -141,82 +86,168 @@ void Grain::triggerRelease()
     releaseStartLevel = currentEnvelopeLevel;
 }
 
-float Grain::getEnvelope()
+void Grain::fadeOut(int numSamples, float startGain)
 {
-    if (grainLength <= 0)
-        return 0.0f;
+    if (!active)
+        return;
+
+    fadeGain *= startGain;
+    fadeStep = fadeGain / static_cast<float>(juce::jmax(1, numSamples));
+}
+
+int Grain::getRemainingSamples() const
+{
+    if (!active)
+        return 0;
+
+    int remaining = grainLength - samplesProcessed;
 
-    // If we're in early release mode (triggered by note-off)
     if (releasing)
+        remaining = juce::jmin(remaining, static_cast<int>(releaseSamples) - (samplesProcessed - releaseSampleStart));
+
+    if (fadeStep > 0.0f)
+        remaining = juce::jmin(remaining, static_cast<int>(std::ceil(fadeGain / fadeStep)));
+
+    return juce::jmax(0, remaining);
+}
+
+void Grain::stop()
+{
+    active = false;
+    done = true;
+}
+
+bool Grain::isRemainingSpanSilent(double outputSampleRate) const
+{
+    if (!isFilterSettled())
+        return false;
+
+    int remaining = grainLength - samplesProcessed;
+    if (releasing)
+        remaining = juce::jmin(remaining, static_cast<int>(releaseSamples) - (samplesProcessed - releaseSampleStart));
+
+    const double readStart = static_cast<double>(sourceSampleStart) + currentPosition;
+    return isSourceSilent(readStart, readStart + getIncrement(outputSampleRate) * juce::jmax(0, remaining));
+}
+
+bool Grain::isSpanSilent(int numSamples, double outputSampleRate) const
+{
+    if (!isFilterSettled())
+        return false;
+
+    const double readStart = static_cast<double>(sourceSampleStart) + currentPosition;
+    return isSourceSilent(readStart, readStart + getIncrement(outputSampleRate) * numSamples);
+}
+
+bool Grain::acquireWindow(int numSamples, double outputSampleRate, SampleSource::Window& window) const
+{
+    const double readStart = static_cast<double>(sourceSampleStart) + currentPosition;
+    juce::int64 first = 0, end = 0;
+    getReadSpan(readStart, readStart + getIncrement(outputSampleRate) * numSamples, first, end);
+
+    return sampleSource->acquireWindow(first, end, reversedSource, window);
+}
+
+void Grain::skip(int numSamples, double outputSampleRate)
+{
+    if (!active)
+        return;
+
+    currentPosition += getIncrement(outputSampleRate) * numSamples;
+    samplesProcessed += numSamples;
+    fadeGain -= fadeStep * static_cast<float>(numSamples);
+
+    filterIc1[0] = filterIc1[1] = 0.0f;
+    filterIc2[0] = filterIc2[1] = 0.0f;
+
+    const bool releaseFinished = releasing && samplesProcessed - releaseSampleStart >= static_cast<int>(releaseSamples);
+
+    if (samplesProcessed >= grainLength || releaseFinished || fadeGain <= 0.0f)
     {
-        int samplesSinceRelease = samplesProcessed - releaseSampleStart;
-        if (releaseSamples > 0.0f && samplesSinceRelease < static_cast<int>(releaseSamples))
-        {
-            float releaseProgress = static_cast<float>(samplesSinceRelease) / releaseSamples;
-            float env = releaseStartLevel * (1.0f - releaseProgress);
-            return 0.5f * (1.0f - std::cos(env * juce::MathConstants<float>::pi));
-        }
-        return 0.0f;
+        stop();
+        return;
     }
 
-    float env = 1.0f;
+    currentEnvelopeLevel = computeEnvelopeLevel();
+}
+
+void Grain::getReadSpan(double readStart, double readEnd, juce::int64& first, juce::int64& end)
+{
+    // Interpolation reads one sample past the last position
+    first = static_cast<juce::int64>(std::floor(readStart));
+    end = static_cast<juce::int64>(std::floor(readEnd)) + 2;
+}
 
-    // ADSR envelope
-    // Attack phase
-    if (attackSamples > 0.0f && samplesProcessed < static_cast<int>(attackSamples))
+bool Grain::isSourceSilent(double readStart, double readEnd) const
+{
+    if (energyMap == nullptr)
+        return false;
+
+    juce::int64 first = 0, end = 0;
+    getReadSpan(readStart, readEnd, first, end);
+
+    return reversedSource ? energyMap->isSilentReversed(first, end) : energyMap->isSilent(first, end);
+}
+
+bool Grain::isFilterSettled() const
+{
+    if (!filterEnabled)
+        return true;
+
+    const float threshold = EnergyMap::silenceThreshold;
+    return std::abs(filterIc1[0]) < threshold && std::abs(filterIc1[1]) < threshold
+        && std::abs(filterIc2[0]) < threshold && std::abs(filterIc2[1]) < threshold;
+}
+
+float Grain::computeEnvelopeLevel() const
+{
+    // Scalar copy of the envelope GrainLane renders, for grains that skip a span
+    const float n = static_cast<float>(samplesProcessed);
+    const float wholeRelease = std::floor(releaseSamples);
+    float env = sustainLevel;
+
+    if (releasing)
     {
-        env = static_cast<float>(samplesProcessed) / attackSamples;
+        const float sinceRelease = n - static_cast<float>(releaseSampleStart);
+        env = sinceRelease < wholeRelease ? releaseStartLevel * (1.0f - sinceRelease / releaseSamples) : 0.0f;
     }
-    // Decay phase
-    else if (decaySamples > 0.0f && samplesProcessed < static_cast<int>(attackSamples + decaySamples))
+    else if (attackSamples > 0.0f && n < std::floor(attackSamples))
     {
-        int decaySample = samplesProcessed - static_cast<int>(attackSamples);
-        float decayProgress = static_cast<float>(decaySample) / decaySamples;
-        env = 1.0f - (1.0f - sustainLevel) * decayProgress;
+        env = n / attackSamples;
     }
-    // Sustain phase
-    else
+    else if (decaySamples > 0.0f && n < std::floor(attackSamples + decaySamples))
     {
-        env = sustainLevel;
-
-        // Natural release phase (at end of grain)
-        if (releaseSamples > 0.0f)
-        {
-            int releaseStart = grainLength - static_cast<int>(releaseSamples);
-            if (samplesProcessed >= releaseStart)
-            {
-                float releaseProgress = static_cast<float>(samplesProcessed - releaseStart) / releaseSamples;
-                env = sustainLevel * (1.0f - releaseProgress);
-            }
-        }
+        const float attackEnd = attackSamples > 0.0f ? std::floor(attackSamples) : 0.0f;
+        env = 1.0f - (1.0f - sustainLevel) * (n - attackEnd) / decaySamples;
+    }
+    else if (releaseSamples > 0.0f && n >= static_cast<float>(grainLength) - wholeRelease)
+    {
+        env = sustainLevel * (1.0f - (n - (static_cast<float>(grainLength) - wholeRelease)) / releaseSamples);
     }
 
-    // Apply a slight smoothing curve (raised cosine)
-    return 0.5f * (1.0f - std::cos(env * juce::MathConstants<float>::pi));
+    env = juce::jlimit(0.0f, 1.0f, env);
+    return 0.5f * (1.0f - std::cos(juce::MathConstants<float>::pi * env));
 }
 
-float Grain::interpolateSample(const juce::AudioBuffer<float>& buffer, int channel, double position) const
+juce::int64 Grain::getStartSampleInSource() const
 {
-    const int numSamples = buffer.getNumSamples();
-
-    if (position < 0.0 || position >= numSamples - 1)
-        return 0.0f;
+    if (reversedSource)
+        return getSourceLength() - sourceSampleStart - grainLength;
 
-    int index0 = static_cast<int>(position);
-    int index1 = index0 + 1;
-    float frac = static_cast<float>(position - index0);
-
-    if (index1 >= numSamples)
-        index1 = index0;
-
-    const float* data = buffer.getReadPointer(channel);
-    return data[index0] + frac * (data[index1] - data[index0]);
+    // Relative to the oldest sample a live source still holds
+    return sourceSampleStart - (sampleSource != nullptr ? sampleSource->getFirstSample() : 0);
 }
 
 float Grain::getCurrentPosition() const
 {
-    if (source == nullptr || source->getNumSamples() == 0)
+    if (getSourceLength() == 0)
         return 0.0f;
 
-    return static_cast<float>(sourceSampleStart + currentPosition) / static_cast<float>(source->getNumSamples());
+    const double position = static_cast<double>(sourceSampleStart - sampleSource->getFirstSample()) + currentPosition;
+    const double length = static_cast<double>(getSourceLength());
+
+    if (reversedSource)
+        return static_cast<float>((length - 1.0 - position) / length);
+
+    return static_cast<float>(position / length);
 }
@@ -1,15 +1,17 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "SampleSource.h"
 
 class Grain
 {
 public:
     Grain();
 
-    void start(const juce::AudioBuffer<float>& sourceBuffer,
-               double sourceSampleRate,
-               int startSampleInSource,
+    // Reversed grains read the source's reversed view, with the start in reversed coordinates
+    void start(const SampleSource& sampleSource,
+               bool readReversedCopy,
+               juce::int64 startSampleInSource,
                int grainLengthSamples,
                float pitchRatio,
                float pan,
@@ -17,14 +19,11 @@ public:
                float decaySamples,
                float sustainLevel,
                float releaseSamples,
-               bool reverse,
                float velocity,
                int midiNoteNumber);
 
-    void process(juce::AudioBuffer<float>& outputBuffer,
-                 int startSample,
-                 int numSamples,
-                 double outputSampleRate);
+    // Per-grain lowpass; cutoffs at or above maxFilterCutoffHz bypass the filter
+    void setFilter(float cutoffHz, double outputSampleRate);
 
     bool isActive() const { return active; }
     bool isDone() const { return done; }
@@ -32,22 +31,60 @@ public:
     // Trigger early release phase (called on note-off)
     void triggerRelease();
 
+    // Linear fade to silence independent of the envelope (used for crossfades), from the
+    // current fade scaled by startGain
+    void fadeOut(int numSamples, float startGain = 1.0f);
+
+    // Deactivate immediately
+    void stop();
+
+    // Source samples read per output sample
+    double getIncrement(double outputSampleRate) const { return pitchRatio * (sourceSampleRate / outputSampleRate); }
+
+    // Silence culling: true when the grain would only read silence for the rest of its
+    // life, or over the next numSamples. Never true while the filter is still ringing.
+    bool isRemainingSpanSilent(double outputSampleRate) const;
+    bool isSpanSilent(int numSamples, double outputSampleRate) const;
+
+    // Advance by numSamples without rendering, for spans that would only read silence
+    void skip(int numSamples, double outputSampleRate);
+
+    // Pin the source samples the grain reads over the next numSamples; false when not resident
+    bool acquireWindow(int numSamples, double outputSampleRate, SampleSource::Window& window) const;
+    void releaseWindow(const SampleSource::Window& window) const { sampleSource->releaseWindow(window); }
+
     float getCurrentPosition() const;
     float getEnvelopeLevel() const { return currentEnvelopeLevel; }
-    int getStartSampleInSource() const { return sourceSampleStart; }
+    juce::int64 getStartSampleInSource() const;
     int getGrainLength() const { return grainLength; }
+
+    // Output samples until the grain ends, taking a release or fade in progress into account
+    int getRemainingSamples() const;
     float getProgress() const { return grainLength > 0 ? static_cast<float>(samplesProcessed) / static_cast<float>(grainLength) : 0.0f; }
-    int getSourceLength() const { return source ? source->getNumSamples() : 0; }
+    juce::int64 getSourceLength() const { return sampleSource != nullptr ? sampleSource->getLengthInSamples() : 0; }
     int getMidiNote() const { return midiNote; }
 
+    // Multi-timbral layer the grain plays for; set by the engine after start()
+    void setLayer(int layerIndex) { layer = layerIndex; }
+    int getLayer() const { return layer; }
+    const SampleSource* getSampleSource() const { return sampleSource; }
+
+    static constexpr float maxFilterCutoffHz = 20000.0f;
+
 private:
-    float getEnvelope();
-    float interpolateSample(const juce::AudioBuffer<float>& buffer, int channel, double position) const;
+    // Rendering is done by GrainLane, which processes several grains at once
+    friend class GrainLane;
 
-    const juce::AudioBuffer<float>* source = nullptr;
+    static void getReadSpan(double readStart, double readEnd, juce::int64& first, juce::int64& end);
+    bool isSourceSilent(double readStart, double readEnd) const;
+    bool isFilterSettled() const;
+    float computeEnvelopeLevel() const;
+
+    const SampleSource* sampleSource = nullptr;  // Kept alive by the engine while the grain is active
+    const EnergyMap* energyMap = nullptr;  // Map of the forward buffer, mirrored when reading the reversed copy
     double sourceSampleRate = 44100.0;
 
-    int sourceSampleStart = 0;
+    juce::int64 sourceSampleStart = 0;
     int grainLength = 0;
     float pitchRatio = 1.0f;
     float panLeft = 1.0f;
@@ -56,9 +93,10 @@ private:
     float decaySamples = 0.0f;
     float sustainLevel = 1.0f;
     float releaseSamples = 0.0f;
-    bool reverse = false;
+    bool reversedSource = false;  // Reading a time-reversed copy; positions are mirrored for display
     float velocity = 1.0f;
     int midiNote = -1;
+    int layer = 0;
 
     double currentPosition = 0.0;
     int samplesProcessed = 0;
@@ -72,5 +110,17 @@ private:
     int releaseSampleStart = 0;
     float releaseStartLevel = 0.0f;
 
+    // Crossfade state
+    float fadeGain = 1.0f;
+    float fadeStep = 0.0f;
+
+    // State-variable lowpass (trapezoidal SVF), state per output channel
+    bool filterEnabled = false;
+    float filterA1 = 1.0f;
+    float filterA2 = 0.0f;
+    float filterA3 = 0.0f;
+    float filterIc1[2] = { 0.0f, 0.0f };
+    float filterIc2[2] = { 0.0f, 0.0f };
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Grain)
 };
@@ -1,11 +1,17 @@
 #include "GrainEngine.h"
+#include "TextureFreezer.h"
 
-GrainEngine::GrainEngine()
+GrainEngine::GrainEngine(bool enableFreeze, bool isRealtime)
+    : realtime(isRealtime),
+      residencyWaitLeftMs(maxResidencyWaitMs)
 {
     for (auto& grain : grains)
     {
         grain = std::make_unique<Grain>();
     }
+
+    if (enableFreeze)
+        freezer = std::make_unique<TextureFreezer>();
 }
 
 GrainEngine::~GrainEngine()
@@ -15,142 +21,473 @@ GrainEngine::~GrainEngine()
 void GrainEngine::prepare(double sampleRate, int /*samplesPerBlock*/)
 {
     outputSampleRate = sampleRate;
-    samplesUntilNextGrain = 0.0;
+
+    for (auto& layer : layers)
+        layer.samplesUntilNextGrain = 0.0;
+
+    if (freezer != nullptr)
+        freezer->prepare(sampleRate);
 }
 
-void GrainEngine::setSourceBuffer(const juce::AudioBuffer<float>* buffer, double srcSampleRate)
+void GrainEngine::setSource(SampleSource::Ptr newSource)
 {
     juce::ScopedLock lock(grainLock);
-    sourceBuffer = buffer;
-    sourceSampleRate = srcSampleRate;
+
+    if (newSource == source)
+        return;
+
+    if (newSource == nullptr)
+    {
+        // Nothing left to play the old source, so no grain may keep it alive; grains of the
+        // zones play on
+        for (auto& grain : grains)
+        {
+            if (zones == nullptr || !zones->uses(grain->getSampleSource()))
+                grain->stop();
+        }
+
+        for (auto& retiring : retiringSources)
+            retiring = nullptr;
+
+        // process() may not run again to drop the stopped grains from the render list
+        if (zones == nullptr)
+        {
+            numInRenderList = 0;
+            inRenderList.fill(false);
+        }
+    }
+    else if (source != nullptr)
+    {
+        retireSource(source);
+    }
+
+    source = std::move(newSource);
 }
 
-void GrainEngine::noteOn(int midiNote, float velocity)
+void GrainEngine::setZones(ZoneMap::Ptr newZones)
 {
-    activeNotes[midiNote] = velocity;
+    juce::ScopedLock lock(grainLock);
+
+    if (newZones == zones)
+        return;
+
+    // Grains keep playing the samples of zones that were dropped, like a replaced source
+    if (zones != nullptr)
+    {
+        for (const auto& zone : zones->getZones())
+        {
+            if (zone.source != nullptr && zone.source != source && (newZones == nullptr || !newZones->uses(zone.source.get())))
+                retireSource(zone.source);
+        }
+    }
+
+    zones = std::move(newZones);
 }
 
-void GrainEngine::noteOff(int midiNote)
+void GrainEngine::retireSource(const SampleSource::Ptr& retiredSource)
 {
-    activeNotes.erase(midiNote);
+    if (std::find(retiringSources.begin(), retiringSources.end(), retiredSource) != retiringSources.end())
+        return;
+
+    for (auto& retiring : retiringSources)
+    {
+        if (retiring == nullptr)
+        {
+            retiring = retiredSource;
+            return;
+        }
+    }
+
+    // Too many swaps in flight: silence the grains of the oldest source to make room
+    for (auto& grain : grains)
+    {
+        if (grain->isActive() && grain->getSampleSource() == retiringSources[0].get())
+            grain->stop();
+    }
+
+    std::move(retiringSources.begin() + 1, retiringSources.end(), retiringSources.begin());
+    retiringSources.back() = retiredSource;
+}
+
+void GrainEngine::releaseFinishedSources()
+{
+    for (auto& retiring : retiringSources)
+    {
+        if (retiring == nullptr)
+            continue;
+
+        const bool stillPlaying = std::any_of(grains.begin(), grains.end(), [&retiring](const auto& grain)
+        {
+            return grain->isActive() && grain->getSampleSource() == retiring.get();
+        });
+
+        // The loader frees the source on the message thread once nothing references it
+        if (!stillPlaying)
+            retiring = nullptr;
+    }
+}
+
+void GrainEngine::noteOn(int midiNote, float velocity, int layer)
+{
+    auto& target = layers[static_cast<size_t>(layer)];
+
+    // The first note after silence spawns its first grain straight away
+    if (target.activeNotes.empty())
+        target.samplesUntilNextGrain = 0.0;
+
+    target.activeNotes[midiNote] = velocity;
+}
+
+void GrainEngine::noteOff(int midiNote, int layer)
+{
+    layers[static_cast<size_t>(layer)].activeNotes.erase(midiNote);
 
     // Trigger release only on grains that belong to this specific note
     juce::ScopedLock lock(grainLock);
     for (auto& grain : grains)
     {
-        if (grain->isActive() && grain->getMidiNote() == midiNote)
+        if (grain->isActive() && grain->getMidiNote() == midiNote && grain->getLayer() == layer)
         {
             grain->triggerRelease();
         }
     }
+
+    if (freezer != nullptr && layer == 0)
+        freezer->releaseLoop(midiNote, static_cast<int>((layers[0].params.releaseMs / 1000.0f) * outputSampleRate));
 }
 
 void GrainEngine::allNotesOff()
 {
-    activeNotes.clear();
+    for (int layer = 0; layer < MAX_LAYERS; ++layer)
+        allNotesOff(layer);
+}
+
+void GrainEngine::allNotesOff(int layer)
+{
+    layers[static_cast<size_t>(layer)].activeNotes.clear();
 
-    // Trigger release on all active grains
+    // Trigger release on all active grains of the layer
     juce::ScopedLock lock(grainLock);
     for (auto& grain : grains)
     {
-        if (grain->isActive())
+        if (grain->isActive() && grain->getLayer() == layer)
         {
             grain->triggerRelease();
         }
     }
+
+    if (freezer != nullptr && layer == 0)
+        freezer->releaseAll(static_cast<int>((layers[0].params.releaseMs / 1000.0f) * outputSampleRate));
+}
+
+void GrainEngine::setLayerOutput(int layer, int firstChannel)
+{
+    layers[static_cast<size_t>(layer)].outputChannel = juce::jmax(0, firstChannel);
+}
+
+void GrainEngine::reset()
+{
+    juce::ScopedLock lock(grainLock);
+
+    for (auto& layer : layers)
+    {
+        layer.activeNotes.clear();
+        layer.samplesUntilNextGrain = 0.0;
+    }
+
+    for (auto& grain : grains)
+    {
+        grain->stop();
+    }
+
+    for (auto& retiring : retiringSources)
+        retiring = nullptr;
+
+    residencyWaitLeftMs = maxResidencyWaitMs;
+}
+
+void GrainEngine::handOverTo(GrainEngine& outgoing, int fadeSamples, float outgoingGain)
+{
+    juce::ScopedLock lock(grainLock);
+    juce::ScopedLock outgoingLock(outgoing.grainLock);
+
+    // The outgoing engine's grains carry on from the gain they are heard at, and no more
+    // are spawned for its notes
+    for (auto& layer : outgoing.layers)
+    {
+        layer.activeNotes.clear();
+        layer.samplesUntilNextGrain = 0.0;
+    }
+
+    for (auto& grain : outgoing.grains)
+    {
+        if (outgoingGain > 0.0f)
+            grain->fadeOut(fadeSamples, outgoingGain);
+        else
+            grain->stop();
+    }
+
+    std::swap(grains, outgoing.grains);
+
+    // They join the cloud in its pool's free slots; should there be too few, the rest stop
+    size_t freeSlot = 0;
+
+    for (auto& grain : grains)
+    {
+        if (!grain->isActive())
+            continue;
+
+        while (freeSlot < outgoing.grains.size() && outgoing.grains[freeSlot]->isActive())
+            ++freeSlot;
+
+        if (freeSlot < outgoing.grains.size())
+            std::swap(grain, outgoing.grains[freeSlot]);
+        else
+            grain->stop();
+    }
+
+    // Render lists refer to grains by index, so both start over on the next tile
+    numInRenderList = 0;
+    inRenderList.fill(false);
+    outgoing.numInRenderList = 0;
+    outgoing.inRenderList.fill(false);
+
+    // The sources those grains read stay alive until they finish, like replaced ones
+    const auto previousSource = std::move(outgoing.source);
+    const auto previousZones = std::move(outgoing.zones);
+    const auto previousRetiring = outgoing.retiringSources;
+
+    outgoing.source = source;
+    outgoing.zones = zones;
+    outgoing.retiringSources = retiringSources;
+    retiringSources.fill(nullptr);
+
+    if (previousSource != nullptr && previousSource != source)
+        outgoing.retireSource(previousSource);
+
+    if (previousZones != nullptr)
+    {
+        for (const auto& zone : previousZones->getZones())
+        {
+            if (zone.source != nullptr && zone.source != source && (zones == nullptr || !zones->uses(zone.source.get())))
+                outgoing.retireSource(zone.source);
+        }
+    }
+
+    for (const auto& retiring : previousRetiring)
+    {
+        if (retiring != nullptr)
+            outgoing.retireSource(retiring);
+    }
+
+    outgoing.maxActiveGrains = maxActiveGrains;
+    outgoing.outputSampleRate = outputSampleRate;
+
+    for (size_t i = 0; i < layers.size(); ++i)
+    {
+        auto& layer = layers[i];
+        auto& outgoingLayer = outgoing.layers[i];
+
+        outgoingLayer.params = layer.params;
+        outgoingLayer.outputChannel = layer.outputChannel;
+        outgoingLayer.samplesUntilNextGrain = layer.samplesUntilNextGrain;
+        layer.samplesUntilNextGrain = 0.0;
+
+        // Notes played by frozen loops fade out on the loops rather than spawning grains again
+        for (const auto& note : layer.activeNotes)
+        {
+            if (freezer == nullptr || i != 0 || !freezer->isLoopPlaying(note.first))
+                outgoingLayer.activeNotes.insert(note);
+        }
+    }
+
+    if (freezer != nullptr)
+        freezer->releaseAll(fadeSamples);
 }
 
 void GrainEngine::process(juce::AudioBuffer<float>& outputBuffer)
+{
+    process(outputBuffer, 0, outputBuffer.getNumSamples());
+}
+
+void GrainEngine::process(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
 {
     juce::ScopedLock lock(grainLock);
 
-    if (sourceBuffer == nullptr || sourceBuffer->getNumSamples() == 0)
+    if ((source == nullptr || source->getLengthInSamples() == 0) && zones == nullptr)
         return;
 
-    const int numSamples = outputBuffer.getNumSamples();
+    // Hand frozen notes over to their loops once rendered, or back to live grains when unfrozen
+    auto& mainLayer = layers[0];
 
-    // Spawn new grains if notes are active
-    if (!activeNotes.empty() && density > 0.0f)
+    if (freezer != nullptr)
     {
-        // Each active note contributes to the total density
-        double effectiveDensity = density * static_cast<double>(activeNotes.size());
-        double samplesPerGrain = outputSampleRate / effectiveDensity;
-
-        for (int i = 0; i < numSamples; ++i)
+        if (frozen)
         {
-            samplesUntilNextGrain -= 1.0;
+            const int crossfadeSamples = static_cast<int>(TextureFreezer::crossfadeSeconds * outputSampleRate);
 
-            if (samplesUntilNextGrain <= 0.0)
+            for (const auto& note : mainLayer.activeNotes)
             {
-                // Spawn a grain for a randomly selected active note
-                // This distributes grains across all held notes
-                int noteIndex = random.nextInt(static_cast<int>(activeNotes.size()));
-                auto it = activeNotes.begin();
-                std::advance(it, noteIndex);
-                spawnGrain(it->first, it->second);
-                samplesUntilNextGrain += samplesPerGrain;
+                freezer->requestLoop(note.first, note.second, mainLayer.params, source, zones, maxActiveGrains);
+
+                if (freezer->startLoopIfReady(note.first, crossfadeSamples))
+                    fadeOutNote(note.first, crossfadeSamples);
             }
         }
+        else
+        {
+            // Give the live cloud roughly one grain length to build back up
+            const double fadeSeconds = juce::jlimit(TextureFreezer::crossfadeSeconds, 2.0, mainLayer.params.grainSizeMs / 1000.0);
+            freezer->releaseAll(static_cast<int>(fadeSeconds * outputSampleRate));
+        }
     }
 
-    // Process all active grains
-    for (auto& grain : grains)
+    // Frozen notes are played by their loops and no longer spawn grains. Each layer with
+    // live notes spawns on its own schedule, each of its notes adding to its density.
+    std::array<int, MAX_LAYERS> spawningLayers;
+    int numSpawningLayers = 0;
+
+    for (int i = 0; i < MAX_LAYERS; ++i)
     {
-        if (grain->isActive())
+        auto& layer = layers[static_cast<size_t>(i)];
+        layer.numLiveNotes = 0;
+
+        for (const auto& note : layer.activeNotes)
         {
-            grain->process(outputBuffer, 0, numSamples, outputSampleRate);
+            if (freezer == nullptr || i != 0 || !freezer->isLoopPlaying(note.first))
+                layer.liveNotes[static_cast<size_t>(layer.numLiveNotes++)] = note;
+        }
+
+        const bool spawning = layer.numLiveNotes > 0 && layer.params.density > 0.0f;
+        layer.samplesPerGrain = spawning ? outputSampleRate / (layer.params.density * static_cast<double>(layer.numLiveNotes)) : 0.0;
+
+        if (spawning)
+            spawningLayers[static_cast<size_t>(numSpawningLayers++)] = i;
+    }
+
+    // The offline renderer reads where the live engine already does, so it leaves the regions to it
+    if (realtime)
+        updateReadRegions();
+
+    // Process all active grains tile by tile. Tiles end where the next grain of any layer is
+    // due, so every grain starts on its own sample rather than at the start of the block.
+    addNewGrainsToRenderList();
+
+    const int endSample = startSample + numSamples;
+
+    for (int tileStart = startSample; tileStart < endSample;)
+    {
+        int tileLength = juce::jmin(TILE_SIZE, endSample - tileStart);
+        bool spawned = false;
+
+        for (int i = 0; i < numSpawningLayers; ++i)
+        {
+            const int layerIndex = spawningLayers[static_cast<size_t>(i)];
+            auto& layer = layers[static_cast<size_t>(layerIndex)];
+
+            // The count falls by one each sample, and a grain is due on the sample that takes it to zero
+            while (layer.samplesUntilNextGrain <= 1.0)
+            {
+                // Spawn a grain for a randomly selected active note
+                // This distributes grains across all held notes
+                const auto& note = layer.liveNotes[static_cast<size_t>(random.nextInt(layer.numLiveNotes))];
+                spawnGrain(layerIndex, note.first, note.second);
+                layer.samplesUntilNextGrain += layer.samplesPerGrain;
+                spawned = true;
+            }
+
+            tileLength = juce::jmin(tileLength, static_cast<int>(std::ceil(layer.samplesUntilNextGrain - 1.0)));
         }
+
+        if (spawned)
+            addNewGrainsToRenderList();
+
+        for (int i = 0; i < numSpawningLayers; ++i)
+            layers[static_cast<size_t>(spawningLayers[static_cast<size_t>(i)])].samplesUntilNextGrain -= tileLength;
+
+        updateRenderOrder(tileLength);
+        renderTile(outputBuffer, tileStart, tileLength);
+        tileStart += tileLength;
     }
 
-    // Apply master volume
-    outputBuffer.applyGain(volume);
+    releaseFinishedSources();
+
+    // Loops play at the main layer's volume, like its grains
+    if (freezer != nullptr)
+        freezer->process(outputBuffer, startSample, numSamples, mainLayer.params.volume);
 }
 
-void GrainEngine::spawnGrain(int midiNote, float velocity)
+bool GrainEngine::isIdle() const
 {
-    Grain* grain = getInactiveGrain();
-    if (grain == nullptr || sourceBuffer == nullptr)
+    // Grains only start in process(), which keeps every active grain in the render list
+    const bool anyNoteHeld = std::any_of(layers.begin(), layers.end(), [](const Layer& layer) { return !layer.activeNotes.empty(); });
+
+    return !anyNoteHeld && numInRenderList == 0
+        && (freezer == nullptr || !freezer->isPlayingAnyLoop());
+}
+
+int GrainEngine::getTailSamples() const
+{
+    int tail = 0;
+    for (int i = 0; i < numInRenderList; ++i)
+        tail = juce::jmax(tail, grains[static_cast<size_t>(renderList[static_cast<size_t>(i)].grainIndex)]->getRemainingSamples());
+
+    return tail;
+}
+
+void GrainEngine::spawnGrain(int layerIndex, int midiNote, float velocity)
+{
+    const auto& params = layers[static_cast<size_t>(layerIndex)].params;
+
+    // Each zone brings its own sample and root note
+    int rootNote = ROOT_NOTE;
+    const SampleSource* grainSource = findSource(midiNote, velocity, rootNote);
+
+    if (grainSource == nullptr || grainSource->getLengthInSamples() == 0)
         return;
 
-    const int sourceLengthSamples = sourceBuffer->getNumSamples();
+    const double sourceSampleRate = grainSource->getSampleRate();
+    const juce::int64 sourceLengthSamples = grainSource->getLengthInSamples();
 
     // Calculate grain parameters
-    int grainLengthSamples = static_cast<int>((grainSizeMs / 1000.0) * sourceSampleRate);
-    grainLengthSamples = juce::jlimit(1, sourceLengthSamples, grainLengthSamples);
+    int grainLengthSamples = static_cast<int>((params.grainSizeMs / 1000.0) * sourceSampleRate);
+    grainLengthSamples = static_cast<int>(juce::jlimit(static_cast<juce::int64>(1), sourceLengthSamples,
+                                                       static_cast<juce::int64>(grainLengthSamples)));
 
     // Position with spray (randomness)
-    float actualPosition = position;
-    if (spray > 0.0f)
+    float actualPosition = params.position;
+    if (params.spray > 0.0f)
     {
-        float sprayAmount = (random.nextFloat() * 2.0f - 1.0f) * spray;
-        actualPosition = juce::jlimit(0.0f, 1.0f, position + sprayAmount);
+        float sprayAmount = (random.nextFloat() * 2.0f - 1.0f) * params.spray;
+        actualPosition = juce::jlimit(0.0f, 1.0f, params.position + sprayAmount);
     }
 
-    int startSample = static_cast<int>(actualPosition * static_cast<float>(sourceLengthSamples - grainLengthSamples));
-    startSample = juce::jlimit(0, sourceLengthSamples - grainLengthSamples, startSample);
+    const juce::int64 lastStartSample = sourceLengthSamples - grainLengthSamples;
+    juce::int64 startSample = static_cast<juce::int64>(static_cast<double>(actualPosition) * static_cast<double>(lastStartSample));
+    startSample = juce::jlimit(static_cast<juce::int64>(0), lastStartSample, startSample);
 
-    // Calculate pitch from MIDI note relative to root note (middle C = 60)
+    // Calculate pitch from MIDI note relative to the root note (middle C = 60 without zones)
     // Plus the pitch dial offset and randomness
-    float notePitchSemitones = static_cast<float>(midiNote - ROOT_NOTE);
-    float actualPitch = notePitchSemitones + pitchSemitones;
-    if (pitchRandom > 0.0f)
+    float notePitchSemitones = static_cast<float>(midiNote - rootNote);
+    float actualPitch = notePitchSemitones + params.pitchSemitones;
+    if (params.pitchRandom > 0.0f)
     {
-        float pitchRandomAmount = (random.nextFloat() * 2.0f - 1.0f) * pitchRandom;
+        float pitchRandomAmount = (random.nextFloat() * 2.0f - 1.0f) * params.pitchRandom;
         actualPitch += pitchRandomAmount;
     }
     float pitchRatio = std::pow(2.0f, actualPitch / 12.0f);
 
     // Pan with spread
     float pan = 0.5f;
-    if (panSpread > 0.0f)
+    if (params.panSpread > 0.0f)
     {
-        pan = 0.5f + (random.nextFloat() - 0.5f) * panSpread;
+        pan = 0.5f + (random.nextFloat() - 0.5f) * params.panSpread;
     }
 
     // ADSR envelope in samples
-    float attackSamples = (attackMs / 1000.0f) * static_cast<float>(sourceSampleRate);
-    float decaySamples = (decayMs / 1000.0f) * static_cast<float>(sourceSampleRate);
-    float releaseSamples = (releaseMs / 1000.0f) * static_cast<float>(sourceSampleRate);
+    float attackSamples = (params.attackMs / 1000.0f) * static_cast<float>(sourceSampleRate);
+    float decaySamples = (params.decayMs / 1000.0f) * static_cast<float>(sourceSampleRate);
+    float releaseSamples = (params.releaseMs / 1000.0f) * static_cast<float>(sourceSampleRate);
 
     // Ensure attack + decay + release don't exceed grain length
     float totalEnvSamples = attackSamples + decaySamples + releaseSamples;
@@ -162,9 +499,61 @@ void GrainEngine::spawnGrain(int midiNote, float velocity)
         releaseSamples *= scale;
     }
 
-    grain->start(*sourceBuffer, sourceSampleRate, startSample, grainLengthSamples,
-                 pitchRatio, pan, attackSamples, decaySamples, sustainLevel, releaseSamples,
-                 reverse, velocity, midiNote);
+    // Reverse grains read the mirrored span of the reversed copy forwards
+    const bool readReversed = params.reverse && grainSource->canReadReversed();
+    juce::int64 grainStart = readReversed ? sourceLengthSamples - startSample - grainLengthSamples : startSample;
+
+    const double increment = pitchRatio * (sourceSampleRate / outputSampleRate);
+
+    // Live input is read behind its write head. The grain's whole span must be captured
+    // already, so it never overtakes the head, and grains reading slower than the head moves
+    // start late enough to finish before the capture comes round to their audio again.
+    if (grainSource->isLive())
+    {
+        const auto span = static_cast<juce::int64>(increment * grainLengthSamples) + 2;
+        const auto lag = static_cast<juce::int64>(juce::jmax(0.0, 1.0 - increment) * grainLengthSamples);
+        const juce::int64 firstStart = grainSource->getFirstSample() + lag;
+        const juce::int64 lastStart = grainSource->getFirstSample() + sourceLengthSamples - span;
+
+        if (lastStart < firstStart)
+            return;
+
+        grainStart = firstStart + static_cast<juce::int64>(static_cast<double>(actualPosition) * static_cast<double>(lastStart - firstStart));
+    }
+
+    // Grains that would only read silence are never started
+    const auto grainEnd = grainStart + static_cast<juce::int64>(increment * grainLengthSamples) + 2;
+    {
+        const auto& energyMap = grainSource->getEnergyMap();
+
+        if (readReversed ? energyMap.isSilentReversed(grainStart, grainEnd) : energyMap.isSilent(grainStart, grainEnd))
+            return;
+    }
+
+    // Grains whose first tile is not cached or decoded yet are dropped rather than waited for,
+    // unless the engine renders offline. Later tiles are checked as they are rendered, since a
+    // long grain spans more than any one window a source can pin.
+    const auto firstTileEnd = grainStart + static_cast<juce::int64>(increment * juce::jmin(TILE_SIZE, grainLengthSamples)) + 2;
+    if (!waitUntilReadable([&] { return grainSource->isResident(grainStart, firstTileEnd, readReversed); }))
+        return;
+
+    Grain* grain = getInactiveGrain();
+    if (grain == nullptr)
+        return;
+
+    grain->start(*grainSource, readReversed, grainStart, grainLengthSamples,
+                 pitchRatio, pan, attackSamples, decaySamples, params.sustainLevel, releaseSamples,
+                 velocity, midiNote);
+    grain->setLayer(layerIndex);
+
+    // Filter cutoff with per-grain random spread
+    float cutoffHz = params.filterCutoffHz;
+    if (params.filterSpread > 0.0f)
+    {
+        float spreadOctaves = (random.nextFloat() * 2.0f - 1.0f) * params.filterSpread;
+        cutoffHz *= std::pow(2.0f, spreadOctaves);
+    }
+    grain->setFilter(cutoffHz, outputSampleRate);
 }
 
 Grain* GrainEngine::getInactiveGrain()
@@ -195,69 +584,311 @@ Grain* GrainEngine::getInactiveGrain()
     return oldestGrain;  // Will reuse the grain closest to completion
 }
 
+void GrainEngine::addNewGrainsToRenderList()
+{
+    for (int i = 0; i < MAX_GRAINS; ++i)
+    {
+        if (!inRenderList[static_cast<size_t>(i)] && grains[static_cast<size_t>(i)]->isActive())
+        {
+            renderList[static_cast<size_t>(numInRenderList++)] = { 0, i, grains[static_cast<size_t>(i)]->getLayer(), false, {} };
+            inRenderList[static_cast<size_t>(i)] = true;
+        }
+    }
+}
+
+void GrainEngine::updateRenderOrder(int numSamples)
+{
+    // Drop finished grains and refresh the read addresses. Grains that only read silence
+    // from here on are retired, and grains that only read silence this tile jump past it.
+    int numKept = 0;
+    for (int i = 0; i < numInRenderList; ++i)
+    {
+        auto entry = renderList[static_cast<size_t>(i)];
+        auto& grain = *grains[static_cast<size_t>(entry.grainIndex)];
+
+        if (grain.isActive() && grain.isRemainingSpanSilent(outputSampleRate))
+            grain.stop();
+
+        entry.skipped = grain.isActive() && grain.isSpanSilent(numSamples, outputSampleRate);
+        if (entry.skipped)
+            grain.skip(numSamples, outputSampleRate);
+
+        if (!grain.isActive())
+        {
+            inRenderList[static_cast<size_t>(entry.grainIndex)] = false;
+            continue;
+        }
+
+        // Streamed grains that run past the cached data are culled, never waited for in realtime
+        if (!entry.skipped && !waitUntilReadable([&] { return grain.acquireWindow(numSamples, outputSampleRate, entry.window); }))
+        {
+            grain.stop();
+            inRenderList[static_cast<size_t>(entry.grainIndex)] = false;
+            continue;
+        }
+
+        if (!entry.skipped)
+            entry.readAddress = GrainLane::getReadAddress(grain, entry.window);
+
+        renderList[static_cast<size_t>(numKept++)] = entry;
+    }
+    numInRenderList = numKept;
+
+    // Insertion sort, since the order barely changes from one tile to the next
+    for (int i = 1; i < numInRenderList; ++i)
+    {
+        const auto entry = renderList[static_cast<size_t>(i)];
+        int j = i - 1;
+
+        while (j >= 0 && (renderList[static_cast<size_t>(j)].layer > entry.layer
+                          || (renderList[static_cast<size_t>(j)].layer == entry.layer
+                              && renderList[static_cast<size_t>(j)].readAddress > entry.readAddress)))
+        {
+            renderList[static_cast<size_t>(j + 1)] = renderList[static_cast<size_t>(j)];
+            --j;
+        }
+
+        renderList[static_cast<size_t>(j + 1)] = entry;
+    }
+}
+
+void GrainEngine::renderTile(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples)
+{
+    int numTileGrains = 0;
+    for (int i = 0; i < numInRenderList; ++i)
+    {
+        const auto& entry = renderList[static_cast<size_t>(i)];
+        if (!entry.skipped)
+        {
+            tileGrains[static_cast<size_t>(numTileGrains)] = grains[static_cast<size_t>(entry.grainIndex)].get();
+            tileWindows[static_cast<size_t>(numTileGrains)] = entry.window;
+            ++numTileGrains;
+        }
+    }
+
+    if (numTileGrains == 0)
+        return;
+
+    GrainLane::prefetch(tileGrains.data(), tileWindows.data(), juce::jmin(GrainLane::width, numTileGrains),
+                        numSamples, outputSampleRate);
+
+    // The render list keeps each layer's grains together, so each layer is mixed once per tile
+    for (int layerStart = 0; layerStart < numTileGrains;)
+    {
+        const int layerIndex = tileGrains[static_cast<size_t>(layerStart)]->getLayer();
+        int layerEnd = layerStart + 1;
+
+        while (layerEnd < numTileGrains && tileGrains[static_cast<size_t>(layerEnd)]->getLayer() == layerIndex)
+            ++layerEnd;
+
+        std::fill_n(layerTileLeft.begin(), numSamples, 0.0f);
+        std::fill_n(layerTileRight.begin(), numSamples, 0.0f);
+
+        for (int first = layerStart; first < layerEnd;)
+        {
+            // Lanes end early where the sample format changes
+            const int nextFirst = first + lane.load(tileGrains.data() + first, tileWindows.data() + first,
+                                                    layerEnd - first, outputSampleRate);
+
+            // Warm up the cache for the following lane while this one renders
+            if (nextFirst < numTileGrains)
+                GrainLane::prefetch(tileGrains.data() + nextFirst, tileWindows.data() + nextFirst,
+                                    juce::jmin(GrainLane::width, numTileGrains - nextFirst), numSamples, outputSampleRate);
+
+            lane.render(layerTileLeft.data(), layerTileRight.data(), numSamples);
+            lane.store();
+            first = nextFirst;
+        }
+
+        const auto& layer = layers[static_cast<size_t>(layerIndex)];
+        const int channel = layer.outputChannel + 1 < outputBuffer.getNumChannels() ? layer.outputChannel : 0;
+
+        juce::FloatVectorOperations::addWithMultiply(outputBuffer.getWritePointer(channel, startSample),
+                                                     layerTileLeft.data(), layer.params.volume, numSamples);
+        juce::FloatVectorOperations::addWithMultiply(outputBuffer.getWritePointer(channel + 1, startSample),
+                                                     layerTileRight.data(), layer.params.volume, numSamples);
+
+        layerStart = layerEnd;
+    }
+
+    for (int i = 0; i < numTileGrains; ++i)
+        tileGrains[static_cast<size_t>(i)]->releaseWindow(tileWindows[static_cast<size_t>(i)]);
+}
+
+const SampleSource* GrainEngine::findSource(int midiNote, float velocity, int& rootNote) const
+{
+    if (zones != nullptr)
+    {
+        if (const auto* zone = zones->find(midiNote, velocity))
+        {
+            rootNote = zone->rootNote;
+            return zone->source.get();
+        }
+    }
+
+    // Keys no zone covers play the main source
+    rootNote = ROOT_NOTE;
+    return source.get();
+}
+
+void GrainEngine::updateReadRegions()
+{
+    numReadRegions = 0;
+
+    for (const auto& layer : layers)
+    {
+        // Each sample the layer plays, with the highest note it plays relative to its root
+        std::array<std::pair<const SampleSource*, int>, 128> sourcesInPlay;
+        int numSourcesInPlay = 0;
+
+        for (int i = 0; i < layer.numLiveNotes; ++i)
+        {
+            const auto& note = layer.liveNotes[static_cast<size_t>(i)];
+            int rootNote = ROOT_NOTE;
+            const auto* noteSource = findSource(note.first, note.second, rootNote);
+            if (noteSource == nullptr)
+                continue;
+
+            const int semitones = note.first - rootNote;
+            const auto inPlay = std::find_if(sourcesInPlay.begin(), sourcesInPlay.begin() + numSourcesInPlay,
+                                             [noteSource](const auto& entry) { return entry.first == noteSource; });
+
+            if (inPlay != sourcesInPlay.begin() + numSourcesInPlay)
+                inPlay->second = juce::jmax(inPlay->second, semitones);
+            else
+                sourcesInPlay[static_cast<size_t>(numSourcesInPlay++)] = { noteSource, semitones };
+        }
+
+        for (int i = 0; i < numSourcesInPlay; ++i)
+            addReadRegion(*sourcesInPlay[static_cast<size_t>(i)].first, layer.params, sourcesInPlay[static_cast<size_t>(i)].second);
+    }
+
+    // Before the first note, the main source readies the span the next one will start in
+    if (numReadRegions == 0 && source != nullptr)
+        addReadRegion(*source, layers[0].params, 0);
+
+    for (int i = 0; i < numReadRegions; ++i)
+    {
+        const auto& region = readRegions[static_cast<size_t>(i)];
+        region.source->setReadRegion(this, region.start, region.end, region.reversed);
+    }
+}
+
+void GrainEngine::addReadRegion(const SampleSource& readSource, const GrainParameters& layerParams, int highestSemitones)
+{
+    // The span spawnGrain() can start grains in, stretched by the fastest pitch in play
+    const double sourceSampleRate = readSource.getSampleRate();
+    const juce::int64 sourceLengthSamples = readSource.getLengthInSamples();
+    if (sourceLengthSamples == 0)
+        return;
+
+    const auto grainLengthSamples = juce::jlimit(static_cast<juce::int64>(1), sourceLengthSamples,
+                                                 static_cast<juce::int64>((layerParams.grainSizeMs / 1000.0) * sourceSampleRate));
+    const auto lastStartSample = static_cast<double>(sourceLengthSamples - grainLengthSamples);
+
+    const float highestPitch = static_cast<float>(highestSemitones) + layerParams.pitchSemitones + layerParams.pitchRandom;
+    const double maxIncrement = std::pow(2.0, highestPitch / 12.0) * (sourceSampleRate / outputSampleRate);
+
+    const auto first = static_cast<juce::int64>(juce::jlimit(0.0f, 1.0f, layerParams.position - layerParams.spray) * lastStartSample);
+    const auto last = static_cast<juce::int64>(juce::jlimit(0.0f, 1.0f, layerParams.position + layerParams.spray) * lastStartSample);
+    const auto end = last + static_cast<juce::int64>(maxIncrement * static_cast<double>(grainLengthSamples)) + 2;
+
+    const bool reversed = layerParams.reverse && readSource.canReadReversed();
+    const auto regionStart = reversed ? sourceLengthSamples - end : first;
+    const auto regionEnd = reversed ? sourceLengthSamples - first : end;
+
+    // Layers playing the same sample the same way share one region spanning all of theirs
+    for (int i = 0; i < numReadRegions; ++i)
+    {
+        auto& region = readRegions[static_cast<size_t>(i)];
+
+        if (region.source == &readSource && region.reversed == reversed)
+        {
+            region.start = juce::jmin(region.start, regionStart);
+            region.end = juce::jmax(region.end, regionEnd);
+            return;
+        }
+    }
+
+    if (numReadRegions < static_cast<int>(readRegions.size()))
+        readRegions[static_cast<size_t>(numReadRegions++)] = { &readSource, reversed, regionStart, regionEnd };
+}
+
+void GrainEngine::fadeOutNote(int midiNote, int fadeSamples)
+{
+    // Only the first layer freezes, so the same note on other layers plays on
+    for (auto& grain : grains)
+    {
+        if (grain->isActive() && grain->getMidiNote() == midiNote && grain->getLayer() == 0)
+        {
+            grain->fadeOut(fadeSamples);
+        }
+    }
+}
+
 void GrainEngine::setGrainSize(float sizeMs)
 {
-    grainSizeMs = juce::jlimit(10.0f, 30000.0f, sizeMs);
+    layers[0].params.grainSizeMs = juce::jlimit(10.0f, 30000.0f, sizeMs);
 }
 
 void GrainEngine::setDensity(float grainsPerSecond)
 {
-    density = juce::jlimit(1.0f, 100.0f, grainsPerSecond);
+    layers[0].params.density = juce::jlimit(1.0f, 100.0f, grainsPerSecond);
 }
 
 void GrainEngine::setPosition(float normalizedPosition)
 {
-    position = juce::jlimit(0.0f, 1.0f, normalizedPosition);
+    layers[0].params.position = juce::jlimit(0.0f, 1.0f, normalizedPosition);
 }
 
 void GrainEngine::setPitch(float semitones)
 {
-    pitchSemitones = juce::jlimit(-24.0f, 24.0f, semitones);
+    layers[0].params.pitchSemitones = juce::jlimit(-24.0f, 24.0f, semitones);
 }
 
 void GrainEngine::setPanSpread(float spread)
 {
-    panSpread = juce::jlimit(0.0f, 1.0f, spread);
+    layers[0].params.panSpread = juce::jlimit(0.0f, 1.0f, spread);
 }
 
 void GrainEngine::setAttack(float attack)
 {
-    attackMs = juce::jlimit(0.0f, 100.0f, attack);
+    layers[0].params.attackMs = juce::jlimit(0.0f, 100.0f, attack);
 }
 
 void GrainEngine::setDecay(float decay)
 {
-    decayMs = juce::jlimit(0.0f, 500.0f, decay);
+    layers[0].params.decayMs = juce::jlimit(0.0f, 500.0f, decay);
 }
 
 void GrainEngine::setSustain(float sustain)
 {
-    sustainLevel = juce::jlimit(0.0f, 1.0f, sustain);
+    layers[0].params.sustainLevel = juce::jlimit(0.0f, 1.0f, sustain);
 }
 
 void GrainEngine::setRelease(float release)
 {
-    releaseMs = juce::jlimit(0.0f, 5000.0f, release);
+    layers[0].params.releaseMs = juce::jlimit(0.0f, 5000.0f, release);
 }
 
 void GrainEngine::setReverse(bool rev)
 {
-    reverse = rev;
+    layers[0].params.reverse = rev;
 }
 
 void GrainEngine::setSpray(float sprayAmount)
 {
-    spray = juce::jlimit(0.0f, 1.0f, sprayAmount);
+    layers[0].params.spray = juce::jlimit(0.0f, 1.0f, sprayAmount);
 }
 
 void GrainEngine::setPitchRandom(float randomSemitones)
 {
-    pitchRandom = juce::jlimit(0.0f, 24.0f, randomSemitones);
+    layers[0].params.pitchRandom = juce::jlimit(0.0f, 24.0f, randomSemitones);
 }
 
 void GrainEngine::setVolume(float vol)
 {
-    volume = juce::jlimit(0.0f, 1.0f, vol);
+    layers[0].params.volume = juce::jlimit(0.0f, 1.0f, vol);
 }
 
 void GrainEngine::setMaxActiveGrains(int maxGrains)
@@ -265,6 +896,21 @@ void GrainEngine::setMaxActiveGrains(int maxGrains)
     maxActiveGrains = juce::jlimit(64, MAX_GRAINS, maxGrains);
 }
 
+void GrainEngine::setFilterCutoff(float cutoffHz)
+{
+    layers[0].params.filterCutoffHz = juce::jlimit(20.0f, Grain::maxFilterCutoffHz, cutoffHz);
+}
+
+void GrainEngine::setFilterSpread(float octaves)
+{
+    layers[0].params.filterSpread = juce::jlimit(0.0f, 4.0f, octaves);
+}
+
+void GrainEngine::setFreeze(bool shouldFreeze)
+{
+    frozen = shouldFreeze;
+}
+
 std::vector<GrainInfo> GrainEngine::getActiveGrainInfo() const
 {
     std::vector<GrainInfo> info;
@@ -280,11 +926,12 @@ std::vector<GrainInfo> GrainEngine::getActiveGrainInfo() const
             gi.envelopeLevel = grain->getEnvelopeLevel();
             gi.midiNote = grain->getMidiNote();
 
-            int sourceLength = grain->getSourceLength();
+            const juce::int64 sourceLength = grain->getSourceLength();
             if (sourceLength > 0)
             {
-                gi.grainStartPosition = static_cast<float>(grain->getStartSampleInSource()) / static_cast<float>(sourceLength);
-                gi.grainEndPosition = static_cast<float>(grain->getStartSampleInSource() + grain->getGrainLength()) / static_cast<float>(sourceLength);
+                const auto start = static_cast<double>(grain->getStartSampleInSource());
+                gi.grainStartPosition = static_cast<float>(start / static_cast<double>(sourceLength));
+                gi.grainEndPosition = static_cast<float>((start + grain->getGrainLength()) / static_cast<double>(sourceLength));
             }
             else
             {
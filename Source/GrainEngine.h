@@ -2,6 +2,8 @@
 
 #include <JuceHeader.h>
 #include "Grain.h"
+#include "GrainLane.h"
+#include "ZoneMap.h"
 
 struct GrainInfo
 {
@@ -14,21 +16,75 @@ struct GrainInfo
     bool active;
 };
 
+struct GrainParameters
+{
+    float grainSizeMs = 100.0f;
+    float density = 10.0f;
+    float position = 0.0f;
+    float pitchSemitones = 0.0f;
+    float panSpread = 0.5f;
+    float attackMs = 10.0f;
+    float decayMs = 50.0f;
+    float sustainLevel = 0.8f;
+    float releaseMs = 50.0f;
+    bool reverse = false;
+    float spray = 0.0f;
+    float pitchRandom = 0.0f;
+    float volume = 1.0f;
+    float filterCutoffHz = Grain::maxFilterCutoffHz;
+    float filterSpread = 0.0f;   // Random cutoff spread per grain, in octaves
+};
+
+class TextureFreezer;
+
 class GrainEngine
 {
 public:
-    GrainEngine();
+    // Offline renderers (used by the texture freezer) are created without freeze support and
+    // not realtime: they leave the read regions to the live engines, and wait a while for the
+    // data their grains read rather than dropping the grains
+    explicit GrainEngine(bool enableFreeze = true, bool isRealtime = true);
     ~GrainEngine();
 
     void prepare(double sampleRate, int samplesPerBlock);
-    void setSourceBuffer(const juce::AudioBuffer<float>* buffer, double sourceSampleRate);
-
-    void noteOn(int midiNote, float velocity);
-    void noteOff(int midiNote);
+    // Grains already playing finish on the previous source, which is held until they are done.
+    // Reverse grains play forwards until the source's reversed copy is built.
+    void setSource(SampleSource::Ptr newSource);
+
+    // Multi-sampling: keys and velocities a zone covers play its sample instead, pitched
+    // from its root note, through the same grain pool. Grains of zones that are dropped
+    // finish on their samples, as with setSource().
+    void setZones(ZoneMap::Ptr newZones);
+
+    // Multi-timbral layers: each plays its own notes with its own parameters, through the one
+    // grain pool and spawn schedule, so maxActiveGrains is a budget shared by all of them.
+    // Calls without a layer address layer 0, the only one that freezes.
+    static constexpr int MAX_LAYERS = 16;
+
+    void noteOn(int midiNote, float velocity, int layer = 0);
+    void noteOff(int midiNote, int layer = 0);
     void allNotesOff();
+    void allNotesOff(int layer);
+
+    // The layer renders into this channel and the next of the buffers passed to process(),
+    // or into the first two where the buffer has too few channels
+    void setLayerOutput(int layer, int firstChannel);
+
+    // Deactivates every grain and forgets held notes
+    void reset();
+
+    // Moves the playing cloud to another engine (created without freeze support), with its
+    // grains, source, parameters and held notes, so it can play on there and be faded out
+    // while this engine starts a new cloud. Frozen loops fade out over fadeSamples. Grains
+    // the other engine is still playing, heard at outgoingGain, fade out over fadeSamples
+    // alongside the cloud rather than being cut.
+    void handOverTo(GrainEngine& outgoing, int fadeSamples, float outgoingGain);
 
     void process(juce::AudioBuffer<float>& outputBuffer);
 
+    // Renders into part of the buffer, so MIDI events can be applied between the parts
+    void process(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples);
+
     // Parameters
     void setGrainSize(float sizeMs);
     void setDensity(float grainsPerSecond);
@@ -44,6 +100,19 @@ public:
     void setPitchRandom(float randomSemitones);
     void setVolume(float volume);
     void setMaxActiveGrains(int maxGrains);
+    void setFilterCutoff(float cutoffHz);
+    void setFilterSpread(float octaves);
+    void setFreeze(bool shouldFreeze);
+
+    void setParameters(const GrainParameters& newParameters, int layer = 0) { layers[static_cast<size_t>(layer)].params = newParameters; }
+    const GrainParameters& getParameters(int layer = 0) const { return layers[static_cast<size_t>(layer)].params; }
+
+    // Nothing held, no grain playing and no frozen loop audible, so process() would only
+    // add silence. Audio thread only, like process().
+    bool isIdle() const;
+
+    // Output samples until the last grain playing now has ended. Audio thread only.
+    int getTailSamples() const;
 
     // For UI visualization
     std::vector<GrainInfo> getActiveGrainInfo() const;
@@ -53,37 +122,113 @@ public:
     static constexpr int ROOT_NOTE = 60;
 
 private:
-    void spawnGrain(int midiNote, float velocity);
+    void spawnGrain(int layerIndex, int midiNote, float velocity);
     Grain* getInactiveGrain();
+    void fadeOutNote(int midiNote, int fadeSamples);
+
+    const SampleSource* findSource(int midiNote, float velocity, int& rootNote) const;
+    void retireSource(const SampleSource::Ptr& retiredSource);
+    void releaseFinishedSources();
+
+    // Realtime engines check once; offline ones poll until the data is in or their wait for
+    // the current render, which reset() starts afresh, runs out
+    template <typename Check>
+    bool waitUntilReadable(Check&& isReadable)
+    {
+        while (!isReadable())
+        {
+            if (realtime || residencyWaitLeftMs <= 0)
+                return false;
+
+            juce::Thread::sleep(residencyPollMs);
+            residencyWaitLeftMs -= residencyPollMs;
+        }
+
+        return true;
+    }
+
+    void updateReadRegions();
+    void addReadRegion(const SampleSource& readSource, const GrainParameters& layerParams, int highestSemitones);
+
+    void addNewGrainsToRenderList();
+    void updateRenderOrder(int numSamples);
+    void renderTile(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples);
 
     static constexpr int MAX_GRAINS = 2048;  // Absolute maximum
     std::array<std::unique_ptr<Grain>, MAX_GRAINS> grains;
     int maxActiveGrains = 512;  // User-configurable active pool size
 
-    const juce::AudioBuffer<float>* sourceBuffer = nullptr;
-    double sourceSampleRate = 44100.0;
-    double outputSampleRate = 44100.0;
-
-    // Parameters
-    float grainSizeMs = 100.0f;
-    float density = 10.0f;
-    float position = 0.0f;
-    float pitchSemitones = 0.0f;
-    float panSpread = 0.5f;
-    float attackMs = 10.0f;
-    float decayMs = 50.0f;
-    float sustainLevel = 0.8f;
-    float releaseMs = 50.0f;
-    bool reverse = false;
-    float spray = 0.0f;
-    float pitchRandom = 0.0f;
-    float volume = 1.0f;
+    // Output is rendered in tiles short enough for the tile to stay in L1 across all grains
+    static constexpr int TILE_SIZE = 128;
+
+    // Active grains grouped by layer, then ordered by the source address they read next, so
+    // neighbouring grains in the list share cache lines; rendered in lanes of GrainLane::width
+    struct RenderEntry
+    {
+        std::uintptr_t readAddress;
+        int grainIndex;
+        int layer;
+        bool skipped;  // Only reads silence this tile and was advanced without rendering
+        SampleSource::Window window;  // Pinned for the tile unless skipped
+    };
+
+    std::array<RenderEntry, MAX_GRAINS> renderList {};
+    std::array<bool, MAX_GRAINS> inRenderList {};
+    int numInRenderList = 0;
+    std::array<Grain*, MAX_GRAINS> tileGrains {};
+    std::array<SampleSource::Window, MAX_GRAINS> tileWindows {};
+    GrainLane lane;
+
+    // Each layer's lanes mix here, so its volume is applied on the way to its output
+    std::array<float, TILE_SIZE> layerTileLeft {};
+    std::array<float, TILE_SIZE> layerTileRight {};
+
+    SampleSource::Ptr source;
+    ZoneMap::Ptr zones;
+
+    // Previous sources that active grains may still be reading
+    static constexpr int MAX_RETIRING_SOURCES = 4;
+    std::array<SampleSource::Ptr, MAX_RETIRING_SOURCES> retiringSources;
 
-    // Note tracking
-    std::map<int, float> activeNotes;  // midiNote -> velocity
+    double outputSampleRate = 44100.0;
 
-    // Grain spawning
-    double samplesUntilNextGrain = 0.0;
+    struct Layer
+    {
+        GrainParameters params;
+        std::map<int, float> activeNotes;  // midiNote -> velocity
+        int outputChannel = 0;
+
+        // Grain spawning
+        double samplesUntilNextGrain = 0.0;
+        double samplesPerGrain = 0.0;  // 0 while the layer spawns nothing
+
+        // Held notes that spawn grains, i.e. not played by frozen loops; refreshed by process()
+        std::array<std::pair<int, float>, 128> liveNotes {};
+        int numLiveNotes = 0;
+    };
+
+    std::array<Layer, MAX_LAYERS> layers;
+
+    // Samples the layers read from, each with the span grains may start in; refreshed by process()
+    struct ReadRegion
+    {
+        const SampleSource* source;
+        bool reversed;
+        juce::int64 start;
+        juce::int64 end;
+    };
+
+    std::array<ReadRegion, 2 * (ZoneMap::maxZones + 1)> readRegions {};
+    int numReadRegions = 0;
+
+    const bool realtime;
+    int residencyWaitLeftMs = 0;  // Offline only
+    static constexpr int maxResidencyWaitMs = 2000;
+    static constexpr int residencyPollMs = 1;
+
+    // Texture freeze: held notes are bounced to loops in the background
+    std::unique_ptr<TextureFreezer> freezer;
+    bool frozen = false;
 
     juce::Random random;
 
@@ -0,0 +1,326 @@
+#include "GrainLane.h"
+
+namespace
+{
+    // Unused lanes read from this instead of a real source
+    const float silentSource[2] = { 0.0f, 0.0f };
+
+    constexpr int cacheLineBytes = 64;
+    constexpr int maxPrefetchLinesPerChannel = 16;
+
+    using SampleFormat = SampleSource::SampleFormat;
+
+    inline void prefetchRead(const void* address)
+    {
+       #if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(address, 0, 3);
+       #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+       #else
+        juce::ignoreUnused(address);
+       #endif
+    }
+
+    // 0.5 * (1 - cos(pi * x)) for x in [0, 1], written as a polynomial so it vectorises.
+    // Uses sin(y) with y = pi * (x - 0.5), accurate to about 4e-6.
+    inline float raisedCosine(float x)
+    {
+        const float y = juce::MathConstants<float>::pi * (x - 0.5f);
+        const float y2 = y * y;
+        const float sine = y * (1.0f + y2 * (-1.0f / 6.0f + y2 * (1.0f / 120.0f + y2 * (-1.0f / 5040.0f + y2 * (1.0f / 362880.0f)))));
+        return 0.5f + 0.5f * sine;
+    }
+}
+
+int GrainLane::load(Grain* const* grainsToLoad, const SampleSource::Window* windows, int numGrainsToLoad, double outputSampleRate)
+{
+    // The conversion is chosen once per lane, so every grain in it must share the format
+    format = numGrainsToLoad > 0 ? windows[0].format : SampleFormat::float32;
+    numGrains = 0;
+
+    while (numGrains < juce::jmin(width, numGrainsToLoad) && windows[numGrains].format == format)
+        ++numGrains;
+
+    anyFiltered = false;
+
+    for (int l = 0; l < width; ++l)
+    {
+        if (l >= numGrains)
+        {
+            grains[l] = nullptr;
+            sourceLeft[l] = reinterpret_cast<const char*>(silentSource);
+            sourceRight[l] = reinterpret_cast<const char*>(silentSource);
+            frameBytes[l] = 0;
+            lastReadableIndex[l] = 1.0;
+            windowStart[l] = 0.0;
+            position[l] = 0.0;
+            increment[l] = 0.0;
+            samplesProcessed[l] = 0.0f;
+            grainLength[l] = 0.0f;
+            attackEnd[l] = decayEnd[l] = releaseStart[l] = 0.0f;
+            inverseAttack[l] = inverseDecay[l] = inverseRelease[l] = 0.0f;
+            sustainLevel[l] = releaseLength[l] = releasing[l] = releaseFrom[l] = releaseStartLevel[l] = 0.0f;
+            envelopeLevel[l] = 0.0f;
+            gainLeft[l] = gainRight[l] = 0.0f;
+            fadeGain[l] = fadeStep[l] = 0.0f;
+            alive[l] = 0.0f;
+            filterOn[l] = 0.0f;
+            filterA1[l] = 1.0f;
+            filterA2[l] = filterA3[l] = 0.0f;
+            ic1Left[l] = ic2Left[l] = ic1Right[l] = ic2Right[l] = 0.0f;
+            continue;
+        }
+
+        Grain& grain = *grainsToLoad[l];
+        grains[l] = &grain;
+
+        // Interpolation reads two neighbouring samples, so tiny windows play silence
+        const auto& window = windows[l];
+        const bool readable = window.length >= 2;
+        sourceLeft[l] = static_cast<const char*>(readable ? window.left : silentSource);
+        sourceRight[l] = static_cast<const char*>(readable ? window.right : silentSource);
+        frameBytes[l] = readable ? window.frameBytes : 0;
+        lastReadableIndex[l] = readable ? static_cast<double>(window.length - 1) : 0.0;
+
+        windowStart[l] = static_cast<double>(window.start);
+        position[l] = static_cast<double>(grain.sourceSampleStart - window.start) + grain.currentPosition;
+        increment[l] = grain.getIncrement(outputSampleRate);
+
+        // Envelope breakpoints, truncated to whole samples like the phase checks always were
+        const float wholeAttack = std::floor(grain.attackSamples);
+        const float wholeAttackDecay = std::floor(grain.attackSamples + grain.decaySamples);
+        const float wholeRelease = std::floor(grain.releaseSamples);
+
+        samplesProcessed[l] = static_cast<float>(grain.samplesProcessed);
+        grainLength[l] = static_cast<float>(grain.grainLength);
+        attackEnd[l] = grain.attackSamples > 0.0f ? wholeAttack : 0.0f;
+        inverseAttack[l] = grain.attackSamples > 0.0f ? 1.0f / grain.attackSamples : 0.0f;
+        decayEnd[l] = grain.decaySamples > 0.0f ? wholeAttackDecay : 0.0f;
+        inverseDecay[l] = grain.decaySamples > 0.0f ? 1.0f / grain.decaySamples : 0.0f;
+        sustainLevel[l] = grain.sustainLevel;
+        releaseStart[l] = grain.releaseSamples > 0.0f ? grainLength[l] - wholeRelease : grainLength[l];
+        releaseLength[l] = grain.releaseSamples > 0.0f ? wholeRelease : 0.0f;
+        inverseRelease[l] = grain.releaseSamples > 0.0f ? 1.0f / grain.releaseSamples : 0.0f;
+        releasing[l] = grain.releasing ? 1.0f : 0.0f;
+        releaseFrom[l] = static_cast<float>(grain.releaseSampleStart);
+        releaseStartLevel[l] = grain.releaseStartLevel;
+        envelopeLevel[l] = grain.currentEnvelopeLevel;
+
+        gainLeft[l] = grain.velocity * grain.panLeft;
+        gainRight[l] = grain.velocity * grain.panRight;
+        fadeGain[l] = grain.fadeGain;
+        fadeStep[l] = grain.fadeStep;
+        alive[l] = 1.0f;
+
+        filterOn[l] = grain.filterEnabled ? 1.0f : 0.0f;
+        filterA1[l] = grain.filterA1;
+        filterA2[l] = grain.filterA2;
+        filterA3[l] = grain.filterA3;
+        ic1Left[l] = grain.filterIc1[0];
+        ic2Left[l] = grain.filterIc2[0];
+        ic1Right[l] = grain.filterIc1[1];
+        ic2Right[l] = grain.filterIc2[1];
+        anyFiltered = anyFiltered || grain.filterEnabled;
+    }
+
+    return numGrains;
+}
+
+void GrainLane::render(float* outputLeft, float* outputRight, int numSamples)
+{
+    switch (format)
+    {
+        case SampleFormat::int16:           renderFrom<SampleFormat::int16>(outputLeft, outputRight, numSamples); break;
+        case SampleFormat::int24:           renderFrom<SampleFormat::int24>(outputLeft, outputRight, numSamples); break;
+        case SampleFormat::int16BigEndian:  renderFrom<SampleFormat::int16BigEndian>(outputLeft, outputRight, numSamples); break;
+        case SampleFormat::int24BigEndian:  renderFrom<SampleFormat::int24BigEndian>(outputLeft, outputRight, numSamples); break;
+        case SampleFormat::float16:         renderFrom<SampleFormat::float16>(outputLeft, outputRight, numSamples); break;
+        case SampleFormat::float32:
+        default:                            renderFrom<SampleFormat::float32>(outputLeft, outputRight, numSamples); break;
+    }
+}
+
+template <SampleSource::SampleFormat sampleFormat>
+void GrainLane::renderFrom(float* outputLeft, float* outputRight, int numSamples)
+{
+    alignas(32) float left[width];
+    alignas(32) float right[width];
+    alignas(32) float gain[width];
+
+    for (int i = 0; i < numSamples; ++i)
+    {
+        // Gather and interpolate; out-of-range reads are silent
+        for (int l = 0; l < width; ++l)
+        {
+            const double pos = position[l];
+            const bool inRange = pos >= 0.0 && pos < lastReadableIndex[l];
+            const int index = inRange ? static_cast<int>(pos) : 0;
+            const float frac = inRange ? static_cast<float>(pos - index) : 0.0f;
+            const float range = inRange ? 1.0f : 0.0f;
+
+            const auto offset = static_cast<std::ptrdiff_t>(index) * frameBytes[l];
+            const char* sl = sourceLeft[l] + offset;
+            const char* sr = sourceRight[l] + offset;
+
+            const float left0 = SampleSource::readSample<sampleFormat>(sl);
+            const float left1 = SampleSource::readSample<sampleFormat>(sl + frameBytes[l]);
+            const float right0 = SampleSource::readSample<sampleFormat>(sr);
+            const float right1 = SampleSource::readSample<sampleFormat>(sr + frameBytes[l]);
+
+            left[l] = (left0 + frac * (left1 - left0)) * range;
+            right[l] = (right0 + frac * (right1 - right0)) * range;
+
+            position[l] = pos + increment[l];
+        }
+
+        // ADSR envelope, or the note-off release ramp once released
+        float anyAlive = 0.0f;
+
+        for (int l = 0; l < width; ++l)
+        {
+            const float n = samplesProcessed[l];
+
+            // Every segment is evaluated and then selected, so the loop has no branches to vectorise around
+            const float attackEnv = n * inverseAttack[l];
+            const float decayEnv = 1.0f - (1.0f - sustainLevel[l]) * (n - attackEnd[l]) * inverseDecay[l];
+            const float naturalReleaseEnv = sustainLevel[l] * (1.0f - (n - releaseStart[l]) * inverseRelease[l]);
+            const float sinceRelease = n - releaseFrom[l];
+            const float noteOffEnv = releaseStartLevel[l] * (1.0f - sinceRelease * inverseRelease[l]);
+
+            float env = n >= releaseStart[l] ? naturalReleaseEnv : sustainLevel[l];
+            env = n < decayEnd[l] ? decayEnv : env;
+            env = n < attackEnd[l] ? attackEnv : env;
+
+            const float releasedEnv = sinceRelease < releaseLength[l] ? noteOffEnv : 0.0f;
+            env = releasing[l] > 0.0f ? releasedEnv : env;
+
+            const float shaped = raisedCosine(std::min(std::max(env, 0.0f), 1.0f));
+
+            // Bitwise rather than short-circuit logic keeps the loop branch-free
+            const bool finished = (n >= grainLength[l]) | ((releasing[l] > 0.0f) & (shaped <= 0.001f));
+            const float live = finished ? 0.0f : alive[l];
+
+            gain[l] = shaped * fadeGain[l] * live;
+            envelopeLevel[l] = live > 0.0f ? shaped : envelopeLevel[l];
+            samplesProcessed[l] = n + live;
+
+            const float nextFade = fadeGain[l] - fadeStep[l];
+            fadeGain[l] = nextFade;
+            alive[l] = nextFade <= 0.0f ? 0.0f : live;
+
+            anyAlive = std::max(anyAlive, live);
+        }
+
+        if (anyAlive <= 0.0f)
+            break;
+
+        if (anyFiltered)
+        {
+            for (int l = 0; l < width; ++l)
+            {
+                const float v3Left = left[l] - ic2Left[l];
+                const float v1Left = filterA1[l] * ic1Left[l] + filterA2[l] * v3Left;
+                const float v2Left = ic2Left[l] + filterA2[l] * ic1Left[l] + filterA3[l] * v3Left;
+                ic1Left[l] = 2.0f * v1Left - ic1Left[l];
+                ic2Left[l] = 2.0f * v2Left - ic2Left[l];
+
+                const float v3Right = right[l] - ic2Right[l];
+                const float v1Right = filterA1[l] * ic1Right[l] + filterA2[l] * v3Right;
+                const float v2Right = ic2Right[l] + filterA2[l] * ic1Right[l] + filterA3[l] * v3Right;
+                ic1Right[l] = 2.0f * v1Right - ic1Right[l];
+                ic2Right[l] = 2.0f * v2Right - ic2Right[l];
+
+                // Blend rather than select so unfiltered grains in the lane pass through
+                left[l] += filterOn[l] * (v2Left - left[l]);
+                right[l] += filterOn[l] * (v2Right - right[l]);
+            }
+        }
+
+        float sumLeft = 0.0f;
+        float sumRight = 0.0f;
+
+        for (int l = 0; l < width; ++l)
+        {
+            sumLeft += left[l] * gain[l] * gainLeft[l];
+            sumRight += right[l] * gain[l] * gainRight[l];
+        }
+
+        outputLeft[i] += sumLeft;
+        outputRight[i] += sumRight;
+    }
+}
+
+void GrainLane::store()
+{
+    for (int l = 0; l < numGrains; ++l)
+    {
+        Grain& grain = *grains[l];
+
+        grain.currentPosition = position[l] + windowStart[l] - static_cast<double>(grain.sourceSampleStart);
+        grain.samplesProcessed = static_cast<int>(samplesProcessed[l]);
+        grain.currentEnvelopeLevel = envelopeLevel[l];
+        grain.fadeGain = fadeGain[l];
+
+        grain.filterIc1[0] = ic1Left[l];
+        grain.filterIc2[0] = ic2Left[l];
+        grain.filterIc1[1] = ic1Right[l];
+        grain.filterIc2[1] = ic2Right[l];
+
+        if (alive[l] <= 0.0f)
+        {
+            grain.active = false;
+            grain.done = true;
+        }
+    }
+}
+
+std::uintptr_t GrainLane::getReadAddress(const Grain& grain, const SampleSource::Window& window)
+{
+    if (window.length == 0)
+        return 0;
+
+    const double position = static_cast<double>(grain.sourceSampleStart - window.start) + grain.currentPosition;
+    const int index = juce::jlimit(0, window.length - 1, static_cast<int>(position));
+    return reinterpret_cast<std::uintptr_t>(static_cast<const char*>(window.left)
+                                            + static_cast<std::ptrdiff_t>(index) * window.frameBytes);
+}
+
+void GrainLane::prefetch(Grain* const* grainsToPrefetch, const SampleSource::Window* windows, int numGrainsToPrefetch,
+                         int numSamples, double outputSampleRate)
+{
+    for (int g = 0; g < numGrainsToPrefetch; ++g)
+    {
+        const Grain& grain = *grainsToPrefetch[g];
+        const auto& window = windows[g];
+
+        if (window.length < 2)
+            continue;
+
+        // Span covered over the next numSamples; every grain reads forwards
+        const double start = static_cast<double>(grain.sourceSampleStart - window.start) + grain.currentPosition;
+        const double end = start + grain.getIncrement(outputSampleRate) * numSamples;
+        const int first = juce::jlimit(0, window.length - 1, static_cast<int>(start));
+        const int last = juce::jlimit(0, window.length - 1, static_cast<int>(end) + 1);
+
+        // Data read backwards is fetched from its lowest address up
+        const auto frameBytes = static_cast<std::ptrdiff_t>(window.frameBytes);
+        const auto firstOffset = juce::jmin(first * frameBytes, last * frameBytes);
+        const auto numBytes = static_cast<std::ptrdiff_t>(last - first) * std::abs(frameBytes);
+        const int numLines = static_cast<int>(juce::jmin(static_cast<std::ptrdiff_t>(maxPrefetchLinesPerChannel),
+                                                         numBytes / cacheLineBytes + 1));
+
+        // Interleaved channels share cache lines, so only planar data needs each channel fetched
+        const auto channelOffset = static_cast<const char*>(window.right) - static_cast<const char*>(window.left);
+        const int numChannels = std::abs(channelOffset) >= std::abs(frameBytes) ? 2 : 1;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const char* data = static_cast<const char*>(channel == 0 ? window.left : window.right) + firstOffset;
+
+            for (int line = 0; line < numLines; ++line)
+            {
+                prefetchRead(data + line * cacheLineBytes);
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "Grain.h"
+
+// Struct-of-arrays view of up to 'width' grains that are rendered together.
+// The envelope, filter, panning and mixing math runs across all grains of the
+// lane in straight-line loops the compiler can keep in SIMD registers; only the
+// source reads are per-grain gathers.
+class GrainLane
+{
+public:
+    static constexpr int width = 8;
+
+    // Copy the state of up to 'width' of the given grains into the lane, stopping early at the
+    // first window in a different sample format. Returns the number of grains loaded.
+    int load(Grain* const* grainsToLoad, const SampleSource::Window* windows, int numGrainsToLoad, double outputSampleRate);
+
+    // Mix the lane into the output and advance every grain by numSamples
+    void render(float* outputLeft, float* outputRight, int numSamples);
+
+    // Write the advanced state back to the grains
+    void store();
+
+    // Address of the next source sample the grain reads, for ordering grains by locality
+    static std::uintptr_t getReadAddress(const Grain& grain, const SampleSource::Window& window);
+
+    // Ask the cache for the source span each grain will read over the next numSamples
+    static void prefetch(Grain* const* grainsToPrefetch, const SampleSource::Window* windows, int numGrainsToPrefetch,
+                         int numSamples, double outputSampleRate);
+
+private:
+    template <SampleSource::SampleFormat sampleFormat>
+    void renderFrom(float* outputLeft, float* outputRight, int numSamples);
+
+    Grain* grains[width] = {};
+    int numGrains = 0;
+    bool anyFiltered = false;
+
+    // Source access
+    SampleSource::SampleFormat format = SampleSource::SampleFormat::float32;
+    const char* sourceLeft[width] = {};
+    const char* sourceRight[width] = {};
+    alignas(32) std::ptrdiff_t frameBytes[width] = {};
+    alignas(32) double lastReadableIndex[width] = {};
+    alignas(32) double windowStart[width] = {};
+    alignas(32) double position[width] = {};  // Relative to the window
+    alignas(32) double increment[width] = {};
+
+    // Envelope (all in samples)
+    alignas(32) float samplesProcessed[width] = {};
+    alignas(32) float grainLength[width] = {};
+    alignas(32) float attackEnd[width] = {};
+    alignas(32) float inverseAttack[width] = {};
+    alignas(32) float decayEnd[width] = {};
+    alignas(32) float inverseDecay[width] = {};
+    alignas(32) float sustainLevel[width] = {};
+    alignas(32) float releaseStart[width] = {};
+    alignas(32) float releaseLength[width] = {};
+    alignas(32) float inverseRelease[width] = {};
+    alignas(32) float releasing[width] = {};
+    alignas(32) float releaseFrom[width] = {};
+    alignas(32) float releaseStartLevel[width] = {};
+    alignas(32) float envelopeLevel[width] = {};
+
+    // Gain
+    alignas(32) float gainLeft[width] = {};
+    alignas(32) float gainRight[width] = {};
+    alignas(32) float fadeGain[width] = {};
+    alignas(32) float fadeStep[width] = {};
+    alignas(32) float alive[width] = {};
+
+    // Filter
+    alignas(32) float filterOn[width] = {};
+    alignas(32) float filterA1[width] = {};
+    alignas(32) float filterA2[width] = {};
+    alignas(32) float filterA3[width] = {};
+    alignas(32) float ic1Left[width] = {};
+    alignas(32) float ic2Left[width] = {};
+    alignas(32) float ic1Right[width] = {};
+    alignas(32) float ic2Right[width] = {};
+};
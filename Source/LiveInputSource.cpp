@@ -0,0 +1,66 @@
+#include "LiveInputSource.h"
+
+LiveInputSource::LiveInputSource(double captureSampleRate, int numInputChannels, double captureSeconds, int maximumLeadToUse)
+    : SampleSource(static_cast<juce::int64>(captureSeconds * captureSampleRate), juce::jlimit(1, 2, numInputChannels), captureSampleRate, "Live Input"),
+      maximumLead(juce::jmax(0, maximumLeadToUse)),
+      ringSamples(static_cast<int>(getLengthInSamples()) + maximumLead + mirrorSamples)
+{
+    ring.setSize(getNumChannels(), ringSamples + mirrorSamples);
+    ring.clear();
+}
+
+void LiveInputSource::write(const juce::AudioBuffer<float>& input, int numSamples)
+{
+    const juce::int64 head = writeHead.load(std::memory_order_relaxed);
+    const int numInputChannels = input.getNumChannels();
+
+    if (numInputChannels == 0)
+        return;
+
+    for (int done = 0; done < numSamples;)
+    {
+        const int index = static_cast<int>((head + done) % ringSamples);
+        const int count = juce::jmin(numSamples - done, ringSamples - index);
+
+        for (int ch = 0; ch < getNumChannels(); ++ch)
+        {
+            // Mono input feeds both channels
+            const int inputChannel = juce::jmin(ch, numInputChannels - 1);
+            ring.copyFrom(ch, index, input, inputChannel, done, count);
+
+            if (index < mirrorSamples)
+                ring.copyFrom(ch, ringSamples + index, input, inputChannel, done, juce::jmin(count, mirrorSamples - index));
+        }
+
+        done += count;
+    }
+
+    writeHead.store(head + numSamples, std::memory_order_release);
+}
+
+bool LiveInputSource::isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    if (reversed || startSample < 0)
+        return false;
+
+    // The next write may already be under way, up to maximumLead past the head
+    const juce::int64 head = getWriteHead();
+    return endSample <= head && startSample >= head + maximumLead - ringSamples;
+}
+
+bool LiveInputSource::acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const
+{
+    // Windows are contiguous only as far as the repeated part of the ring reaches
+    if (endSample - startSample > mirrorSamples || !isResident(startSample, endSample, reversed))
+        return false;
+
+    const int index = static_cast<int>(startSample % ringSamples);
+    window.left = ring.getReadPointer(0, index);
+    window.right = ring.getReadPointer(getNumChannels() > 1 ? 1 : 0, index);
+    window.frameBytes = static_cast<int>(sizeof(float));
+    window.format = SampleFormat::float32;
+    window.start = startSample;
+    window.length = static_cast<int>(endSample - startSample);
+    window.slot = -1;
+    return true;
+}
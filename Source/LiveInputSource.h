@@ -0,0 +1,51 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+// The plugin's input, captured into a fixed ring as the host delivers it and read by
+// grains in place, like any other source. Samples are numbered from the start of the
+// capture, so a grain keeps reading the same audio while the write head moves on past
+// it. Only the last getLengthInSamples() are readable: the ring is larger by the most the
+// capture can run ahead of the engine, so nothing is overwritten while it may be read.
+// The start of the ring is repeated past its end, so every window is contiguous.
+class LiveInputSource : public SampleSource
+{
+public:
+    // maximumLead is how far the capture may run ahead of the engine: a block, plus any
+    // latency the engine renders ahead by
+    LiveInputSource(double captureSampleRate, int numInputChannels, double captureSeconds, int maximumLead);
+
+    // Audio thread: appends the input and moves the write head past it
+    void write(const juce::AudioBuffer<float>& input, int numSamples);
+
+    // Samples captured so far, which is also the number of the next one
+    juce::int64 getWriteHead() const { return writeHead.load(std::memory_order_acquire); }
+
+    juce::int64 getFirstSample() const override { return getWriteHead() - getLengthInSamples(); }
+    bool isLive() const override { return true; }
+
+    bool isStreaming() const override { return false; }
+    bool isShareable() const override { return false; }
+
+    // Audio still arriving has no reversed copy; reverse grains read it forwards
+    void prepareReversed() override {}
+    bool canReadReversed() const override { return false; }
+
+    // Resident means captured and not yet about to be overwritten. Windows are pinned in
+    // spans no longer than the repeated part of the ring.
+    bool isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+    bool acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const override;
+
+    static constexpr int mirrorSamples = 16384;
+
+private:
+    const int maximumLead;
+    const int ringSamples;
+
+    // ringSamples followed by the first mirrorSamples again, per channel
+    juce::AudioBuffer<float> ring;
+    std::atomic<juce::int64> writeHead { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LiveInputSource)
+};
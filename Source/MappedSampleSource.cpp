@@ -0,0 +1,293 @@
+#include "MappedSampleSource.h"
+
+namespace
+{
+    // JUCE keeps the mapped data layout protected; a derived class may still name the members
+    // to form pointers to them, which can then be used on any reader
+    struct MappedDataAccess : juce::MemoryMappedAudioFormatReader
+    {
+        static const char* getSamplePointer(const juce::MemoryMappedAudioFormatReader& reader, juce::int64 sample)
+        {
+            return static_cast<const char*>((reader.*(&MappedDataAccess::sampleToPointer))(sample));
+        }
+
+        static int getBytesPerFrame(const juce::MemoryMappedAudioFormatReader& reader)
+        {
+            return reader.*(&MappedDataAccess::bytesPerFrame);
+        }
+    };
+
+    constexpr int numProbePositions = 64;
+    constexpr int numProbeFrames = 16;
+}
+
+MappedSampleSource::MappedSampleSource(std::unique_ptr<juce::MemoryMappedAudioFormatReader> mappedReader, const juce::String& name)
+    : SampleSource(mappedReader->lengthInSamples, static_cast<int>(mappedReader->numChannels), mappedReader->sampleRate, name),
+      reader(std::move(mappedReader)),
+      blockTouchTimes(new std::atomic<juce::uint32>[static_cast<size_t>(getNumBlocks())])
+{
+    const bool readable = findFormat(*reader, format);
+    jassert(readable);
+    juce::ignoreUnused(readable);
+
+    firstFrame = MappedDataAccess::getSamplePointer(*reader, 0);
+    bytesPerFrame = MappedDataAccess::getBytesPerFrame(*reader);
+    bytesPerSample = static_cast<int>(reader->bitsPerSample / 8);
+
+    for (juce::int64 block = 0; block < getNumBlocks(); ++block)
+        blockTouchTimes[static_cast<size_t>(block)] = 0;
+
+    toucher->add(*this);
+}
+
+MappedSampleSource::~MappedSampleSource()
+{
+    toucher->remove(*this);
+}
+
+bool MappedSampleSource::canReadDirectly(const juce::MemoryMappedAudioFormatReader& mappedReader)
+{
+    SampleFormat format = SampleFormat::float32;
+    return findFormat(mappedReader, format);
+}
+
+bool MappedSampleSource::findFormat(const juce::MemoryMappedAudioFormatReader& mappedReader, SampleFormat& format)
+{
+    const auto length = mappedReader.lengthInSamples;
+    const auto numChannels = static_cast<int>(mappedReader.numChannels);
+
+    if (length <= 0 || numChannels <= 0 || mappedReader.getMappedSection() != juce::Range<juce::int64>(0, length))
+        return false;
+
+    const int bytesPerSample = static_cast<int>(mappedReader.bitsPerSample / 8);
+    if (MappedDataAccess::getBytesPerFrame(mappedReader) != bytesPerSample * numChannels)
+        return false;
+
+    // AIFF is big-endian unless it is an AIFF-C 'sowt' file, WAV is always little-endian
+    const bool bigEndianFirst = mappedReader.getFormatName().startsWithIgnoreCase("AIFF");
+
+    juce::Array<SampleFormat> candidates;
+
+    if (mappedReader.usesFloatingPointData && mappedReader.bitsPerSample == 32)
+        candidates.add(SampleFormat::float32);
+    else if (!mappedReader.usesFloatingPointData && mappedReader.bitsPerSample == 16)
+        candidates.addArray(bigEndianFirst ? juce::Array<SampleFormat> { SampleFormat::int16BigEndian, SampleFormat::int16 }
+                                           : juce::Array<SampleFormat> { SampleFormat::int16, SampleFormat::int16BigEndian });
+    else if (!mappedReader.usesFloatingPointData && mappedReader.bitsPerSample == 24)
+        candidates.addArray(bigEndianFirst ? juce::Array<SampleFormat> { SampleFormat::int24BigEndian, SampleFormat::int24 }
+                                           : juce::Array<SampleFormat> { SampleFormat::int24, SampleFormat::int24BigEndian });
+
+    // Check the layout against the reader's own conversion at frames spread over the file
+    std::vector<float> expected(static_cast<size_t>(numChannels));
+
+    for (auto candidate : candidates)
+    {
+        bool matches = true;
+
+        for (int probe = 0; probe < numProbePositions && matches; ++probe)
+        {
+            const auto probeStart = length * probe / numProbePositions;
+
+            for (auto sample = probeStart; sample < juce::jmin(length, probeStart + numProbeFrames) && matches; ++sample)
+            {
+                mappedReader.getSample(sample, expected.data());
+                const char* frame = MappedDataAccess::getSamplePointer(mappedReader, sample);
+
+                for (int channel = 0; channel < numChannels && matches; ++channel)
+                    matches = std::abs(readSample(candidate, frame + channel * bytesPerSample) - expected[static_cast<size_t>(channel)]) < 1.0e-6f;
+            }
+        }
+
+        if (matches)
+        {
+            format = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool MappedSampleSource::analyse(const std::function<bool(float progress)>& shouldContinue)
+{
+    const auto length = getLengthInSamples();
+    juce::AudioBuffer<float> chunk(getNumChannels(), blockSize);
+
+    energyMap.prepare(length);
+
+    for (juce::int64 block = 0; block < getNumBlocks(); ++block)
+    {
+        if (!shouldContinue(static_cast<float>(block) / static_cast<float>(getNumBlocks())))
+            return false;
+
+        const juce::int64 start = block * blockSize;
+        const int numSamples = static_cast<int>(juce::jmin(length - start, static_cast<juce::int64>(blockSize)));
+
+        reader->read(chunk.getArrayOfWritePointers(), getNumChannels(), start, numSamples);
+        energyMap.addChunk(start, chunk, numSamples);
+
+        if (!peakPyramid.isReady())
+            peakPyramid.addChunk(start, chunk, numSamples);
+
+        blockTouchTimes[static_cast<size_t>(block)] = juce::jmax(1u, juce::Time::getMillisecondCounter());
+    }
+
+    energyMap.finish();
+
+    if (!peakPyramid.isReady())
+        peakPyramid.finish();
+
+    return shouldContinue(1.0f);
+}
+
+bool MappedSampleSource::isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    // In reversed coordinates the span covers forward samples [L - end, L - start)
+    const juce::int64 length = getLengthInSamples();
+    const juce::int64 first = juce::jmax(static_cast<juce::int64>(0), reversed ? length - endSample : startSample);
+    const juce::int64 end = juce::jmin(length, reversed ? length - startSample : endSample);
+
+    if (first >= end)
+        return true;
+
+    const auto now = juce::Time::getMillisecondCounter();
+
+    for (juce::int64 block = first / blockSize; block <= (end - 1) / blockSize; ++block)
+    {
+        if (!wasTouchedWithin(block, now, residentForMs))
+            return false;
+    }
+
+    return true;
+}
+
+bool MappedSampleSource::wasTouchedWithin(juce::int64 block, juce::uint32 now, juce::uint32 maxAgeMs) const
+{
+    const auto touchTime = blockTouchTimes[static_cast<size_t>(block)].load();
+    return touchTime != 0 && now - touchTime < maxAgeMs;
+}
+
+bool MappedSampleSource::acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const
+{
+    if (!isResident(startSample, endSample, reversed))
+        return false;
+
+    // Windows start at the block being read, so their length always fits in an int.
+    // Reversed windows start at the mirrored frame and step backwards through the file.
+    const juce::int64 length = getLengthInSamples();
+    const juce::int64 start = juce::jlimit(static_cast<juce::int64>(0), length - 1, startSample) / blockSize * blockSize;
+    const juce::int64 firstForwardSample = reversed ? length - 1 - start : start;
+    const char* frame = firstFrame + firstForwardSample * bytesPerFrame;
+
+    window.left = frame;
+    window.right = frame + (getNumChannels() > 1 ? bytesPerSample : 0);
+    window.frameBytes = reversed ? -bytesPerFrame : bytesPerFrame;
+    window.format = format;
+    window.start = start;
+    window.length = static_cast<int>(juce::jmin(length - start, static_cast<juce::int64>(std::numeric_limits<int>::max())));
+    window.slot = -1;
+    return true;
+}
+
+void MappedSampleSource::setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    // Wake the toucher only when the region reaches other blocks
+    const juce::int64 length = getLengthInSamples();
+
+    if (readRegions.set(readerId, reversed, reversed ? length - endSample : startSample, reversed ? length - startSample : endSample, blockSize))
+        toucher->regionMoved();
+}
+
+bool MappedSampleSource::touchRegions()
+{
+    std::array<ReadRegions::Region, ReadRegions::maxReaders> regions;
+    const int numRegions = readRegions.get(regions);
+
+    const juce::int64 lastBlock = getNumBlocks() - 1;
+    const auto now = juce::Time::getMillisecondCounter();
+
+    // Touch outwards from the middle of each region, a few blocks per pass so that a
+    // region that moves is followed quickly and other sources get their turn
+    int numTouched = 0;
+
+    for (int r = 0; r < numRegions && numTouched < maxBlocksPerPass; ++r)
+    {
+        const auto& region = regions[static_cast<size_t>(r)];
+        const juce::int64 first = juce::jlimit(static_cast<juce::int64>(0), lastBlock, region.start / blockSize);
+        const juce::int64 last = juce::jlimit(first, lastBlock, (region.end - 1) / blockSize);
+        const juce::int64 centre = (first + last) / 2;
+
+        for (juce::int64 i = 0; i < 2 * (last - first + 1) && numTouched < maxBlocksPerPass; ++i)
+        {
+            const juce::int64 block = (i % 2 == 0) ? centre + i / 2 : centre - (i + 1) / 2;
+            if (block < first || block > last || wasTouchedWithin(block, now, retouchAfterMs))
+                continue;
+
+            touchBlock(block);
+            ++numTouched;
+        }
+    }
+
+    return numTouched > 0;
+}
+
+void MappedSampleSource::touchBlock(juce::int64 block)
+{
+    const juce::int64 start = block * blockSize;
+    const juce::int64 end = juce::jmin(getLengthInSamples(), start + blockSize);
+    const juce::int64 samplesPerPage = juce::jmax(1, pageBytes / bytesPerFrame);
+
+    for (juce::int64 sample = start; sample < end; sample += samplesPerPage)
+        reader->touchSample(sample);
+
+    reader->touchSample(end - 1);
+    blockTouchTimes[static_cast<size_t>(block)] = juce::jmax(1u, juce::Time::getMillisecondCounter());
+}
+
+PageToucher::PageToucher()
+    : juce::Thread("PinkGrain Page Toucher")
+{
+    startThread(juce::Thread::Priority::low);
+}
+
+PageToucher::~PageToucher()
+{
+    jassert(sources.empty());
+    stopThread(4000);
+}
+
+void PageToucher::add(MappedSampleSource& source)
+{
+    const juce::ScopedLock sl(lock);
+    sources.push_back(&source);
+    notify();
+}
+
+void PageToucher::remove(MappedSampleSource& source)
+{
+    const juce::ScopedLock sl(lock);
+    sources.erase(std::remove(sources.begin(), sources.end(), &source), sources.end());
+}
+
+void PageToucher::run()
+{
+    while (!threadShouldExit())
+    {
+        bool touchedAny = false;
+
+        {
+            const juce::ScopedLock sl(lock);
+
+            for (auto* source : sources)
+            {
+                if (threadShouldExit())
+                    break;
+
+                touchedAny = source->touchRegions() || touchedAny;
+            }
+        }
+
+        if (!touchedAny)
+            wait(idleIntervalMs);
+    }
+}
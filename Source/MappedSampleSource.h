@@ -0,0 +1,101 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+class MappedSampleSource;
+
+// One low-priority thread that keeps the read regions of every mapped source in the page
+// cache. Sources register themselves and wake it when a region moves; otherwise it
+// looks again every so often to re-touch pages the OS may since have dropped. Shared
+// through a SharedResourcePointer.
+class PageToucher : private juce::Thread
+{
+public:
+    PageToucher();
+    ~PageToucher() override;
+
+    void add(MappedSampleSource& source);
+    void remove(MappedSampleSource& source);  // Waits for a pass over the source to finish
+
+    void regionMoved() { notify(); }
+
+private:
+    void run() override;
+
+    juce::CriticalSection lock;
+    std::vector<MappedSampleSource*> sources;
+
+    static constexpr int idleIntervalMs = 250;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PageToucher)
+};
+
+// An uncompressed WAV or AIFF file mapped into memory. Grains read the file's own sample
+// data, converting integer formats as they go, and reverse grains read it backwards, so
+// nothing is decoded or copied and every instance shares the OS page cache. The shared
+// PageToucher keeps the pages around each engine's read region warm; blocks it has not
+// touched recently are not resident, so the audio thread never faults in a cold page.
+class MappedSampleSource : public SampleSource
+{
+public:
+    // The reader must have its whole file mapped, in a layout canReadDirectly() accepts
+    MappedSampleSource(std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader, const juce::String& fileName);
+    ~MappedSampleSource() override;
+
+    // True when the grain kernel can read the reader's mapped data as it is
+    static bool canReadDirectly(const juce::MemoryMappedAudioFormatReader& reader);
+
+    // Fills the energy map by scanning the whole file, which also faults in every page.
+    // Call before the source is shared; returns false if shouldContinue() asks to stop.
+    bool analyse(const std::function<bool(float progress)>& shouldContinue);
+
+    // Pages come in from disk, but there is no block cache to fill
+    bool isStreaming() const override { return true; }
+
+    // Reverse grains read the mapped data backwards, so there is nothing to prepare
+    void prepareReversed() override {}
+    bool canReadReversed() const override { return true; }
+
+    bool isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+    bool acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const override;
+    void setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+
+    static constexpr int blockSize = 65536;
+
+private:
+    friend class PageToucher;
+
+    // Touches a few blocks of the read regions that are cold or due for a re-touch, and
+    // returns false once there were none
+    bool touchRegions();
+    void touchBlock(juce::int64 block);
+
+    // A block counts as resident for a while after it was last touched, since the OS may
+    // drop its pages again once nothing reads them
+    bool wasTouchedWithin(juce::int64 block, juce::uint32 now, juce::uint32 maxAgeMs) const;
+
+    static bool findFormat(const juce::MemoryMappedAudioFormatReader& reader, SampleFormat& format);
+
+    juce::int64 getNumBlocks() const { return (getLengthInSamples() + blockSize - 1) / blockSize; }
+
+    std::unique_ptr<juce::MemoryMappedAudioFormatReader> reader;
+    const char* firstFrame = nullptr;  // Start of sample 0 in the mapping
+    int bytesPerFrame = 0;
+    int bytesPerSample = 0;
+    SampleFormat format = SampleFormat::float32;
+
+    std::unique_ptr<std::atomic<juce::uint32>[]> blockTouchTimes;  // Millisecond counter, 0 if never
+
+    // Read regions, written by the engines
+    mutable ReadRegions readRegions;
+
+    juce::SharedResourcePointer<PageToucher> toucher;
+
+    static constexpr int maxBlocksPerPass = 16;
+    static constexpr juce::uint32 retouchAfterMs = 1000;
+    static constexpr juce::uint32 residentForMs = 4000;
+    static constexpr int pageBytes = 4096;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MappedSampleSource)
+};
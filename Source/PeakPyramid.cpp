@@ -0,0 +1,188 @@
+#include "PeakPyramid.h"
+
+void PeakPyramid::prepare(juce::int64 totalSamples, int channels)
+{
+    ready.store(false, std::memory_order_relaxed);
+    numSamples = juce::jmax(static_cast<juce::int64>(0), totalSamples);
+    numChannels = juce::jmax(0, channels);
+    levels.clear();
+
+    if (numSamples == 0 || numChannels == 0)
+        return;
+
+    // The finest level 0 that fits the budget, always a factor of the loaders' chunk size
+    juce::int64 samplesPerPeak = minSamplesPerPeak;
+    while (samplesPerPeak < maxSamplesPerPeak
+           && (numSamples + samplesPerPeak - 1) / samplesPerPeak * numChannels > maxLevelZeroPeaks)
+        samplesPerPeak *= levelRatio;
+
+    for (;;)
+    {
+        Level level;
+        level.samplesPerPeak = samplesPerPeak;
+        level.numPeaks = (numSamples + samplesPerPeak - 1) / samplesPerPeak;
+        level.minima.assign(static_cast<size_t>(level.numPeaks * numChannels), 0.0f);
+        level.maxima.assign(static_cast<size_t>(level.numPeaks * numChannels), 0.0f);
+        levels.push_back(std::move(level));
+
+        if (levels.back().numPeaks <= maxTopLevelPeaks)
+            break;
+
+        samplesPerPeak *= levelRatio;
+    }
+}
+
+void PeakPyramid::addChunk(juce::int64 startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples)
+{
+    if (levels.empty() || chunk.getNumChannels() == 0)
+        return;
+
+    auto& level = levels.front();
+    const int samplesPerPeak = static_cast<int>(level.samplesPerPeak);
+    jassert(startSample % samplesPerPeak == 0);
+
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        const float* data = chunk.getReadPointer(juce::jmin(channel, chunk.getNumChannels() - 1));
+        const size_t channelOffset = static_cast<size_t>(channel * level.numPeaks);
+
+        for (int offset = 0; offset < numChunkSamples; offset += samplesPerPeak)
+        {
+            const juce::int64 peak = (startSample + offset) / samplesPerPeak;
+            if (peak >= level.numPeaks)
+                break;
+
+            const auto range = juce::FloatVectorOperations::findMinAndMax(data + offset, juce::jmin(samplesPerPeak, numChunkSamples - offset));
+            level.minima[channelOffset + static_cast<size_t>(peak)] = range.getStart();
+            level.maxima[channelOffset + static_cast<size_t>(peak)] = range.getEnd();
+        }
+    }
+}
+
+void PeakPyramid::finish()
+{
+    for (size_t l = 1; l < levels.size(); ++l)
+    {
+        const auto& below = levels[l - 1];
+        auto& level = levels[l];
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const float* belowMinima = below.minima.data() + channel * below.numPeaks;
+            const float* belowMaxima = below.maxima.data() + channel * below.numPeaks;
+            float* minima = level.minima.data() + channel * level.numPeaks;
+            float* maxima = level.maxima.data() + channel * level.numPeaks;
+
+            for (juce::int64 peak = 0; peak < level.numPeaks; ++peak)
+            {
+                const juce::int64 first = peak * levelRatio;
+                const juce::int64 last = juce::jmin(first + levelRatio, below.numPeaks);
+
+                float lowest = belowMinima[first];
+                float highest = belowMaxima[first];
+
+                for (juce::int64 i = first + 1; i < last; ++i)
+                {
+                    lowest = juce::jmin(lowest, belowMinima[i]);
+                    highest = juce::jmax(highest, belowMaxima[i]);
+                }
+
+                minima[peak] = lowest;
+                maxima[peak] = highest;
+            }
+        }
+    }
+
+    ready.store(true, std::memory_order_release);
+}
+
+bool PeakPyramid::getPeaks(int channel, double startSample, double endSample, float* minima, float* maxima, int numPoints) const
+{
+    if (!isReady() || levels.empty() || channel < 0 || channel >= numChannels || numPoints <= 0 || endSample <= startSample)
+        return false;
+
+    const double span = (endSample - startSample) / numPoints;
+    if (span < static_cast<double>(levels.front().samplesPerPeak))
+        return false;
+
+    size_t l = 0;
+    while (l + 1 < levels.size() && static_cast<double>(levels[l + 1].samplesPerPeak) <= span)
+        ++l;
+
+    const auto& level = levels[l];
+    const double samplesPerPeak = static_cast<double>(level.samplesPerPeak);
+    const float* levelMinima = level.minima.data() + channel * level.numPeaks;
+    const float* levelMaxima = level.maxima.data() + channel * level.numPeaks;
+
+    for (int point = 0; point < numPoints; ++point)
+    {
+        const double from = startSample + point * span;
+        const auto first = juce::jmax(static_cast<juce::int64>(0), static_cast<juce::int64>(std::floor(from / samplesPerPeak)));
+        const auto last = juce::jmin(level.numPeaks, static_cast<juce::int64>(std::ceil((from + span) / samplesPerPeak)));
+
+        if (first >= last)
+        {
+            // Past either end of the sample
+            minima[point] = 0.0f;
+            maxima[point] = 0.0f;
+            continue;
+        }
+
+        float lowest = levelMinima[first];
+        float highest = levelMaxima[first];
+
+        for (juce::int64 i = first + 1; i < last; ++i)
+        {
+            lowest = juce::jmin(lowest, levelMinima[i]);
+            highest = juce::jmax(highest, levelMaxima[i]);
+        }
+
+        minima[point] = lowest;
+        maxima[point] = highest;
+    }
+
+    return true;
+}
+
+bool PeakPyramid::writeTo(juce::OutputStream& stream) const
+{
+    if (!isReady() || levels.empty())
+        return false;
+
+    const auto& level = levels.front();
+    const size_t numBytes = level.minima.size() * sizeof(float);
+
+    // The peaks themselves go in native byte order, which every platform the plugin builds for shares
+    return stream.writeInt(fileMagic)
+        && stream.writeInt(fileVersion)
+        && stream.writeInt64(numSamples)
+        && stream.writeInt(numChannels)
+        && stream.writeInt64(level.samplesPerPeak)
+        && stream.write(level.minima.data(), numBytes)
+        && stream.write(level.maxima.data(), numBytes);
+}
+
+bool PeakPyramid::readFrom(juce::InputStream& stream, juce::int64 totalSamples, int channels)
+{
+    if (stream.readInt() != fileMagic
+        || stream.readInt() != fileVersion
+        || stream.readInt64() != totalSamples
+        || stream.readInt() != channels)
+        return false;
+
+    const juce::int64 samplesPerPeak = stream.readInt64();
+
+    prepare(totalSamples, channels);
+    if (levels.empty() || levels.front().samplesPerPeak != samplesPerPeak)
+        return false;
+
+    auto& level = levels.front();
+    const int numBytes = static_cast<int>(level.minima.size() * sizeof(float));
+
+    if (stream.read(level.minima.data(), numBytes) != numBytes
+        || stream.read(level.maxima.data(), numBytes) != numBytes)
+        return false;
+
+    finish();
+    return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Min/max peaks of a sample at several resolutions, so it can be drawn at any zoom without
+// touching the samples. Level 0 holds a peak per 16 samples (more for very long samples, so
+// the pyramid stays small) and each level above merges four peaks of the one below.
+class PeakPyramid
+{
+public:
+    static constexpr int levelRatio = 4;
+    static constexpr int minSamplesPerPeak = 16;
+    static constexpr int maxSamplesPerPeak = 65536;
+
+    PeakPyramid() = default;
+
+    // Filled like EnergyMap: chunks must start on a level 0 peak and must not overlap, but
+    // may be added in any order and from several threads at once. Until finish() the
+    // pyramid is not ready, so it may already be shared.
+    void prepare(juce::int64 totalSamples, int numChannels);
+    void addChunk(juce::int64 startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples);
+    void finish();
+
+    bool isReady() const { return ready.load(std::memory_order_acquire); }
+
+    // Min and max of each of numPoints equal spans covering [startSample, endSample) of the
+    // channel, from the coarsest level with at least one peak per span. Returns false when
+    // the pyramid is not ready or the spans are shorter than a level 0 peak, in which case
+    // the samples themselves are the right thing to draw.
+    bool getPeaks(int channel, double startSample, double endSample, float* minima, float* maxima, int numPoints) const;
+
+    // Stores level 0 as a sidecar file; the levels above are rebuilt when it is read back.
+    // Reading fails, leaving the pyramid not ready, if the file is for a different sample.
+    bool writeTo(juce::OutputStream& stream) const;
+    bool readFrom(juce::InputStream& stream, juce::int64 totalSamples, int numChannels);
+
+private:
+    struct Level
+    {
+        int samplesPerPeak = 0;
+        juce::int64 numPeaks = 0;
+        std::vector<float> minima;  // One channel after another
+        std::vector<float> maxima;
+    };
+
+    std::vector<Level> levels;
+    juce::int64 numSamples = 0;
+    int numChannels = 0;
+    std::atomic<bool> ready { false };
+
+    static constexpr juce::int64 maxLevelZeroPeaks = 4 * 1024 * 1024;  // Over all channels, about 32 MB
+    static constexpr juce::int64 maxTopLevelPeaks = 512;
+    static constexpr int fileMagic = 0x4b504750;  // "PGPK"
+    static constexpr int fileVersion = 1;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PeakPyramid)
+};
@@ -13,7 +13,9 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
       panDial("PAN"),
       sprayDial("SPRAY"),
       pitchRandomDial("PITCH RND"),
-      maxGrainsDial("MAX GRAINS")
+      maxGrainsDial("MAX GRAINS"),
+      filterCutoffDial("CUTOFF"),
+      filterSpreadDial("CUT SPREAD")
 {
     setLookAndFeel(&lookAndFeel);
 
@@ -22,6 +24,16 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
     loadFileButton.onClick = [this]() { loadFileButtonClicked(); };
     addAndMakeVisible(loadFileButton);
 
+    liveInputButton.setButtonText("Live");
+    liveInputButton.setClickingTogglesState(true);
+    liveInputButton.setToggleState(audioProcessor.isLiveInputEnabled(), juce::dontSendNotification);
+    liveInputButton.onClick = [this]() { audioProcessor.setLiveInputEnabled(liveInputButton.getToggleState()); };
+    addAndMakeVisible(liveInputButton);
+
+    zonesButton.setButtonText("Zones");
+    zonesButton.onClick = [this]() { zonesButtonClicked(); };
+    addAndMakeVisible(zonesButton);
+
     savePresetButton.setButtonText("Save");
     savePresetButton.onClick = [this]() { savePresetButtonClicked(); };
     addAndMakeVisible(savePresetButton);
@@ -30,6 +42,24 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
     presetCombo.onChange = [this]() { presetComboChanged(); };
     addAndMakeVisible(presetCombo);
     refreshPresetList();
+    audioProcessor.getPresetIndex().addChangeListener(this);
+
+    presetOptionsButton.setButtonText("...");
+    presetOptionsButton.onClick = [this]() { presetOptionsButtonClicked(); };
+    addAndMakeVisible(presetOptionsButton);
+
+    // Item IDs are the storage mode plus one
+    storageCombo.addItem("Auto", 1);
+    storageCombo.addItem("32-bit", 2);
+    storageCombo.addItem("16-bit", 3);
+    storageCombo.addItem("Half", 4);
+    storageCombo.setSelectedId(static_cast<int>(audioProcessor.getSampleStorage()) + 1, juce::dontSendNotification);
+    storageCombo.onChange = [this]()
+    {
+        audioProcessor.setSampleStorage(static_cast<AudioFileLoader::StorageMode>(storageCombo.getSelectedId() - 1));
+    };
+    addAndMakeVisible(storageCombo);
+    audioProcessor.getAudioFileLoader().addListener(this);
 
     titleLabel.setText("PINKGRAIN", juce::dontSendNotification);
     titleLabel.setFont(juce::FontOptions(24.0f).withStyle("Bold"));
@@ -37,26 +67,25 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
     titleLabel.setJustificationType(juce::Justification::centred);
     addAndMakeVisible(titleLabel);
 
+    layerButton.onClick = [this]() { layerButtonClicked(); };
+    addAndMakeVisible(layerButton);
+
     addAndMakeVisible(volumeControl);
     audioProcessor.setVolumeControl(&volumeControl);
 
     // Waveform displays
     addAndMakeVisible(waveformDisplay);
-    waveformDisplay.setPositionParameter(audioProcessor.getApvts().getRawParameterValue(PinkGrainAudioProcessor::POSITION_ID));
-    waveformDisplay.setGrainSizeParameter(audioProcessor.getApvts().getRawParameterValue(PinkGrainAudioProcessor::GRAIN_SIZE_ID));
 
     addAndMakeVisible(liveWaveformDisplay);
     audioProcessor.setLiveWaveformDisplay(&liveWaveformDisplay);
 
     // Zoomed waveform display
     addAndMakeVisible(zoomedWaveformDisplay);
-    zoomedWaveformDisplay.setPositionParameter(audioProcessor.getApvts().getRawParameterValue(PinkGrainAudioProcessor::POSITION_ID));
-    zoomedWaveformDisplay.setGrainSizeParameter(audioProcessor.getApvts().getRawParameterValue(PinkGrainAudioProcessor::GRAIN_SIZE_ID));
 
     // Set up mouse drag callback to update position parameter
     waveformDisplay.onPositionChanged = [this](float newPosition)
     {
-        if (auto* param = audioProcessor.getApvts().getParameter(PinkGrainAudioProcessor::POSITION_ID))
+        if (auto* param = audioProcessor.getApvts().getParameter(PinkGrainAudioProcessor::getLayerParameterId(shownLayer, PinkGrainAudioProcessor::POSITION_ID)))
         {
             param->setValueNotifyingHost(param->convertTo0to1(newPosition));
         }
@@ -65,7 +94,7 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
     // Set up mouse drag callback to update size parameter
     waveformDisplay.onSizeChanged = [this](float newSizeMs)
     {
-        if (auto* param = audioProcessor.getApvts().getParameter(PinkGrainAudioProcessor::GRAIN_SIZE_ID))
+        if (auto* param = audioProcessor.getApvts().getParameter(PinkGrainAudioProcessor::getLayerParameterId(shownLayer, PinkGrainAudioProcessor::GRAIN_SIZE_ID)))
         {
             param->setValueNotifyingHost(param->convertTo0to1(newSizeMs));
         }
@@ -87,59 +116,34 @@ PinkGrainAudioProcessorEditor::PinkGrainAudioProcessorEditor(PinkGrainAudioProce
     reverseButton.setColour(juce::ToggleButton::tickColourId, PinkGrainLookAndFeel::primaryColour);
     addAndMakeVisible(reverseButton);
 
+    freezeButton.setButtonText("FREEZE");
+    freezeButton.setColour(juce::ToggleButton::textColourId, PinkGrainLookAndFeel::textColour);
+    freezeButton.setColour(juce::ToggleButton::tickColourId, PinkGrainLookAndFeel::primaryColour);
+    addAndMakeVisible(freezeButton);
+
     addAndMakeVisible(pitchRandomDial);
     addAndMakeVisible(maxGrainsDial);
+    addAndMakeVisible(filterCutoffDial);
+    addAndMakeVisible(filterSpreadDial);
 
-    // Parameter attachments
+    // Parameter attachments; the rest follow the layer shown
     auto& apvts = audioProcessor.getApvts();
 
-    volumeAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::VOLUME_ID, volumeControl.getSlider());
-
-    sizeAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::GRAIN_SIZE_ID, sizeDial.getSlider());
-
-    densityAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::DENSITY_ID, densityDial.getSlider());
-
-    positionAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::POSITION_ID, positionDial.getSlider());
-
-    pitchAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::PITCH_ID, pitchDial.getSlider());
-
-    panAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::PAN_SPREAD_ID, panDial.getSlider());
-
-    sprayAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::SPRAY_ID, sprayDial.getSlider());
-
-    attackAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::ATTACK_ID, adsrControl.getAttackSlider());
-
-    decayAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::DECAY_ID, adsrControl.getDecaySlider());
-
-    sustainAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::SUSTAIN_ID, adsrControl.getSustainSlider());
-
-    releaseAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::RELEASE_ID, adsrControl.getReleaseSlider());
-
-    reverseAttachment = std::make_unique<juce::AudioProcessorValueTreeState::ButtonAttachment>(
-        apvts, PinkGrainAudioProcessor::REVERSE_ID, reverseButton);
-
-    pitchRandomAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
-        apvts, PinkGrainAudioProcessor::PITCH_RANDOM_ID, pitchRandomDial.getSlider());
+    freezeAttachment = std::make_unique<juce::AudioProcessorValueTreeState::ButtonAttachment>(
+        apvts, PinkGrainAudioProcessor::FREEZE_ID, freezeButton);
 
     maxGrainsAttachment = std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
         apvts, PinkGrainAudioProcessor::MAX_GRAINS_ID, maxGrainsDial.getSlider());
 
+    showLayer(0);
+
     setSize(800, 600);
 }
 
 PinkGrainAudioProcessorEditor::~PinkGrainAudioProcessorEditor()
 {
+    audioProcessor.getPresetIndex().removeChangeListener(this);
+    audioProcessor.getAudioFileLoader().removeListener(this);
     audioProcessor.setLiveWaveformDisplay(nullptr);
     audioProcessor.setVolumeControl(nullptr);
     setLookAndFeel(nullptr);
@@ -158,12 +162,22 @@ void PinkGrainAudioProcessorEditor::resized()
     auto headerRow = bounds.removeFromTop(50);
     loadFileButton.setBounds(headerRow.removeFromLeft(70).reduced(0, 10));
     headerRow.removeFromLeft(5);
+    liveInputButton.setBounds(headerRow.removeFromLeft(50).reduced(0, 10));
+    headerRow.removeFromLeft(5);
+    zonesButton.setBounds(headerRow.removeFromLeft(60).reduced(0, 10));
+    headerRow.removeFromLeft(5);
     savePresetButton.setBounds(headerRow.removeFromLeft(70).reduced(0, 10));
     headerRow.removeFromLeft(5);
     presetCombo.setBounds(headerRow.removeFromLeft(150).reduced(0, 10));
+    headerRow.removeFromLeft(5);
+    presetOptionsButton.setBounds(headerRow.removeFromLeft(30).reduced(0, 10));
+    headerRow.removeFromLeft(5);
+    storageCombo.setBounds(headerRow.removeFromLeft(80).reduced(0, 10));
     headerRow.removeFromLeft(10);
 
     auto volumeArea = headerRow.removeFromRight(200);
+    layerButton.setBounds(volumeArea.removeFromLeft(45).reduced(0, 10));
+    volumeArea.removeFromLeft(5);
     volumeControl.setBounds(volumeArea.reduced(0, 12));
 
     titleLabel.setBounds(headerRow);
@@ -208,15 +222,19 @@ void PinkGrainAudioProcessorEditor::resized()
     adsrControl.setBounds(row2.removeFromLeft(200));
     row2.removeFromLeft(20);
 
-    // Remaining space split for reverse button, pitch random, and max grains (use top 90px)
+    // Remaining space split for reverse/freeze buttons, pitch random, max grains and filter (use top 90px)
     auto controlsArea = row2.removeFromTop(90);
-    const int remainingWidth = controlsArea.getWidth() / 3;
+    const int remainingWidth = controlsArea.getWidth() / 5;
 
-    auto reverseArea = controlsArea.removeFromLeft(remainingWidth);
-    reverseButton.setBounds(reverseArea.reduced(20, 30));
+    auto toggleArea = controlsArea.removeFromLeft(remainingWidth).reduced(5, 12);
+    reverseButton.setBounds(toggleArea.removeFromTop(30));
+    toggleArea.removeFromTop(6);
+    freezeButton.setBounds(toggleArea.removeFromTop(30));
 
     pitchRandomDial.setBounds(controlsArea.removeFromLeft(remainingWidth));
     maxGrainsDial.setBounds(controlsArea.removeFromLeft(remainingWidth));
+    filterCutoffDial.setBounds(controlsArea.removeFromLeft(remainingWidth));
+    filterSpreadDial.setBounds(controlsArea.removeFromLeft(remainingWidth));
 }
 
 void PinkGrainAudioProcessorEditor::loadFileButtonClicked()
@@ -239,6 +257,169 @@ void PinkGrainAudioProcessorEditor::loadFileButtonClicked()
     });
 }
 
+void PinkGrainAudioProcessorEditor::layerButtonClicked()
+{
+    auto& apvts = audioProcessor.getApvts();
+    juce::PopupMenu menu;
+
+    for (int layer = 0; layer < PinkGrainAudioProcessor::numLayers; ++layer)
+    {
+        // Channels without a layer of their own play channel 1's
+        const auto* enabled = layer > 0 ? apvts.getRawParameterValue(PinkGrainAudioProcessor::getLayerParameterId(layer, PinkGrainAudioProcessor::LAYER_ID))
+                                        : nullptr;
+        const bool off = enabled != nullptr && enabled->load() <= 0.5f;
+
+        menu.addItem("Channel " + juce::String(layer + 1) + (off ? " (off)" : ""), true, layer == shownLayer,
+                     [this, layer]() { showLayer(layer); });
+    }
+
+    if (shownLayer > 0)
+    {
+        auto* layerParameter = apvts.getParameter(PinkGrainAudioProcessor::getLayerParameterId(shownLayer, PinkGrainAudioProcessor::LAYER_ID));
+        const bool on = layerParameter->getValue() > 0.5f;
+
+        menu.addSeparator();
+        menu.addItem("Layer On", true, on, [layerParameter, on]()
+        {
+            layerParameter->beginChangeGesture();
+            layerParameter->setValueNotifyingHost(on ? 0.0f : 1.0f);
+            layerParameter->endChangeGesture();
+        });
+    }
+
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&layerButton));
+}
+
+void PinkGrainAudioProcessorEditor::showLayer(int layer)
+{
+    using SliderAttachment = juce::AudioProcessorValueTreeState::SliderAttachment;
+    using ButtonAttachment = juce::AudioProcessorValueTreeState::ButtonAttachment;
+
+    shownLayer = layer;
+    layerButton.setButtonText("Ch " + juce::String(layer + 1));
+
+    auto& apvts = audioProcessor.getApvts();
+    const auto id = [layer](const juce::String& parameterId) { return PinkGrainAudioProcessor::getLayerParameterId(layer, parameterId); };
+
+    // Old attachments go first, so the new ones setting the controls never write to the previous layer
+    volumeAttachment.reset();
+    sizeAttachment.reset();
+    densityAttachment.reset();
+    positionAttachment.reset();
+    pitchAttachment.reset();
+    panAttachment.reset();
+    sprayAttachment.reset();
+    attackAttachment.reset();
+    decayAttachment.reset();
+    sustainAttachment.reset();
+    releaseAttachment.reset();
+    reverseAttachment.reset();
+    pitchRandomAttachment.reset();
+    filterCutoffAttachment.reset();
+    filterSpreadAttachment.reset();
+
+    volumeAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::VOLUME_ID), volumeControl.getSlider());
+    sizeAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::GRAIN_SIZE_ID), sizeDial.getSlider());
+    densityAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::DENSITY_ID), densityDial.getSlider());
+    positionAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::POSITION_ID), positionDial.getSlider());
+    pitchAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::PITCH_ID), pitchDial.getSlider());
+    panAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::PAN_SPREAD_ID), panDial.getSlider());
+    sprayAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::SPRAY_ID), sprayDial.getSlider());
+    attackAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::ATTACK_ID), adsrControl.getAttackSlider());
+    decayAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::DECAY_ID), adsrControl.getDecaySlider());
+    sustainAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::SUSTAIN_ID), adsrControl.getSustainSlider());
+    releaseAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::RELEASE_ID), adsrControl.getReleaseSlider());
+    reverseAttachment = std::make_unique<ButtonAttachment>(apvts, id(PinkGrainAudioProcessor::REVERSE_ID), reverseButton);
+    pitchRandomAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::PITCH_RANDOM_ID), pitchRandomDial.getSlider());
+    filterCutoffAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::FILTER_CUTOFF_ID), filterCutoffDial.getSlider());
+    filterSpreadAttachment = std::make_unique<SliderAttachment>(apvts, id(PinkGrainAudioProcessor::FILTER_SPREAD_ID), filterSpreadDial.getSlider());
+
+    waveformDisplay.setPositionParameter(apvts.getRawParameterValue(id(PinkGrainAudioProcessor::POSITION_ID)));
+    waveformDisplay.setGrainSizeParameter(apvts.getRawParameterValue(id(PinkGrainAudioProcessor::GRAIN_SIZE_ID)));
+    zoomedWaveformDisplay.setPositionParameter(apvts.getRawParameterValue(id(PinkGrainAudioProcessor::POSITION_ID)));
+    zoomedWaveformDisplay.setGrainSizeParameter(apvts.getRawParameterValue(id(PinkGrainAudioProcessor::GRAIN_SIZE_ID)));
+}
+
+void PinkGrainAudioProcessorEditor::zonesButtonClicked()
+{
+    juce::PopupMenu menu;
+    menu.addItem("Add Zone...", [this]() { addZoneClicked(); });
+
+    const auto& zones = audioProcessor.getZones();
+    if (!zones.empty())
+        menu.addSeparator();
+
+    for (size_t i = 0; i < zones.size(); ++i)
+    {
+        const auto& zone = zones[i];
+        const auto text = juce::File(zone.filePath).getFileName()
+                        + "  keys " + juce::String(zone.lowKey) + "-" + juce::String(zone.highKey)
+                        + "  vel " + juce::String(zone.lowVelocity) + "-" + juce::String(zone.highVelocity)
+                        + "  root " + juce::String(zone.rootNote);
+
+        juce::PopupMenu zoneMenu;
+        zoneMenu.addItem("Remove", [this, index = static_cast<int>(i)]() { audioProcessor.removeZone(index); });
+        menu.addSubMenu(text, zoneMenu);
+    }
+
+    menu.addSeparator();
+    menu.addItem("Clear Zones", !zones.empty(), false, [this]() { audioProcessor.clearZones(); });
+
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&zonesButton));
+}
+
+void PinkGrainAudioProcessorEditor::addZoneClicked()
+{
+    fileChooser = std::make_unique<juce::FileChooser>(
+        "Select the zone's audio file...",
+        juce::File{},
+        "*.wav;*.aif;*.aiff;*.mp3;*.flac");
+
+    auto chooserFlags = juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles;
+
+    fileChooser->launchAsync(chooserFlags, [this](const juce::FileChooser& fc)
+    {
+        auto file = fc.getResult();
+        if (!file.existsAsFile())
+            return;
+
+        auto zoneWindow = std::make_unique<juce::AlertWindow>(
+            "Add Zone",
+            "Keys and velocities the zone plays, and the key that plays " + file.getFileName() + " at its original pitch:",
+            juce::MessageBoxIconType::NoIcon);
+
+        zoneWindow->addTextEditor("keys", "0-127", "Keys:");
+        zoneWindow->addTextEditor("velocities", "1-127", "Velocities:");
+        zoneWindow->addTextEditor("root", juce::String(GrainEngine::ROOT_NOTE), "Root Note:");
+        zoneWindow->addButton("Add", 1, juce::KeyPress(juce::KeyPress::returnKey));
+        zoneWindow->addButton("Cancel", 0, juce::KeyPress(juce::KeyPress::escapeKey));
+
+        zoneWindow->enterModalState(true, juce::ModalCallbackFunction::create(
+            [this, file, alertWindow = zoneWindow.release()](int result)
+            {
+                std::unique_ptr<juce::AlertWindow> aw(alertWindow);
+                if (result != 1)
+                    return;
+
+                // Ranges are "low-high", or a single number
+                const auto readRange = [&aw](const juce::String& name, int& low, int& high)
+                {
+                    const auto text = aw->getTextEditorContents(name).trim();
+                    low = juce::jlimit(0, 127, text.upToFirstOccurrenceOf("-", false, false).getIntValue());
+                    high = text.containsChar('-') ? juce::jlimit(0, 127, text.fromFirstOccurrenceOf("-", false, false).getIntValue()) : low;
+                };
+
+                PinkGrainAudioProcessor::SampleZone zone;
+                zone.filePath = file.getFullPathName();
+                readRange("keys", zone.lowKey, zone.highKey);
+                readRange("velocities", zone.lowVelocity, zone.highVelocity);
+                zone.rootNote = juce::jlimit(0, 127, aw->getTextEditorContents("root").getIntValue());
+
+                audioProcessor.addZone(zone);
+            }));
+    });
+}
+
 void PinkGrainAudioProcessorEditor::savePresetButtonClicked()
 {
     auto presetName = std::make_unique<juce::AlertWindow>(
@@ -276,8 +457,45 @@ void PinkGrainAudioProcessorEditor::presetComboChanged()
     }
 }
 
+void PinkGrainAudioProcessorEditor::presetOptionsButtonClicked()
+{
+    juce::PopupMenu crossfadeMenu;
+    const float currentCrossfade = audioProcessor.getPresetCrossfade();
+
+    for (const float seconds : { 0.02f, 0.1f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f })
+    {
+        const auto text = seconds < 1.0f ? juce::String(juce::roundToInt(seconds * 1000.0f)) + " ms"
+                                         : juce::String(juce::roundToInt(seconds)) + " s";
+
+        crossfadeMenu.addItem(text, true, std::abs(seconds - currentCrossfade) < 0.001f,
+                              [this, seconds]() { audioProcessor.setPresetCrossfade(seconds); });
+    }
+
+    juce::PopupMenu menu;
+    menu.addSubMenu("Crossfade", crossfadeMenu);
+    menu.addItem("Prefetch Neighbours", true, audioProcessor.getPresetPrefetch(),
+                 [this]() { audioProcessor.setPresetPrefetch(!audioProcessor.getPresetPrefetch()); });
+
+    juce::PopupMenu renderAheadMenu;
+    const int currentRenderAhead = audioProcessor.getRenderAhead();
+
+    for (const int blocks : { 0, 2, 4, 8 })
+    {
+        renderAheadMenu.addItem(blocks == 0 ? juce::String("Off") : juce::String(blocks) + " Blocks",
+                                true, blocks == currentRenderAhead,
+                                [this, blocks]() { audioProcessor.setRenderAhead(blocks); });
+    }
+
+    menu.addSeparator();
+    menu.addSubMenu("Render Ahead", renderAheadMenu);
+
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&presetOptionsButton));
+}
+
 void PinkGrainAudioProcessorEditor::refreshPresetList()
 {
+    // The list is rebuilt whenever the index changes, so keep the chosen preset selected
+    const auto selected = presetCombo.getText();
     presetCombo.clear(juce::dontSendNotification);
 
     juce::StringArray presets = audioProcessor.getPresetList();
@@ -286,4 +504,18 @@ void PinkGrainAudioProcessorEditor::refreshPresetList()
     {
         presetCombo.addItem(preset, id++);
     }
+
+    if (const int index = presets.indexOf(selected); selected.isNotEmpty() && index >= 0)
+        presetCombo.setSelectedId(index + 1, juce::dontSendNotification);
+}
+
+void PinkGrainAudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcaster* /*source*/)
+{
+    refreshPresetList();
+}
+
+void PinkGrainAudioProcessorEditor::fileLoaded(const juce::String& /*fileName*/)
+{
+    // Presets switch their sample's storage once it has been decoded in the background
+    storageCombo.setSelectedId(static_cast<int>(audioProcessor.getSampleStorage()) + 1, juce::dontSendNotification);
 }
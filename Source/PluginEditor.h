@@ -10,7 +10,9 @@
 #include "UI/VolumeControl.h"
 #include "UI/ADSRControl.h"
 
-class PinkGrainAudioProcessorEditor : public juce::AudioProcessorEditor
+class PinkGrainAudioProcessorEditor : public juce::AudioProcessorEditor,
+                                      private juce::ChangeListener,
+                                      private AudioFileLoader::Listener
 {
 public:
     explicit PinkGrainAudioProcessorEditor(PinkGrainAudioProcessor&);
@@ -23,7 +25,17 @@ private:
     void loadFileButtonClicked();
     void savePresetButtonClicked();
     void presetComboChanged();
+    void presetOptionsButtonClicked();
+    void zonesButtonClicked();
+    void addZoneClicked();
+    void layerButtonClicked();
+
+    // Points the dials and displays at the parameters of the layer played on MIDI channel layer + 1
+    void showLayer(int layer);
     void refreshPresetList();
+    void changeListenerCallback(juce::ChangeBroadcaster* source) override;
+    void fileLoaded(const juce::String& fileName) override;
+    void fileCleared() override {}
 
     PinkGrainAudioProcessor& audioProcessor;
 
@@ -31,9 +43,14 @@ private:
 
     // Header
     juce::TextButton loadFileButton;
+    juce::TextButton liveInputButton;
+    juce::TextButton zonesButton;
     juce::TextButton savePresetButton;
     juce::ComboBox presetCombo;
+    juce::TextButton presetOptionsButton;
+    juce::ComboBox storageCombo;
     juce::Label titleLabel;
+    juce::TextButton layerButton;
     VolumeControl volumeControl;
 
     // Waveform displays
@@ -52,8 +69,11 @@ private:
     // Parameter dials - Row 2
     ADSRControl adsrControl;
     juce::ToggleButton reverseButton;
+    juce::ToggleButton freezeButton;
     CustomDial pitchRandomDial;
     CustomDial maxGrainsDial;
+    CustomDial filterCutoffDial;
+    CustomDial filterSpreadDial;
 
     // Parameter attachments
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> volumeAttachment;
@@ -68,10 +88,15 @@ private:
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> sustainAttachment;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> releaseAttachment;
     std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> reverseAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment> freezeAttachment;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> pitchRandomAttachment;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> maxGrainsAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> filterCutoffAttachment;
+    std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment> filterSpreadAttachment;
 
     std::unique_ptr<juce::FileChooser> fileChooser;
 
+    int shownLayer = 0;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PinkGrainAudioProcessorEditor)
 };
@@ -18,161 +18,329 @@ const juce::String PinkGrainAudioProcessor::SPRAY_ID = "spray";
 const juce::String PinkGrainAudioProcessor::PITCH_RANDOM_ID = "pitchRandom";
 const juce::String PinkGrainAudioProcessor::VOLUME_ID = "volume";
 const juce::String PinkGrainAudioProcessor::MAX_GRAINS_ID = "maxGrains";
+const juce::String PinkGrainAudioProcessor::FREEZE_ID = "freeze";
+const juce::String PinkGrainAudioProcessor::FILTER_CUTOFF_ID = "filterCutoff";
+const juce::String PinkGrainAudioProcessor::FILTER_SPREAD_ID = "filterSpread";
+const juce::String PinkGrainAudioProcessor::LAYER_ID = "layer";
+
+namespace
+{
+    // Parameter table of the binary state. New parameters are only ever appended, so
+    // states saved before they existed leave them at their defaults.
+    const juce::String* const binaryStateParameterIds[] =
+    {
+        &PinkGrainAudioProcessor::GRAIN_SIZE_ID,
+        &PinkGrainAudioProcessor::DENSITY_ID,
+        &PinkGrainAudioProcessor::POSITION_ID,
+        &PinkGrainAudioProcessor::PITCH_ID,
+        &PinkGrainAudioProcessor::PAN_SPREAD_ID,
+        &PinkGrainAudioProcessor::ATTACK_ID,
+        &PinkGrainAudioProcessor::DECAY_ID,
+        &PinkGrainAudioProcessor::SUSTAIN_ID,
+        &PinkGrainAudioProcessor::RELEASE_ID,
+        &PinkGrainAudioProcessor::REVERSE_ID,
+        &PinkGrainAudioProcessor::SPRAY_ID,
+        &PinkGrainAudioProcessor::PITCH_RANDOM_ID,
+        &PinkGrainAudioProcessor::VOLUME_ID,
+        &PinkGrainAudioProcessor::MAX_GRAINS_ID,
+        &PinkGrainAudioProcessor::FREEZE_ID,
+        &PinkGrainAudioProcessor::FILTER_CUTOFF_ID,
+        &PinkGrainAudioProcessor::FILTER_SPREAD_ID
+    };
+
+    // Followed by these for each layer past the first, in channel order
+    const juce::String* const binaryStateLayerParameterIds[] =
+    {
+        &PinkGrainAudioProcessor::LAYER_ID,
+        &PinkGrainAudioProcessor::GRAIN_SIZE_ID,
+        &PinkGrainAudioProcessor::DENSITY_ID,
+        &PinkGrainAudioProcessor::POSITION_ID,
+        &PinkGrainAudioProcessor::PITCH_ID,
+        &PinkGrainAudioProcessor::PAN_SPREAD_ID,
+        &PinkGrainAudioProcessor::ATTACK_ID,
+        &PinkGrainAudioProcessor::DECAY_ID,
+        &PinkGrainAudioProcessor::SUSTAIN_ID,
+        &PinkGrainAudioProcessor::RELEASE_ID,
+        &PinkGrainAudioProcessor::REVERSE_ID,
+        &PinkGrainAudioProcessor::SPRAY_ID,
+        &PinkGrainAudioProcessor::PITCH_RANDOM_ID,
+        &PinkGrainAudioProcessor::VOLUME_ID,
+        &PinkGrainAudioProcessor::FILTER_CUTOFF_ID,
+        &PinkGrainAudioProcessor::FILTER_SPREAD_ID
+    };
+
+    juce::AudioProcessor::BusesProperties createBusesProperties()
+    {
+        auto buses = juce::AudioProcessor::BusesProperties()
+                         .withInput("Input", juce::AudioChannelSet::stereo(), false)
+                         .withOutput("Output", juce::AudioChannelSet::stereo(), true);
+
+        // Layers past the first play out of the main output unless the host enables theirs
+        for (int layer = 1; layer < GrainEngine::MAX_LAYERS; ++layer)
+            buses = buses.withOutput("Ch " + juce::String(layer + 1), juce::AudioChannelSet::stereo(), false);
+
+        return buses;
+    }
+}
 
 PinkGrainAudioProcessor::PinkGrainAudioProcessor()
-    : AudioProcessor(BusesProperties()
-                     .withOutput("Output", juce::AudioChannelSet::stereo(), true)),
+    : AudioProcessor(createBusesProperties()),
       apvts(*this, nullptr, "Parameters", createParameterLayout())
 {
-    restoreSession();
+    // No file I/O here, so plugin scans and new instances construct quickly
+    for (const auto* id : binaryStateParameterIds)
+        stateParameters.push_back(apvts.getParameter(*id));
+
+    for (int layer = 1; layer < numLayers; ++layer)
+    {
+        for (const auto* id : binaryStateLayerParameterIds)
+            stateParameters.push_back(apvts.getParameter(getLayerParameterId(layer, *id)));
+    }
+
+    // Every change to the state is saved to the session
+    for (auto* parameter : stateParameters)
+    {
+        jassert(parameter != nullptr);
+        apvts.addParameterListener(parameter->getParameterID(), this);
+    }
+
+    // Looked up once, as the audio thread reads them every block
+    for (int layer = 0; layer < numLayers; ++layer)
+    {
+        const auto value = [this, layer](const juce::String& id) { return apvts.getRawParameterValue(getLayerParameterId(layer, id)); };
+        auto& values = layerParameterValues[static_cast<size_t>(layer)];
+
+        values.enabled = layer > 0 ? value(LAYER_ID) : nullptr;
+        values.grainSize = value(GRAIN_SIZE_ID);
+        values.density = value(DENSITY_ID);
+        values.position = value(POSITION_ID);
+        values.pitch = value(PITCH_ID);
+        values.panSpread = value(PAN_SPREAD_ID);
+        values.attack = value(ATTACK_ID);
+        values.decay = value(DECAY_ID);
+        values.sustain = value(SUSTAIN_ID);
+        values.release = value(RELEASE_ID);
+        values.reverse = value(REVERSE_ID);
+        values.spray = value(SPRAY_ID);
+        values.pitchRandom = value(PITCH_RANDOM_ID);
+        values.volume = value(VOLUME_ID);
+        values.filterCutoff = value(FILTER_CUTOFF_ID);
+        values.filterSpread = value(FILTER_SPREAD_ID);
+    }
 }
 
 PinkGrainAudioProcessor::~PinkGrainAudioProcessor()
 {
-    saveSession();
+    for (auto* parameter : stateParameters)
+        apvts.removeParameterListener(parameter->getParameterID(), this);
+
+    cancelPendingUpdate();
+
+    // An instance that never got as far as restoring (a plugin scan, say) must not
+    // overwrite its slot's session with its defaults
+    if (!sessionRestorePending.load())
+        saveSession();
+
+    sessionWriter->releaseSlot(sessionSlot);
+}
+
+juce::String PinkGrainAudioProcessor::getLayerParameterId(int layer, const juce::String& parameterId)
+{
+    return layer == 0 ? parameterId : "ch" + juce::String(layer + 1) + "_" + parameterId;
 }
 
 juce::AudioProcessorValueTreeState::ParameterLayout PinkGrainAudioProcessor::createParameterLayout()
 {
     std::vector<std::unique_ptr<juce::RangedAudioParameter>> params;
 
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(GRAIN_SIZE_ID, 1),
-        "Grain Size",
-        juce::NormalisableRange<float>(10.0f, 30000.0f, 1.0f, 0.3f),
-        100.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) {
-            if (value >= 1000.0f)
-                return juce::String(value / 1000.0f, 2) + " s";
-            return juce::String(value, 0) + " ms";
-        },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(DENSITY_ID, 1),
-        "Density",
-        juce::NormalisableRange<float>(1.0f, 100.0f, 0.1f, 0.5f),
-        10.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(value, 1) + " g/s"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(POSITION_ID, 1),
-        "Position",
-        juce::NormalisableRange<float>(0.0f, 1.0f, 0.001f),
-        0.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(PITCH_ID, 1),
-        "Pitch",
-        juce::NormalisableRange<float>(-24.0f, 24.0f, 0.1f),
-        0.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(value, 1) + " st"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(PAN_SPREAD_ID, 1),
-        "Pan Spread",
-        juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
-        0.5f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(ATTACK_ID, 1),
-        "Attack",
-        juce::NormalisableRange<float>(0.0f, 100.0f, 0.1f, 0.5f),
-        10.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(value, 1) + " ms"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(DECAY_ID, 1),
-        "Decay",
-        juce::NormalisableRange<float>(0.0f, 500.0f, 1.0f, 0.5f),
-        50.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(value, 0) + " ms"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(SUSTAIN_ID, 1),
-        "Sustain",
-        juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
-        0.8f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(RELEASE_ID, 1),
-        "Release",
-        juce::NormalisableRange<float>(0.0f, 5000.0f, 1.0f, 0.5f),
-        50.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) {
-            if (value >= 1000.0f)
-                return juce::String(value / 1000.0f, 2) + " s";
-            return juce::String(value, 0) + " ms";
-        },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterBool>(
-        juce::ParameterID(REVERSE_ID, 1),
-        "Reverse",
-        false));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(SPRAY_ID, 1),
-        "Spray",
-        juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
-        0.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(PITCH_RANDOM_ID, 1),
-        "Pitch Random",
-        juce::NormalisableRange<float>(0.0f, 24.0f, 0.1f),
-        0.0f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(value, 1) + " st"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterFloat>(
-        juce::ParameterID(VOLUME_ID, 1),
-        "Volume",
-        juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
-        0.8f,
-        juce::String(),
-        juce::AudioProcessorParameter::genericParameter,
-        [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
-        nullptr));
-
-    params.push_back(std::make_unique<juce::AudioParameterInt>(
-        juce::ParameterID(MAX_GRAINS_ID, 1),
-        "Max Grains",
-        64, 2048, 512));
+    // Channel 1's parameters come first, in the order hosts have always seen them; the
+    // other channels' layers were added later, so their IDs carry a newer version hint
+    for (int layer = 0; layer < numLayers; ++layer)
+    {
+        const auto id = [layer](const juce::String& parameterId) { return juce::ParameterID(getLayerParameterId(layer, parameterId), layer == 0 ? 1 : 2); };
+        const auto name = [layer](const juce::String& text) { return layer == 0 ? text : "Ch " + juce::String(layer + 1) + " " + text; };
+
+        if (layer > 0)
+        {
+            params.push_back(std::make_unique<juce::AudioParameterBool>(
+                id(LAYER_ID),
+                name("Layer"),
+                false));
+        }
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(GRAIN_SIZE_ID),
+            name("Grain Size"),
+            juce::NormalisableRange<float>(10.0f, 30000.0f, 1.0f, 0.3f),
+            100.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) {
+                if (value >= 1000.0f)
+                    return juce::String(value / 1000.0f, 2) + " s";
+                return juce::String(value, 0) + " ms";
+            },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(DENSITY_ID),
+            name("Density"),
+            juce::NormalisableRange<float>(1.0f, 100.0f, 0.1f, 0.5f),
+            10.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 1) + " g/s"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(POSITION_ID),
+            name("Position"),
+            juce::NormalisableRange<float>(0.0f, 1.0f, 0.001f),
+            0.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(PITCH_ID),
+            name("Pitch"),
+            juce::NormalisableRange<float>(-24.0f, 24.0f, 0.1f),
+            0.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 1) + " st"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(PAN_SPREAD_ID),
+            name("Pan Spread"),
+            juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
+            0.5f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(ATTACK_ID),
+            name("Attack"),
+            juce::NormalisableRange<float>(0.0f, 100.0f, 0.1f, 0.5f),
+            10.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 1) + " ms"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(DECAY_ID),
+            name("Decay"),
+            juce::NormalisableRange<float>(0.0f, 500.0f, 1.0f, 0.5f),
+            50.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 0) + " ms"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(SUSTAIN_ID),
+            name("Sustain"),
+            juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
+            0.8f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(RELEASE_ID),
+            name("Release"),
+            juce::NormalisableRange<float>(0.0f, 5000.0f, 1.0f, 0.5f),
+            50.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) {
+                if (value >= 1000.0f)
+                    return juce::String(value / 1000.0f, 2) + " s";
+                return juce::String(value, 0) + " ms";
+            },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterBool>(
+            id(REVERSE_ID),
+            name("Reverse"),
+            false));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(SPRAY_ID),
+            name("Spray"),
+            juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
+            0.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(PITCH_RANDOM_ID),
+            name("Pitch Random"),
+            juce::NormalisableRange<float>(0.0f, 24.0f, 0.1f),
+            0.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 1) + " st"; },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(VOLUME_ID),
+            name("Volume"),
+            juce::NormalisableRange<float>(0.0f, 1.0f, 0.01f),
+            0.8f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(static_cast<int>(value * 100)) + "%"; },
+            nullptr));
+
+        // Shared by every layer
+        if (layer == 0)
+        {
+            params.push_back(std::make_unique<juce::AudioParameterInt>(
+                id(MAX_GRAINS_ID),
+                name("Max Grains"),
+                64, 2048, 512));
+
+            params.push_back(std::make_unique<juce::AudioParameterBool>(
+                id(FREEZE_ID),
+                name("Freeze"),
+                false));
+        }
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(FILTER_CUTOFF_ID),
+            name("Filter Cutoff"),
+            juce::NormalisableRange<float>(20.0f, 20000.0f, 1.0f, 0.25f),
+            20000.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) {
+                if (value >= 20000.0f)
+                    return juce::String("Off");
+                if (value >= 1000.0f)
+                    return juce::String(value / 1000.0f, 1) + " kHz";
+                return juce::String(value, 0) + " Hz";
+            },
+            nullptr));
+
+        params.push_back(std::make_unique<juce::AudioParameterFloat>(
+            id(FILTER_SPREAD_ID),
+            name("Filter Spread"),
+            juce::NormalisableRange<float>(0.0f, 4.0f, 0.01f),
+            0.0f,
+            juce::String(),
+            juce::AudioProcessorParameter::genericParameter,
+            [](float value, int) { return juce::String(value, 2) + " oct"; },
+            nullptr));
+    }
 
     return { params.begin(), params.end() };
 }
@@ -199,7 +367,28 @@ bool PinkGrainAudioProcessor::isMidiEffect() const
 
 double PinkGrainAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.5;  // Account for grain release time
+    // After the last note-off grains fade over the release, but none outlasts its own
+    // length, while frozen loops always fade over the full release
+    const bool frozen = apvts.getRawParameterValue(FREEZE_ID)->load() > 0.5f;
+    double releaseTail = 0.0;
+
+    for (int layer = 0; layer < numLayers; ++layer)
+    {
+        const auto& values = layerParameterValues[static_cast<size_t>(layer)];
+        if (values.enabled != nullptr && values.enabled->load() <= 0.5f)
+            continue;
+
+        const double grainSeconds = values.grainSize->load() / 1000.0;
+        const double releaseSeconds = values.release->load() / 1000.0;
+
+        releaseTail = juce::jmax(releaseTail, frozen && layer == 0 ? releaseSeconds : juce::jmin(grainSeconds, releaseSeconds));
+    }
+
+    // Grains already playing can last longer, for instance after the release was shortened
+    const double sampleRate = getSampleRate();
+    const double playingTail = sampleRate > 0.0 ? tailSamples.load() / sampleRate : 0.0;
+
+    return juce::jmax(releaseTail, playingTail);
 }
 
 int PinkGrainAudioProcessor::getNumPrograms()
@@ -227,16 +416,78 @@ void PinkGrainAudioProcessor::changeProgramName(int /*index*/, const juce::Strin
 
 void PinkGrainAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
+    // The worker renders with the engines, so it stops before they are prepared again
+    renderAhead.reset();
+
+    const int latency = renderAheadBlocks.load() * samplesPerBlock;
+    setLatencySamples(latency);
+
+    // Input is captured a block ahead of the engine, and further still when it renders ahead,
+    // by as much as it ever may so that the depth can change without a new capture
+    const int numInputChannels = getTotalNumInputChannels();
+    liveInput = numInputChannels > 0 ? new LiveInputSource(sampleRate, numInputChannels, liveCaptureSeconds,
+                                                           samplesPerBlock * (1 + maxRenderAheadBlocks))
+                                     : nullptr;
+
     grainEngine.prepare(sampleRate, samplesPerBlock);
 
-    if (audioFileLoader.hasFile())
+    grainEngine.setSource(getEngineSource());
+    grainEngine.setZones(getZoneMap());
+
+    outgoingEngine.prepare(sampleRate, samplesPerBlock);
+    outgoingEngine.setZones(nullptr);
+    outgoingEngine.setSource(nullptr);
+    outgoingBuffer.setSize(getTotalNumOutputChannels(), samplesPerBlock);
+
+    // Layers play out of their own bus once the host enables it
+    for (int layer = 1; layer < numLayers; ++layer)
+    {
+        const auto* bus = getBus(false, layer);
+        const int firstChannel = bus != nullptr && bus->isEnabled() ? getChannelIndexInProcessBlockBuffer(false, layer, 0) : 0;
+        grainEngine.setLayerOutput(layer, firstChannel);
+    }
+
+    std::fill(layerEnabled.begin(), layerEnabled.end(), false);
+
+    for (auto& heldLayers : noteLayers)
+        heldLayers.fill(-1);
+
+    crossfadeRemaining = 0;
+    outputIdle = false;
+
+    startRenderAhead(latency, samplesPerBlock);
+    prepared = true;
+    scheduleSessionRestore();
+}
+
+void PinkGrainAudioProcessor::startRenderAhead(int latency, int samplesPerBlock)
+{
+    if (latency > 0)
     {
-        grainEngine.setSourceBuffer(&audioFileLoader.getBuffer(), audioFileLoader.getSampleRate());
+        renderAhead = std::make_unique<RenderAhead>(latency, samplesPerBlock, getTotalNumOutputChannels(),
+                                                    [this](juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages)
+                                                    {
+                                                        juce::ScopedNoDenormals noDenormals;
+                                                        renderUnlessIdle(buffer, midiMessages);
+                                                    });
     }
 }
 
+void PinkGrainAudioProcessor::switchRenderAhead()
+{
+    // Between blocks, with the old worker stopped before the new one renders with the engines
+    const juce::ScopedLock sl(getCallbackLock());
+
+    renderAhead.reset();
+
+    if (prepared.load())
+        startRenderAhead(renderAheadBlocks.load() * getBlockSize(), getBlockSize());
+}
+
 void PinkGrainAudioProcessor::releaseResources()
 {
+    prepared = false;
+    renderAhead.reset();
 }
 
 bool PinkGrainAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts) const
@@ -245,6 +496,19 @@ bool PinkGrainAudioProcessor::isBusesLayoutSupported(const BusesLayout& layouts)
     if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
         return false;
 
+    // The input for live granulation is optional, mono or stereo
+    const auto input = layouts.getMainInputChannelSet();
+    if (!input.isDisabled() && input != juce::AudioChannelSet::mono() && input != juce::AudioChannelSet::stereo())
+        return false;
+
+    // So are the layers' outputs, which are stereo like the main one
+    for (int bus = 1; bus < layouts.outputBuses.size(); ++bus)
+    {
+        const auto& output = layouts.outputBuses.getReference(bus);
+        if (!output.isDisabled() && output != juce::AudioChannelSet::stereo())
+            return false;
+    }
+
     return true;
 }
 
@@ -253,73 +517,269 @@ void PinkGrainAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer,
 {
     juce::ScopedNoDenormals noDenormals;
 
+    // Capture the input for live granulation before the buffer is reused for the output
+    if (liveInput != nullptr && getTotalNumInputChannels() > 0)
+        liveInput->write(getBusBuffer(buffer, true, 0), buffer.getNumSamples());
+
     // Clear output buffer
     buffer.clear();
 
-    // Update grain engine parameters from APVTS
-    updateGrainEngineParameters();
+    if (renderAhead != nullptr)
+        renderAhead->process(buffer, midiMessages);
+    else if (!renderUnlessIdle(buffer, midiMessages))
+        return;
+
+    // Push samples to live waveform display
+    if (liveWaveformDisplay != nullptr && buffer.getNumChannels() >= 2)
+    {
+        liveWaveformDisplay->pushSamples(buffer.getReadPointer(0),
+                                          buffer.getReadPointer(1),
+                                          buffer.getNumSamples());
+    }
+
+    // Push samples to volume control for level metering
+    if (volumeControl != nullptr && buffer.getNumChannels() >= 2)
+    {
+        volumeControl->pushSamples(buffer.getReadPointer(0),
+                                   buffer.getReadPointer(1),
+                                   buffer.getNumSamples());
+    }
+}
 
-    // Update source buffer if file is loaded
-    if (audioFileLoader.hasFile())
+bool PinkGrainAudioProcessor::renderUnlessIdle(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages)
+{
+    // Idle instances output silence without touching the engine. The displays get one
+    // silent block to fall back to zero, after which a block costs next to nothing.
+    if (midiMessages.isEmpty() && crossfadeRemaining == 0 && grainEngine.isIdle())
     {
-        grainEngine.setSourceBuffer(&audioFileLoader.getBuffer(), audioFileLoader.getSampleRate());
+        tailSamples = 0;
+        return !std::exchange(outputIdle, true);
+    }
+
+    outputIdle = false;
+    renderBlock(buffer, midiMessages);
+    return true;
+}
+
+void PinkGrainAudioProcessor::renderBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages)
+{
+    // A loaded preset takes over at once, even while the previous one is still fading out
+    int expected = switchReady;
+    if (presetSwitchState.compare_exchange_strong(expected, switchIdle))
+        startPresetCrossfade();
+
+    // Both stay as they are while a preset switch is on its way
+    if (presetSwitchState.load() == switchIdle)
+    {
+        // Update grain engine parameters from APVTS
+        updateGrainEngineParameters();
+
+        // Pick up a newly loaded sample; grains already playing finish on the previous one
+        grainEngine.setSource(getEngineSource());
+        grainEngine.setZones(getZoneMap());
     }
 
-    // Process MIDI messages
+    // Process grains up to each MIDI event, then apply it, so events land on their own sample
+    const int numSamples = buffer.getNumSamples();
+    int renderedSamples = 0;
+
     for (const auto metadata : midiMessages)
     {
-        const auto msg = metadata.getMessage();
+        const int eventSample = juce::jlimit(renderedSamples, numSamples, metadata.samplePosition);
 
-        if (msg.isNoteOn())
-        {
-            grainEngine.noteOn(msg.getNoteNumber(), msg.getFloatVelocity());
-        }
-        else if (msg.isNoteOff())
+        if (eventSample > renderedSamples)
         {
-            grainEngine.noteOff(msg.getNoteNumber());
-        }
-        else if (msg.isAllNotesOff() || msg.isAllSoundOff())
-        {
-            grainEngine.allNotesOff();
+            renderGrains(buffer, renderedSamples, eventSample - renderedSamples);
+            renderedSamples = eventSample;
         }
+
+        handleMidiEvent(metadata.getMessage());
     }
 
-    // Process grains
-    grainEngine.process(buffer);
+    if (renderedSamples < numSamples)
+        renderGrains(buffer, renderedSamples, numSamples - renderedSamples);
 
-    // Push samples to live waveform display
-    if (liveWaveformDisplay != nullptr && buffer.getNumChannels() >= 2)
+    tailSamples = juce::jmax(grainEngine.getTailSamples(), crossfadeRemaining);
+}
+
+void PinkGrainAudioProcessor::handleMidiEvent(const juce::MidiMessage& msg)
+{
+    const int channel = msg.getChannel() - 1;
+    auto& heldLayers = noteLayers[static_cast<size_t>(channel)];
+
+    // Channels without a layer of their own play the first
+    const int layer = channel > 0 && layerEnabled[static_cast<size_t>(channel)] ? channel : 0;
+
+    const auto releaseNote = [this](int midiNote, int noteLayer)
     {
-        liveWaveformDisplay->pushSamples(buffer.getReadPointer(0),
-                                          buffer.getReadPointer(1),
-                                          buffer.getNumSamples());
+        grainEngine.noteOff(midiNote, noteLayer);
+
+        if (crossfadeRemaining > 0)
+            outgoingEngine.noteOff(midiNote, noteLayer);
+    };
+
+    if (msg.isNoteOn())
+    {
+        grainEngine.noteOn(msg.getNoteNumber(), msg.getFloatVelocity(), layer);
+        heldLayers[static_cast<size_t>(msg.getNoteNumber())] = static_cast<juce::int8>(layer);
+    }
+    else if (msg.isNoteOff())
+    {
+        // A note ends on the layer it started on, even if its channel's layer was switched since
+        auto& heldLayer = heldLayers[static_cast<size_t>(msg.getNoteNumber())];
+        releaseNote(msg.getNoteNumber(), heldLayer >= 0 ? heldLayer : layer);
+        heldLayer = -1;
+    }
+    else if (msg.isAllNotesOff() || msg.isAllSoundOff())
+    {
+        for (int midiNote = 0; midiNote < 128; ++midiNote)
+        {
+            const int heldLayer = heldLayers[static_cast<size_t>(midiNote)];
+
+            if (heldLayer >= 0 && heldLayer != layer)
+                releaseNote(midiNote, heldLayer);
+        }
+
+        heldLayers.fill(-1);
+        grainEngine.allNotesOff(layer);
+
+        if (crossfadeRemaining > 0)
+            outgoingEngine.allNotesOff(layer);
     }
+}
 
-    // Push samples to volume control for level metering
-    if (volumeControl != nullptr && buffer.getNumChannels() >= 2)
+void PinkGrainAudioProcessor::renderGrains(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    grainEngine.process(buffer, startSample, numSamples);
+
+    if (crossfadeRemaining > 0)
+        renderPresetCrossfade(buffer, startSample, numSamples);
+}
+
+void PinkGrainAudioProcessor::startPresetCrossfade()
+{
+    // A cloud still fading out goes on from the gain it has reached
+    const float outgoingGain = crossfadeRemaining > 0 ? static_cast<float>(crossfadeRemaining) / static_cast<float>(crossfadeLength) : 0.0f;
+
+    crossfadeLength = juce::jmax(1, static_cast<int>(presetCrossfadeSeconds.load() * getSampleRate()));
+    crossfadeRemaining = crossfadeLength;
+
+    // The parameters the old cloud was spawned with go with it, so apply the new ones after
+    grainEngine.handOverTo(outgoingEngine, crossfadeLength, outgoingGain);
+}
+
+void PinkGrainAudioProcessor::renderPresetCrossfade(juce::AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    // Only grows if the host sends a larger block than it prepared for
+    outgoingBuffer.setSize(outgoingBuffer.getNumChannels(), buffer.getNumSamples(), false, false, true);
+    outgoingBuffer.clear(startSample, numSamples);
+    outgoingEngine.process(outgoingBuffer, startSample, numSamples);
+
+    // The new cloud builds up on its own as its grains start, so only the old one is ramped
+    const int fadeSamples = juce::jmin(numSamples, crossfadeRemaining);
+    const float startGain = static_cast<float>(crossfadeRemaining) / static_cast<float>(crossfadeLength);
+    crossfadeRemaining -= fadeSamples;
+    const float endGain = static_cast<float>(crossfadeRemaining) / static_cast<float>(crossfadeLength);
+
+    for (int channel = 0; channel < juce::jmin(outgoingBuffer.getNumChannels(), buffer.getNumChannels()); ++channel)
+        buffer.addFromWithRamp(channel, startSample, outgoingBuffer.getReadPointer(channel, startSample), fadeSamples, startGain, endGain);
+
+    // Sources the old cloud still holds are kept alive by their loaders, so this never frees one
+    if (crossfadeRemaining == 0)
     {
-        volumeControl->pushSamples(buffer.getReadPointer(0),
-                                   buffer.getReadPointer(1),
-                                   buffer.getNumSamples());
+        outgoingEngine.setZones(nullptr);
+        outgoingEngine.setSource(nullptr);
     }
 }
 
 void PinkGrainAudioProcessor::updateGrainEngineParameters()
 {
-    grainEngine.setGrainSize(*apvts.getRawParameterValue(GRAIN_SIZE_ID));
-    grainEngine.setDensity(*apvts.getRawParameterValue(DENSITY_ID));
-    grainEngine.setPosition(*apvts.getRawParameterValue(POSITION_ID));
-    grainEngine.setPitch(*apvts.getRawParameterValue(PITCH_ID));
-    grainEngine.setPanSpread(*apvts.getRawParameterValue(PAN_SPREAD_ID));
-    grainEngine.setAttack(*apvts.getRawParameterValue(ATTACK_ID));
-    grainEngine.setDecay(*apvts.getRawParameterValue(DECAY_ID));
-    grainEngine.setSustain(*apvts.getRawParameterValue(SUSTAIN_ID));
-    grainEngine.setRelease(*apvts.getRawParameterValue(RELEASE_ID));
-    grainEngine.setReverse(*apvts.getRawParameterValue(REVERSE_ID) > 0.5f);
-    grainEngine.setSpray(*apvts.getRawParameterValue(SPRAY_ID));
-    grainEngine.setPitchRandom(*apvts.getRawParameterValue(PITCH_RANDOM_ID));
-    grainEngine.setVolume(*apvts.getRawParameterValue(VOLUME_ID));
+    for (int layer = 0; layer < numLayers; ++layer)
+    {
+        const auto& values = layerParameterValues[static_cast<size_t>(layer)];
+
+        // A layer switched off lets go of its notes, as its channel now plays the first layer
+        const bool enabled = values.enabled == nullptr || values.enabled->load() > 0.5f;
+        if (std::exchange(layerEnabled[static_cast<size_t>(layer)], enabled) && !enabled)
+            grainEngine.allNotesOff(layer);
+
+        GrainParameters layerParams;
+        layerParams.grainSizeMs = values.grainSize->load();
+        layerParams.density = values.density->load();
+        layerParams.position = values.position->load();
+        layerParams.pitchSemitones = values.pitch->load();
+        layerParams.panSpread = values.panSpread->load();
+        layerParams.attackMs = values.attack->load();
+        layerParams.decayMs = values.decay->load();
+        layerParams.sustainLevel = values.sustain->load();
+        layerParams.releaseMs = values.release->load();
+        layerParams.reverse = values.reverse->load() > 0.5f;
+        layerParams.spray = values.spray->load();
+        layerParams.pitchRandom = values.pitchRandom->load();
+        layerParams.volume = values.volume->load();
+        layerParams.filterCutoffHz = values.filterCutoff->load();
+        layerParams.filterSpread = values.filterSpread->load();
+        grainEngine.setParameters(layerParams, layer);
+    }
+
     grainEngine.setMaxActiveGrains(static_cast<int>(*apvts.getRawParameterValue(MAX_GRAINS_ID)));
+    grainEngine.setFreeze(*apvts.getRawParameterValue(FREEZE_ID) > 0.5f);
+}
+
+void PinkGrainAudioProcessor::parameterChanged(const juce::String& parameterID, float newValue)
+{
+    // May be called from the audio thread, so the reversed copy is built on the message
+    // thread. Every layer's reverse parameter ends with the same ID.
+    if (parameterID.endsWith(REVERSE_ID) && newValue > 0.5f)
+    {
+        reversedBufferWanted = true;
+        triggerAsyncUpdate();
+    }
+
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::handleAsyncUpdate()
+{
+    // Skipped if the host has applied its own state since the restore was scheduled
+    if (sessionRestoreScheduled.exchange(false) && sessionRestorePending.load())
+        restoreSession();
+
+    if (renderAheadChanged.exchange(false))
+        switchRenderAhead();
+
+    if (reversedBufferWanted.exchange(false))
+    {
+        audioFileLoader.prepareReversedBuffer();
+
+        for (auto& loader : zoneLoaders)
+            loader->prepareReversedBuffer();
+    }
+
+    // Handed over at most once per message loop pass, however many parameters changed
+    if (sessionChanged.exchange(false) && !sessionRestorePending.load())
+    {
+        juce::MemoryBlock data;
+        getStateInformation(data);
+        sessionWriter->submit(getSessionSlot(), std::move(data), false);
+    }
+}
+
+void PinkGrainAudioProcessor::markSessionChanged()
+{
+    sessionChanged = true;
+    triggerAsyncUpdate();
+}
+
+void PinkGrainAudioProcessor::scheduleSessionRestore()
+{
+    // Hosts call this from any thread, and often before setStateInformation(), so the
+    // restore waits for the message thread to get round to it
+    if (sessionRestorePending.load())
+    {
+        sessionRestoreScheduled = true;
+        triggerAsyncUpdate();
+    }
 }
 
 bool PinkGrainAudioProcessor::hasEditor() const
@@ -329,21 +789,154 @@ bool PinkGrainAudioProcessor::hasEditor() const
 
 juce::AudioProcessorEditor* PinkGrainAudioProcessor::createEditor()
 {
+    scheduleSessionRestore();
     return new PinkGrainAudioProcessorEditor(*this);
 }
 
 void PinkGrainAudioProcessor::getStateInformation(juce::MemoryBlock& destData)
+{
+    // A fixed layout of plain values, so hosts saving and snapshotting many instances
+    // do not pay for building and parsing XML
+    juce::MemoryOutputStream stream(destData, false);
+
+    stream.writeInt(binaryStateMagic);
+    stream.writeInt(binaryStateVersion);
+    stream.writeInt(static_cast<int>(stateParameters.size()));
+
+    for (const auto* parameter : stateParameters)
+        stream.writeFloat(parameter->convertFrom0to1(parameter->getValue()));
+
+    stream.writeInt(static_cast<int>(audioFileLoader.getStorageMode()));
+    stream.writeString(currentFilePath);
+    stream.writeString(audioFileLoader.getFileKey());
+
+    // Version 2
+    stream.writeFloat(presetCrossfadeSeconds.load());
+    stream.writeBool(presetPrefetch);
+
+    // Version 3
+    stream.writeInt(renderAheadBlocks.load());
+
+    // Version 4
+    stream.writeBool(liveInputEnabled.load());
+
+    // Version 5
+    stream.writeInt(static_cast<int>(zones.size()));
+
+    for (const auto& zone : zones)
+    {
+        stream.writeString(zone.filePath);
+        stream.writeInt(zone.lowKey);
+        stream.writeInt(zone.highKey);
+        stream.writeInt(zone.lowVelocity);
+        stream.writeInt(zone.highVelocity);
+        stream.writeInt(zone.rootNote);
+    }
+}
+
+void PinkGrainAudioProcessor::setStateInformation(const void* data, int sizeInBytes)
+{
+    // State from the host, a preset or the session itself replaces the last session
+    sessionRestorePending = false;
+    cancelPresetSwitch();
+
+    if (!readBinaryState(data, sizeInBytes))
+        readXmlState(data, sizeInBytes);
+}
+
+bool PinkGrainAudioProcessor::readBinaryState(const void* data, int sizeInBytes)
+{
+    if (data == nullptr || sizeInBytes < 3 * static_cast<int>(sizeof(int)))
+        return false;
+
+    juce::MemoryInputStream stream(data, static_cast<size_t>(sizeInBytes), false);
+
+    if (stream.readInt() != binaryStateMagic)
+        return false;
+
+    // Later versions only append fields, so any version can be read this far
+    const int version = stream.readInt();
+    const int numParameters = stream.readInt();
+
+    if (version < 1 || numParameters < 0 || stream.getNumBytesRemaining() < static_cast<juce::int64>(numParameters) * 4)
+        return false;
+
+    for (int i = 0; i < numParameters; ++i)
+    {
+        const float value = stream.readFloat();
+
+        if (i < static_cast<int>(stateParameters.size()))
+            restoreParameter(*stateParameters[static_cast<size_t>(i)], stateParameters[static_cast<size_t>(i)]->convertTo0to1(value));
+    }
+
+    // Parameters added since the state was saved
+    for (size_t i = static_cast<size_t>(numParameters); i < stateParameters.size(); ++i)
+        restoreParameter(*stateParameters[i], stateParameters[i]->getDefaultValue());
+
+    // The host reads every value back once, rather than hearing of each
+    updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withParameterInfoChanged(true));
+
+    const int storage = stream.readInt();
+    const auto filePath = stream.readString();
+    const auto fileKey = stream.readString();
+
+    restoreFile(filePath, fileKey, storage);
+
+    if (version >= 2 && stream.getNumBytesRemaining() >= 5)
+    {
+        setPresetCrossfade(stream.readFloat());
+        setPresetPrefetch(stream.readBool());
+    }
+
+    if (version >= 3 && stream.getNumBytesRemaining() >= 4)
+        setRenderAhead(stream.readInt());
+
+    if (version >= 4 && stream.getNumBytesRemaining() >= 1)
+        setLiveInputEnabled(stream.readBool());
+
+    // Like the parameters, states from before zones existed replace them with none
+    std::vector<SampleZone> restoredZones;
+    const int numZones = version >= 5 && stream.getNumBytesRemaining() >= 4 ? stream.readInt() : 0;
+
+    for (int i = 0; i < numZones && !stream.isExhausted(); ++i)
+    {
+        SampleZone zone;
+        zone.filePath = stream.readString();
+        zone.lowKey = stream.readInt();
+        zone.highKey = stream.readInt();
+        zone.lowVelocity = stream.readInt();
+        zone.highVelocity = stream.readInt();
+        zone.rootNote = stream.readInt();
+        restoredZones.push_back(zone);
+    }
+
+    restoreZones(restoredZones);
+
+    return true;
+}
+
+void PinkGrainAudioProcessor::restoreParameter(juce::RangedAudioParameter& parameter, float normalisedValue)
+{
+    // Like replaceState(), only values that change are set. The value tree state only learns
+    // of a value through the notifying setter, so this is what keeps restoring a state with
+    // hundreds of layer parameters, most at their defaults, from flooding the host.
+    if (!juce::approximatelyEqual(parameter.getValue(), normalisedValue))
+        parameter.setValueNotifyingHost(normalisedValue);
+}
+
+void PinkGrainAudioProcessor::writeXmlState(juce::MemoryBlock& destData)
 {
     auto state = apvts.copyState();
 
     // Add file path as a property
     state.setProperty("audioFilePath", currentFilePath, nullptr);
+    state.setProperty("sampleStorage", static_cast<int>(audioFileLoader.getStorageMode()), nullptr);
 
     std::unique_ptr<juce::XmlElement> xml(state.createXml());
     copyXmlToBinary(*xml, destData);
 }
 
-void PinkGrainAudioProcessor::setStateInformation(const void* data, int sizeInBytes)
+void PinkGrainAudioProcessor::readXmlState(const void* data, int sizeInBytes)
 {
     std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
 
@@ -353,96 +946,416 @@ void PinkGrainAudioProcessor::setStateInformation(const void* data, int sizeInBy
         {
             auto newState = juce::ValueTree::fromXml(*xmlState);
 
-            // Extract and restore file path
-            juce::String filePath = newState.getProperty("audioFilePath", "").toString();
-            if (filePath.isNotEmpty())
-            {
-                juce::File file(filePath);
-                if (file.existsAsFile())
-                {
-                    audioFileLoader.loadFile(file);
-                    currentFilePath = filePath;
-                }
-            }
+            restoreFile(newState.getProperty("audioFilePath", "").toString(), {},
+                        newState.getProperty("sampleStorage", 0));
 
             apvts.replaceState(newState);
         }
     }
 }
 
+void PinkGrainAudioProcessor::restoreFile(const juce::String& filePath, const juce::String& fileKey, int storage)
+{
+    const auto mode = static_cast<AudioFileLoader::StorageMode>(
+        juce::jlimit(0, static_cast<int>(AudioFileLoader::StorageMode::float16), storage));
+
+    // Hosts re-apply state for undo and the like; if it was saved with the sample that is
+    // already loaded, that sample is kept rather than loaded again
+    if (fileKey.isNotEmpty() && filePath == currentFilePath && fileKey == audioFileLoader.getFileKey()
+        && mode == audioFileLoader.getStorageMode())
+        return;
+
+    // Set before the file loads so it is decoded in the saved format
+    audioFileLoader.setStorageMode(mode);
+
+    if (filePath.isNotEmpty())
+    {
+        juce::File file(filePath);
+        if (file.existsAsFile())
+        {
+            audioFileLoader.loadFile(file);
+            currentFilePath = filePath;
+        }
+    }
+
+    markSessionChanged();
+}
+
 void PinkGrainAudioProcessor::setCurrentFilePath(const juce::String& path)
 {
     currentFilePath = path;
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::setSampleStorage(AudioFileLoader::StorageMode mode)
+{
+    if (mode == audioFileLoader.getStorageMode())
+        return;
+
+    audioFileLoader.setStorageMode(mode);
+
+    if (currentFilePath.isNotEmpty())
+        audioFileLoader.loadFile(juce::File(currentFilePath));
+
+    markSessionChanged();
 }
 
 juce::File PinkGrainAudioProcessor::getPresetsDirectory() const
 {
-    juce::File presetDir = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
-                              .getChildFile("PinkGrain")
-                              .getChildFile("Presets");
-    presetDir.createDirectory();
-    return presetDir;
+    return presetIndex->getDirectory();
 }
 
 juce::StringArray PinkGrainAudioProcessor::getPresetList() const
 {
-    juce::StringArray presets;
-    juce::File presetDir = getPresetsDirectory();
-
-    for (const auto& file : presetDir.findChildFiles(juce::File::findFiles, false, "*.xml"))
-    {
-        presets.add(file.getFileNameWithoutExtension());
-    }
-
-    presets.sort(true);
-    return presets;
+    // Sorted by name, from the index rather than the folder
+    return presetIndex->getNames();
 }
 
 void PinkGrainAudioProcessor::savePreset(const juce::String& presetName)
 {
     juce::File presetFile = getPresetsDirectory().getChildFile(presetName + ".xml");
+    presetFile.getParentDirectory().createDirectory();
 
+    // Presets stay XML, so they can be read and shared outside the plugin
     juce::MemoryBlock data;
-    getStateInformation(data);
+    writeXmlState(data);
 
     presetFile.replaceWithData(data.getData(), data.getSize());
+    presetIndex->refresh();
 }
 
 void PinkGrainAudioProcessor::loadPreset(const juce::String& presetName)
 {
-    juce::File presetFile = getPresetsDirectory().getChildFile(presetName + ".xml");
+    // Taken from the index unless the file has changed since it was indexed
+    PresetIndex::Preset preset;
+    if (!presetIndex->findPreset(presetName, preset) || !preset.isCurrent())
+    {
+        preset = {};
+        if (!PresetIndex::parsePreset(getPresetsDirectory().getChildFile(presetName + ".xml"), preset))
+            return;
+    }
+
+    sessionRestorePending = false;
+    pendingPreset = std::move(preset);
+    presetStage = PresetStage::preparing;
 
-    if (presetFile.existsAsFile())
+    // Decoded on a loader of its own, so the current sample plays on undisturbed
+    if (presetNeedsSample(pendingPreset))
     {
-        juce::MemoryBlock data;
-        if (presetFile.loadFileAsData(data))
+        presetLoader.setStorageMode(static_cast<AudioFileLoader::StorageMode>(
+            juce::jlimit(0, static_cast<int>(AudioFileLoader::StorageMode::float16), pendingPreset.sampleStorage)));
+        presetLoader.loadFile(juce::File(pendingPreset.samplePath));
+    }
+
+    if (presetPrefetch)
+        prefetchNeighbours(presetName);
+
+    advancePresetSwitch();
+
+    if (presetStage != PresetStage::idle)
+        startTimer(presetPollIntervalMs);
+}
+
+bool PinkGrainAudioProcessor::presetNeedsSample(const PresetIndex::Preset& preset) const
+{
+    if (preset.samplePath.isEmpty() || !juce::File(preset.samplePath).existsAsFile())
+        return false;
+
+    return preset.samplePath != currentFilePath || !audioFileLoader.hasFile()
+        || preset.sampleStorage != static_cast<int>(audioFileLoader.getStorageMode());
+}
+
+void PinkGrainAudioProcessor::advancePresetSwitch()
+{
+    if (presetStage == PresetStage::preparing)
+    {
+        if (presetLoader.isLoading())
+            return;
+
+        // The engine keeps its sample and parameters from here until the switch is handed over.
+        // Shareable samples are in the registry by now, so the main loader does not decode again.
+        presetSwitchState = switchHeld;
+
+        if (presetNeedsSample(pendingPreset))
+            restoreFile(pendingPreset.samplePath, {}, pendingPreset.sampleStorage);
+
+        presetStage = PresetStage::loading;
+    }
+
+    if (presetStage == PresetStage::loading)
+    {
+        if (audioFileLoader.isLoading())
+            return;
+
+        applyPreset(pendingPreset);
+        presetSwitchState = switchReady;
+
+        presetStage = PresetStage::idle;
+        stopTimer();
+        presetLoader.clear();
+    }
+}
+
+void PinkGrainAudioProcessor::cancelPresetSwitch()
+{
+    if (presetStage != PresetStage::idle)
+    {
+        presetStage = PresetStage::idle;
+        stopTimer();
+        presetLoader.clear();
+    }
+
+    // State applied from elsewhere goes to the engine straight away
+    presetSwitchState = switchIdle;
+}
+
+void PinkGrainAudioProcessor::timerCallback()
+{
+    advancePresetSwitch();
+}
+
+void PinkGrainAudioProcessor::prefetchNeighbours(const juce::String& presetName)
+{
+    const auto names = presetIndex->getNames();
+    const int index = names.indexOf(presetName);
+    if (index < 0)
+        return;
+
+    const int neighbours[] = { index - 1, index + 1 };
+
+    for (size_t i = 0; i < neighbourLoaders.size(); ++i)
+    {
+        // Out of range names are empty and never found
+        PresetIndex::Preset neighbour;
+        if (!presetIndex->findPreset(names[neighbours[i]], neighbour) || !presetNeedsSample(neighbour))
+            continue;
+
+        const auto sample = neighbour.samplePath + "-" + juce::String(neighbour.sampleStorage);
+        if (sample == neighbourSamples[i])
+            continue;
+
+        auto& loader = neighbourLoaders[i];
+        if (loader == nullptr)
+            loader = std::make_unique<AudioFileLoader>();
+
+        // Holding the source keeps it in the registry for when the preset is loaded
+        loader->setStorageMode(static_cast<AudioFileLoader::StorageMode>(
+            juce::jlimit(0, static_cast<int>(AudioFileLoader::StorageMode::float16), neighbour.sampleStorage)));
+        loader->loadFile(juce::File(neighbour.samplePath));
+        neighbourSamples[i] = sample;
+    }
+}
+
+void PinkGrainAudioProcessor::setPresetCrossfade(float seconds)
+{
+    presetCrossfadeSeconds = juce::jlimit(minPresetCrossfadeSeconds, maxPresetCrossfadeSeconds, seconds);
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::setPresetPrefetch(bool shouldPrefetch)
+{
+    presetPrefetch = shouldPrefetch;
+
+    if (!presetPrefetch)
+    {
+        for (auto& loader : neighbourLoaders)
+            loader.reset();
+
+        for (auto& sample : neighbourSamples)
+            sample = {};
+    }
+
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::setRenderAhead(int blocks)
+{
+    blocks = juce::jlimit(0, maxRenderAheadBlocks, blocks);
+
+    if (renderAheadBlocks.exchange(blocks) != blocks)
+    {
+        // Not every host prepares the plugin again when its latency changes, and this may be
+        // called from any thread, so the worker is switched over on the message thread
+        setLatencySamples(blocks * getBlockSize());
+        updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withLatencyChanged(true));
+
+        renderAheadChanged = true;
+        markSessionChanged();
+    }
+}
+
+void PinkGrainAudioProcessor::setLiveInputEnabled(bool shouldGranulateInput)
+{
+    liveInputEnabled = shouldGranulateInput;
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::addZone(const SampleZone& zone)
+{
+    if (static_cast<int>(zones.size()) >= ZoneMap::maxZones)
+        return;
+
+    std::unique_ptr<AudioFileLoader> loader;
+    if (!spareZoneLoaders.empty())
+    {
+        loader = std::move(spareZoneLoaders.back());
+        spareZoneLoaders.pop_back();
+    }
+    else
+    {
+        loader = std::make_unique<AudioFileLoader>();
+        loader->addListener(this);
+    }
+
+    loader->setStorageMode(audioFileLoader.getStorageMode());
+
+    const bool reversed = std::any_of(layerParameterValues.begin(), layerParameterValues.end(),
+                                      [](const LayerParameterValues& values) { return values.reverse->load() > 0.5f; });
+    if (reversed)
+        loader->prepareReversedBuffer();
+
+    // A missing file leaves the zone silent rather than falling back to the main sample
+    loader->loadFile(juce::File(zone.filePath));
+
+    zones.push_back(zone);
+    zoneLoaders.push_back(std::move(loader));
+
+    publishZones();
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::removeZone(int index)
+{
+    if (!juce::isPositiveAndBelow(index, static_cast<int>(zones.size())))
+        return;
+
+    auto& loader = zoneLoaders[static_cast<size_t>(index)];
+    loader->clear();
+    spareZoneLoaders.push_back(std::move(loader));
+
+    zones.erase(zones.begin() + index);
+    zoneLoaders.erase(zoneLoaders.begin() + index);
+
+    publishZones();
+    markSessionChanged();
+}
+
+void PinkGrainAudioProcessor::clearZones()
+{
+    while (!zones.empty())
+        removeZone(static_cast<int>(zones.size()) - 1);
+}
+
+void PinkGrainAudioProcessor::restoreZones(const std::vector<SampleZone>& restoredZones)
+{
+    // Re-applying a state with the zones already loaded keeps their samples
+    if (restoredZones == zones)
+        return;
+
+    clearZones();
+
+    for (const auto& zone : restoredZones)
+        addZone(zone);
+}
+
+void PinkGrainAudioProcessor::fileLoaded(const juce::String& /*fileName*/)
+{
+    // A zone's sample was published, perhaps only partly decoded so far
+    publishZones();
+}
+
+void PinkGrainAudioProcessor::publishZones()
+{
+    ZoneMap::Ptr newMap;
+
+    if (!zones.empty())
+    {
+        std::vector<ZoneMap::Zone> mapZones;
+
+        for (size_t i = 0; i < zones.size(); ++i)
         {
-            setStateInformation(data.getData(), static_cast<int>(data.getSize()));
+            const auto& zone = zones[i];
+            mapZones.push_back({ zoneLoaders[i]->getSource(), zone.lowKey, zone.highKey,
+                                 zone.lowVelocity, zone.highVelocity, zone.rootNote });
         }
+
+        newMap = new ZoneMap(std::move(mapZones));
+    }
+
+    {
+        const juce::SpinLock::ScopedLockType lock(zoneMapLock);
+        std::swap(zoneMap, newMap);
+    }
+
+    // The audio thread never drops the last reference to a map
+    if (newMap != nullptr)
+        retiredZoneMaps.add(newMap);
+
+    for (int i = retiredZoneMaps.size(); --i >= 0;)
+    {
+        if (retiredZoneMaps.getUnchecked(i)->getReferenceCount() == 1)
+            retiredZoneMaps.remove(i);
     }
 }
 
-juce::File PinkGrainAudioProcessor::getSessionFile() const
+ZoneMap::Ptr PinkGrainAudioProcessor::getZoneMap() const
 {
-    juce::File appDataDir = juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
-                               .getChildFile("PinkGrain");
-    appDataDir.createDirectory();
-    return appDataDir.getChildFile("lastSession.xml");
+    const juce::SpinLock::ScopedLockType lock(zoneMapLock);
+    return zoneMap;
 }
 
-void PinkGrainAudioProcessor::saveSession()
+SampleSource::Ptr PinkGrainAudioProcessor::getEngineSource() const
 {
-    juce::File sessionFile = getSessionFile();
+    if (liveInputEnabled.load() && liveInput != nullptr)
+        return liveInput;
+
+    return audioFileLoader.getSource();
+}
+
+void PinkGrainAudioProcessor::applyPreset(const PresetIndex::Preset& preset)
+{
+    // Like replacing the state, parameters the preset does not have go back to their defaults
+    for (auto* parameter : stateParameters)
+    {
+        const auto stored = std::find_if(preset.parameters.begin(), preset.parameters.end(),
+                                         [parameter](const auto& entry) { return entry.first == parameter->getParameterID(); });
+
+        restoreParameter(*parameter, stored != preset.parameters.end() ? parameter->convertTo0to1(stored->second)
+                                                                       : parameter->getDefaultValue());
+    }
+
+    updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withProgramChanged(true));
+}
 
+void PinkGrainAudioProcessor::saveSession()
+{
+    // Written on the writer's thread; instances going away hand over their state and move on
     juce::MemoryBlock data;
     getStateInformation(data);
+    sessionWriter->submit(getSessionSlot(), std::move(data), true);
+}
 
-    sessionFile.replaceWithData(data.getData(), data.getSize());
+int PinkGrainAudioProcessor::getSessionSlot()
+{
+    // Plugin scans never get this far, so they lock no slot
+    if (sessionSlot < 0)
+        sessionSlot = sessionWriter->claimSlot();
+
+    return sessionSlot;
 }
 
 void PinkGrainAudioProcessor::restoreSession()
 {
-    juce::File sessionFile = getSessionFile();
+    sessionRestorePending = false;
+
+    juce::File sessionFile = sessionWriter->getSlotFile(getSessionSlot());
+
+    // Sessions saved before slots, then before the binary state format, were shared by every instance
+    if (!sessionFile.existsAsFile())
+        sessionFile = sessionFile.getParentDirectory().getSiblingFile("lastSession.dat");
+
+    if (!sessionFile.existsAsFile())
+        sessionFile = sessionFile.getSiblingFile("lastSession.xml");
 
     if (sessionFile.existsAsFile())
     {
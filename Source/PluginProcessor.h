@@ -3,11 +3,19 @@
 #include <JuceHeader.h>
 #include "GrainEngine.h"
 #include "AudioFileLoader.h"
+#include "PresetIndex.h"
+#include "SessionWriter.h"
+#include "RenderAhead.h"
+#include "LiveInputSource.h"
 
 class LiveWaveformDisplay;
 class VolumeControl;
 
-class PinkGrainAudioProcessor : public juce::AudioProcessor
+class PinkGrainAudioProcessor : public juce::AudioProcessor,
+                                private juce::AudioProcessorValueTreeState::Listener,
+                                private AudioFileLoader::Listener,
+                                private juce::AsyncUpdater,
+                                private juce::Timer
 {
 public:
     PinkGrainAudioProcessor();
@@ -48,15 +56,82 @@ public:
     void setCurrentFilePath(const juce::String& path);
     juce::String getCurrentFilePath() const { return currentFilePath; }
 
-    // Preset management
+    // Sample storage format, saved with the state; reloads the current file when it changes
+    void setSampleStorage(AudioFileLoader::StorageMode mode);
+    AudioFileLoader::StorageMode getSampleStorage() const { return audioFileLoader.getStorageMode(); }
+
+    // Preset management. Loading a preset decodes its sample in the background first, then
+    // hands sample and parameters to the engine together at the start of a block, where the
+    // cloud playing so far fades out over the crossfade time while the new one builds up.
     void savePreset(const juce::String& presetName);
     void loadPreset(const juce::String& presetName);
     juce::StringArray getPresetList() const;
     juce::File getPresetsDirectory() const;
+    PresetIndex& getPresetIndex() { return *presetIndex; }
+
+    // Saved with the state, not with presets
+    void setPresetCrossfade(float seconds);
+    float getPresetCrossfade() const { return presetCrossfadeSeconds.load(); }
+
+    // Also decodes the samples of the presets either side of the last one loaded, so
+    // stepping through the list never waits for a decode
+    void setPresetPrefetch(bool shouldPrefetch);
+    bool getPresetPrefetch() const { return presetPrefetch; }
+
+    // Renders on a worker thread this many blocks ahead of the host, reporting them as
+    // latency, so a block that takes too long to render no longer drops out. 0 renders on
+    // the audio thread. Saved with the state; the worker switches over on the message
+    // thread, whether or not the host prepares the plugin again for the new latency.
+    void setRenderAhead(int blocks);
+    int getRenderAhead() const { return renderAheadBlocks.load(); }
+
+    // Granulates the input bus instead of the loaded file, once the host has enabled the
+    // input. Saved with the state; the file stays loaded for switching back.
+    void setLiveInputEnabled(bool shouldGranulateInput);
+    bool isLiveInputEnabled() const { return liveInputEnabled.load(); }
+
+    // Multi-sampling. Each zone plays its own file over a range of keys and velocities,
+    // pitched from its root note, through the one grain engine and pool. Zone files load in
+    // parallel, each on a loader of its own, and are shared with other instances through
+    // the SampleRegistry. Keys no zone covers play the main sample. Saved with the state.
+    struct SampleZone
+    {
+        juce::String filePath;
+        int lowKey = 0;
+        int highKey = 127;
+        int lowVelocity = 1;
+        int highVelocity = 127;
+        int rootNote = GrainEngine::ROOT_NOTE;
+
+        bool operator==(const SampleZone& other) const
+        {
+            return filePath == other.filePath && lowKey == other.lowKey && highKey == other.highKey
+                && lowVelocity == other.lowVelocity && highVelocity == other.highVelocity && rootNote == other.rootNote;
+        }
+    };
+
+    void addZone(const SampleZone& zone);
+    void removeZone(int index);
+    void clearZones();
+    const std::vector<SampleZone>& getZones() const { return zones; }
 
-    // Session persistence
+    // Multi-timbral layers. MIDI channel 1 plays the parameters below; each other channel
+    // plays a layer with parameters of its own once its LAYER_ID parameter is on, and
+    // channel 1's until then. Layers render through the one grain pool, so MAX GRAINS is
+    // the budget of all of them, and only channel 1 freezes. A layer plays out of its own
+    // output bus ("Ch 2" to "Ch 16") when the host enables it, and out of the main one otherwise.
+    static constexpr int numLayers = GrainEngine::MAX_LAYERS;
+
+    // The ID of a parameter for the layer played on MIDI channel layer + 1
+    static juce::String getLayerParameterId(int layer, const juce::String& parameterId);
+
+    // Session persistence. Each instance keeps its session in a slot of its own, saved in the
+    // background whenever the state changes. The slot's last session is restored after
+    // construction, once the host prepares the plugin or opens its editor, unless the host
+    // applies its own state first.
     void saveSession();
     void restoreSession();
+    int getSessionSlot();
 
     // Live waveform display connection
     void setLiveWaveformDisplay(LiveWaveformDisplay* display) { liveWaveformDisplay = display; }
@@ -77,21 +152,165 @@ public:
     static const juce::String PITCH_RANDOM_ID;
     static const juce::String VOLUME_ID;
     static const juce::String MAX_GRAINS_ID;
+    static const juce::String FREEZE_ID;
+    static const juce::String FILTER_CUTOFF_ID;
+    static const juce::String FILTER_SPREAD_ID;
+    static const juce::String LAYER_ID;
 
 private:
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout();
     void updateGrainEngineParameters();
-    juce::File getSessionFile() const;
+    void parameterChanged(const juce::String& parameterID, float newValue) override;
+    void handleAsyncUpdate() override;
+    void fileLoaded(const juce::String& fileName) override;
+    void fileCleared() override {}
+    void timerCallback() override;
+    void scheduleSessionRestore();
+    void markSessionChanged();
+
+    // Host and session state is binary; presets and states saved by older versions are XML
+    bool readBinaryState(const void* data, int sizeInBytes);
+    static void restoreParameter(juce::RangedAudioParameter& parameter, float normalisedValue);
+    void writeXmlState(juce::MemoryBlock& destData);
+    void readXmlState(const void* data, int sizeInBytes);
+    void restoreFile(const juce::String& filePath, const juce::String& fileKey, int storage);
+    void applyPreset(const PresetIndex::Preset& preset);
+
+    bool presetNeedsSample(const PresetIndex::Preset& preset) const;
+    void advancePresetSwitch();
+    void cancelPresetSwitch();
+    void prefetchNeighbours(const juce::String& presetName);
+    SampleSource::Ptr getEngineSource() const;
+    void restoreZones(const std::vector<SampleZone>& restoredZones);
+    void publishZones();
+    ZoneMap::Ptr getZoneMap() const;
+    bool renderUnlessIdle(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages);
+    void renderBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages);
+    void handleMidiEvent(const juce::MidiMessage& msg);
+    void renderGrains(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void startPresetCrossfade();
+    void renderPresetCrossfade(juce::AudioBuffer<float>& buffer, int startSample, int numSamples);
+    void startRenderAhead(int latency, int samplesPerBlock);
+    void switchRenderAhead();
 
     GrainEngine grainEngine;
     AudioFileLoader audioFileLoader;
 
+    // The last liveCaptureSeconds of input, while the host has the input bus enabled
+    juce::ReferenceCountedObjectPtr<LiveInputSource> liveInput;
+    std::atomic<bool> liveInputEnabled { false };
+
+    // Zones on the message thread, each with its loader; loaders of removed zones are kept
+    // for the next zone, so they free their samples once the engine lets go
+    std::vector<SampleZone> zones;
+    std::vector<std::unique_ptr<AudioFileLoader>> zoneLoaders;
+    std::vector<std::unique_ptr<AudioFileLoader>> spareZoneLoaders;
+
+    // The map the audio thread picks up. Replaced maps are freed here once no engine holds them.
+    mutable juce::SpinLock zoneMapLock;
+    ZoneMap::Ptr zoneMap;
+    juce::ReferenceCountedArray<ZoneMap> retiredZoneMaps;
+
+    // Plays the previous preset's cloud while it fades out
+    GrainEngine outgoingEngine { false };
+    juce::AudioBuffer<float> outgoingBuffer;
+    int crossfadeLength = 0;     // Rendering thread only
+    int crossfadeRemaining = 0;
+
+    // Output samples until everything playing now has ended, for the host's tail query
+    std::atomic<int> tailSamples { 0 };
+    bool outputIdle = false;     // Rendering thread only
+
     juce::AudioProcessorValueTreeState apvts;
 
+    juce::SharedResourcePointer<PresetIndex> presetIndex;
+
+    juce::SharedResourcePointer<SessionWriter> sessionWriter;
+    int sessionSlot = -1;  // Claimed on the message thread when first needed, as claiming locks a file
+
     LiveWaveformDisplay* liveWaveformDisplay = nullptr;
     VolumeControl* volumeControl = nullptr;
 
     juce::String currentFilePath;
 
+    // Parameters in the order the binary state stores them
+    std::vector<juce::RangedAudioParameter*> stateParameters;
+
+    // Each layer's parameters, looked up once since their IDs are built from strings
+    struct LayerParameterValues
+    {
+        std::atomic<float>* enabled = nullptr;  // Null for the first layer, which is always on
+        std::atomic<float>* grainSize = nullptr;
+        std::atomic<float>* density = nullptr;
+        std::atomic<float>* position = nullptr;
+        std::atomic<float>* pitch = nullptr;
+        std::atomic<float>* panSpread = nullptr;
+        std::atomic<float>* attack = nullptr;
+        std::atomic<float>* decay = nullptr;
+        std::atomic<float>* sustain = nullptr;
+        std::atomic<float>* release = nullptr;
+        std::atomic<float>* reverse = nullptr;
+        std::atomic<float>* spray = nullptr;
+        std::atomic<float>* pitchRandom = nullptr;
+        std::atomic<float>* volume = nullptr;
+        std::atomic<float>* filterCutoff = nullptr;
+        std::atomic<float>* filterSpread = nullptr;
+    };
+
+    std::array<LayerParameterValues, numLayers> layerParameterValues;
+    std::array<bool, numLayers> layerEnabled {};  // Rendering thread only
+
+    // The layer each channel's held notes started on, -1 where none is held. Rendering thread only
+    std::array<std::array<juce::int8, 128>, 16> noteLayers {};
+
+    // Work handed to the message thread
+    std::atomic<bool> sessionRestorePending { true };  // Until restored or replaced by the host's state
+    std::atomic<bool> sessionRestoreScheduled { false };
+    std::atomic<bool> sessionChanged { false };
+    std::atomic<bool> reversedBufferWanted { false };
+    std::atomic<bool> renderAheadChanged { false };
+
+    // A preset switch, from the message thread's side: its sample decodes on presetLoader,
+    // then the main loader picks it up from the registry before the parameters are set
+    enum class PresetStage
+    {
+        idle,
+        preparing,
+        loading
+    };
+
+    PresetStage presetStage = PresetStage::idle;
+    PresetIndex::Preset pendingPreset;
+    AudioFileLoader presetLoader;
+    std::array<std::unique_ptr<AudioFileLoader>, 2> neighbourLoaders;  // Created once prefetching is on
+    std::array<juce::String, 2> neighbourSamples;
+    bool presetPrefetch = false;
+    std::atomic<float> presetCrossfadeSeconds { 0.25f };
+
+    // And from the audio thread's: while held, the engine keeps its sample and parameters;
+    // once ready, the next block hands over, even if the previous crossfade is still running
+    enum PresetSwitchState
+    {
+        switchIdle,
+        switchHeld,
+        switchReady
+    };
+
+    std::atomic<int> presetSwitchState { switchIdle };
+
+    static constexpr int binaryStateMagic = 0x54534750;  // "PGST"
+    static constexpr int binaryStateVersion = 5;
+    static constexpr int presetPollIntervalMs = 10;
+    static constexpr float minPresetCrossfadeSeconds = 0.01f;
+    static constexpr float maxPresetCrossfadeSeconds = 4.0f;
+    static constexpr int maxRenderAheadBlocks = 8;
+    static constexpr double liveCaptureSeconds = 32.0;  // Longer than the longest grain
+
+    // Renders the engines in place of the audio thread while render ahead is on. Last, so
+    // it stops before anything it renders with goes away.
+    std::atomic<int> renderAheadBlocks { 0 };
+    std::atomic<bool> prepared { false };  // Between prepareToPlay() and releaseResources()
+    std::unique_ptr<RenderAhead> renderAhead;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PinkGrainAudioProcessor)
 };
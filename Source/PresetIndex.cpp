@@ -0,0 +1,402 @@
+#include "PresetIndex.h"
+
+namespace
+{
+    // Index file layout, in native byte order: a header, a record per preset sorted by
+    // name ignoring case, their parameters, then the strings, each a length and UTF-8 bytes
+    struct Header
+    {
+        juce::int32 magic;
+        juce::int32 version;
+        juce::int32 numEntries;
+        juce::int32 numParameters;
+    };
+
+    struct Record
+    {
+        juce::int64 modificationTime;
+        juce::int64 fileSize;
+        juce::uint32 name;            // String offsets from the start of the file
+        juce::uint32 fileName;
+        juce::uint32 samplePath;
+        juce::int32 sampleStorage;
+        juce::uint32 firstParameter;
+        juce::uint32 numParameters;
+    };
+
+    struct ParameterRecord
+    {
+        juce::uint32 id;
+        float value;
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Record) == 40 && sizeof(ParameterRecord) == 8,
+                  "The index file layout must not depend on the compiler");
+
+    template <typename Type>
+    Type readAt(const char* data, size_t offset)
+    {
+        Type value;
+        std::memcpy(&value, data + offset, sizeof(Type));
+        return value;
+    }
+
+    bool comesBefore(const juce::String& a, const juce::String& b)
+    {
+        const int order = a.compareIgnoreCase(b);
+        return order != 0 ? order < 0 : a.compare(b) < 0;
+    }
+}
+
+bool PresetIndex::Preset::isCurrent() const
+{
+    return file.getLastModificationTime().toMilliseconds() == modificationTime && file.getSize() == fileSize;
+}
+
+bool PresetIndex::Snapshot::attach(const char* newData, size_t newSize)
+{
+    if (newData == nullptr || newSize < sizeof(Header))
+        return false;
+
+    const auto header = readAt<Header>(newData, 0);
+
+    if (header.magic != indexMagic || header.version != indexVersion || header.numEntries < 0 || header.numParameters < 0
+        || sizeof(Header) + static_cast<size_t>(header.numEntries) * sizeof(Record)
+               + static_cast<size_t>(header.numParameters) * sizeof(ParameterRecord) > newSize)
+        return false;
+
+    data = newData;
+    size = newSize;
+    numEntries = header.numEntries;
+    return true;
+}
+
+juce::String PresetIndex::Snapshot::getString(size_t offset) const
+{
+    if (offset + sizeof(juce::uint32) > size)
+        return {};
+
+    const auto length = static_cast<size_t>(readAt<juce::uint32>(data, offset));
+
+    if (offset + sizeof(juce::uint32) + length > size)
+        return {};
+
+    return juce::String::fromUTF8(data + offset + sizeof(juce::uint32), static_cast<int>(length));
+}
+
+juce::String PresetIndex::Snapshot::getName(int index) const
+{
+    return getString(readAt<Record>(data, sizeof(Header) + static_cast<size_t>(index) * sizeof(Record)).name);
+}
+
+juce::String PresetIndex::Snapshot::getFileName(int index) const
+{
+    return getString(readAt<Record>(data, sizeof(Header) + static_cast<size_t>(index) * sizeof(Record)).fileName);
+}
+
+PresetIndex::Preset PresetIndex::Snapshot::getPreset(int index, const juce::File& presetDirectory) const
+{
+    const auto record = readAt<Record>(data, sizeof(Header) + static_cast<size_t>(index) * sizeof(Record));
+    const auto header = readAt<Header>(data, 0);
+
+    Preset preset;
+    preset.name = getString(record.name);
+    preset.file = presetDirectory.getChildFile(getString(record.fileName));
+    preset.samplePath = getString(record.samplePath);
+    preset.sampleStorage = record.sampleStorage;
+    preset.modificationTime = record.modificationTime;
+    preset.fileSize = record.fileSize;
+
+    const size_t parametersStart = sizeof(Header) + static_cast<size_t>(numEntries) * sizeof(Record);
+    const auto numParameters = static_cast<juce::uint32>(header.numParameters);
+
+    for (juce::uint32 i = record.firstParameter; i < record.firstParameter + record.numParameters && i < numParameters; ++i)
+    {
+        const auto parameter = readAt<ParameterRecord>(data, parametersStart + i * sizeof(ParameterRecord));
+        preset.parameters.emplace_back(getString(parameter.id), parameter.value);
+    }
+
+    return preset;
+}
+
+int PresetIndex::Snapshot::lowerBound(const juce::String& name) const
+{
+    int first = 0;
+    int count = numEntries;
+
+    while (count > 0)
+    {
+        const int step = count / 2;
+
+        if (getName(first + step).compareIgnoreCase(name) < 0)
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+        {
+            count = step;
+        }
+    }
+
+    return first;
+}
+
+PresetIndex::PresetIndex()
+    : juce::Thread("PinkGrain Preset Index"),
+      directory(juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                    .getChildFile("PinkGrain")
+                    .getChildFile("Presets")),
+      indexFile(directory.getSiblingFile("PresetIndex.dat")),
+      snapshot(std::make_shared<Snapshot>())
+{
+}
+
+PresetIndex::~PresetIndex()
+{
+    stopThread(4000);
+}
+
+void PresetIndex::ensureStarted()
+{
+    if (!started.exchange(true))
+        startThread(juce::Thread::Priority::background);
+}
+
+std::shared_ptr<const PresetIndex::Snapshot> PresetIndex::getSnapshot() const
+{
+    const juce::SpinLock::ScopedLockType lock(snapshotLock);
+    return snapshot;
+}
+
+juce::StringArray PresetIndex::getNames(const juce::String& prefix)
+{
+    ensureStarted();
+
+    const auto current = getSnapshot();
+    juce::StringArray names;
+
+    for (int i = prefix.isEmpty() ? 0 : current->lowerBound(prefix); i < current->numEntries; ++i)
+    {
+        auto name = current->getName(i);
+        if (!name.startsWithIgnoreCase(prefix))
+            break;
+
+        names.add(std::move(name));
+    }
+
+    return names;
+}
+
+bool PresetIndex::findPreset(const juce::String& name, Preset& result)
+{
+    ensureStarted();
+
+    const auto current = getSnapshot();
+    int match = -1;
+
+    // Names differing only in case sort together; an exact match wins
+    for (int i = current->lowerBound(name); i < current->numEntries; ++i)
+    {
+        const auto candidate = current->getName(i);
+        if (!candidate.equalsIgnoreCase(name))
+            break;
+
+        if (match < 0 || candidate == name)
+            match = i;
+    }
+
+    if (match < 0)
+        return false;
+
+    result = current->getPreset(match, directory);
+    return true;
+}
+
+void PresetIndex::refresh()
+{
+    scanRequested = true;
+    ensureStarted();
+    notify();
+}
+
+void PresetIndex::run()
+{
+    // The index left by the last run lists presets straight away, while the folder is rescanned
+    auto mapping = std::make_unique<juce::MemoryMappedFile>(indexFile, juce::MemoryMappedFile::readOnly);
+    auto loaded = std::make_shared<Snapshot>();
+
+    if (loaded->attach(static_cast<const char*>(mapping->getData()), mapping->getSize()))
+    {
+        loaded->mapping = std::move(mapping);
+        {
+            const juce::SpinLock::ScopedLockType lock(snapshotLock);
+            snapshot = std::move(loaded);
+        }
+
+        sendChangeMessage();
+    }
+
+    // Polled rather than watched, as no folder notification works on every platform and
+    // network share. Adding, removing or renaming presets changes the folder's time.
+    juce::Time lastFolderChange;
+    juce::uint32 lastScan = juce::Time::getMillisecondCounter();
+    bool scanned = false;
+
+    while (!threadShouldExit())
+    {
+        const auto folderChange = directory.getLastModificationTime();
+        const auto now = juce::Time::getMillisecondCounter();
+
+        if (!scanned || scanRequested.exchange(false) || folderChange != lastFolderChange || now - lastScan >= fullScanIntervalMs)
+        {
+            lastFolderChange = folderChange;
+            lastScan = now;
+            scanned = true;
+            scan();
+        }
+
+        wait(pollIntervalMs);
+    }
+}
+
+void PresetIndex::scan()
+{
+    const auto current = getSnapshot();
+
+    // Presets already indexed are carried over unless their file has changed
+    std::map<juce::String, int> indexed;
+    for (int i = 0; i < current->numEntries; ++i)
+        indexed[current->getFileName(i)] = i;
+
+    std::vector<Preset> presets;
+    bool changed = false;
+
+    for (const auto& entry : juce::RangedDirectoryIterator(directory, false, "*.xml", juce::File::findFiles))
+    {
+        if (threadShouldExit())
+            return;
+
+        const auto& file = entry.getFile();
+        const juce::int64 modificationTime = entry.getModificationTime().toMilliseconds();
+        const juce::int64 fileSize = entry.getFileSize();
+
+        if (const auto known = indexed.find(file.getFileName()); known != indexed.end())
+        {
+            auto preset = current->getPreset(known->second, directory);
+
+            if (preset.modificationTime == modificationTime && preset.fileSize == fileSize)
+            {
+                presets.push_back(std::move(preset));
+                continue;
+            }
+        }
+
+        // Files that cannot be read yet, such as ones still syncing, are tried again once they change
+        Preset preset;
+        preset.name = file.getFileNameWithoutExtension();
+        preset.file = file;
+        preset.modificationTime = modificationTime;
+        preset.fileSize = fileSize;
+
+        if (parsePreset(file, preset))
+        {
+            presets.push_back(std::move(preset));
+            changed = true;
+        }
+    }
+
+    if (!changed && static_cast<int>(presets.size()) == current->numEntries)
+        return;
+
+    auto next = std::make_shared<Snapshot>();
+    next->block = buildIndex(presets);
+    next->attach(static_cast<const char*>(next->block.getData()), next->block.getSize());
+
+    {
+        const juce::SpinLock::ScopedLockType lock(snapshotLock);
+        snapshot = next;
+    }
+
+    sendChangeMessage();
+
+    // Another process may still have the old index mapped, in which case the next change writes it
+    if (indexFile.getParentDirectory().createDirectory().wasOk())
+        indexFile.replaceWithData(next->block.getData(), next->block.getSize());
+}
+
+bool PresetIndex::parsePreset(const juce::File& file, Preset& preset)
+{
+    juce::MemoryBlock data;
+    if (!file.loadFileAsData(data))
+        return false;
+
+    auto xml = juce::AudioProcessor::getXmlFromBinary(data.getData(), static_cast<int>(data.getSize()));
+    if (xml == nullptr)
+        return false;
+
+    // The processor's XML state: parameters as PARAM children, the sample as attributes
+    preset.samplePath = xml->getStringAttribute("audioFilePath");
+    preset.sampleStorage = xml->getIntAttribute("sampleStorage");
+
+    for (const auto* parameter : xml->getChildWithTagNameIterator("PARAM"))
+        preset.parameters.emplace_back(parameter->getStringAttribute("id"),
+                                       static_cast<float>(parameter->getDoubleAttribute("value")));
+
+    return true;
+}
+
+juce::MemoryBlock PresetIndex::buildIndex(std::vector<Preset>& presets)
+{
+    std::sort(presets.begin(), presets.end(), [](const Preset& a, const Preset& b) { return comesBefore(a.name, b.name); });
+
+    size_t numParameters = 0;
+    for (const auto& preset : presets)
+        numParameters += preset.parameters.size();
+
+    const size_t stringsStart = sizeof(Header) + presets.size() * sizeof(Record) + numParameters * sizeof(ParameterRecord);
+    juce::MemoryBlock block(stringsStart, true);
+    juce::MemoryOutputStream strings;
+
+    const auto addString = [&](const juce::String& text)
+    {
+        const auto offset = static_cast<juce::uint32>(stringsStart + strings.getDataSize());
+        const auto length = static_cast<juce::uint32>(text.getNumBytesAsUTF8());
+
+        strings.write(&length, sizeof(length));
+        strings.write(text.toRawUTF8(), length);
+        return offset;
+    };
+
+    const Header header { indexMagic, indexVersion, static_cast<juce::int32>(presets.size()), static_cast<juce::int32>(numParameters) };
+    block.copyFrom(&header, 0, sizeof(header));
+
+    size_t parameterIndex = 0;
+
+    for (size_t i = 0; i < presets.size(); ++i)
+    {
+        const auto& preset = presets[i];
+
+        Record record {};
+        record.modificationTime = preset.modificationTime;
+        record.fileSize = preset.fileSize;
+        record.name = addString(preset.name);
+        record.fileName = addString(preset.file.getFileName());
+        record.samplePath = addString(preset.samplePath);
+        record.sampleStorage = preset.sampleStorage;
+        record.firstParameter = static_cast<juce::uint32>(parameterIndex);
+        record.numParameters = static_cast<juce::uint32>(preset.parameters.size());
+        block.copyFrom(&record, static_cast<int>(sizeof(Header) + i * sizeof(Record)), sizeof(record));
+
+        for (const auto& [id, value] : preset.parameters)
+        {
+            const ParameterRecord parameter { addString(id), value };
+            block.copyFrom(&parameter, static_cast<int>(sizeof(Header) + presets.size() * sizeof(Record) + parameterIndex * sizeof(ParameterRecord)),
+                           sizeof(parameter));
+            ++parameterIndex;
+        }
+    }
+
+    block.append(strings.getData(), strings.getDataSize());
+    return block;
+}
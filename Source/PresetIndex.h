@@ -0,0 +1,84 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Every preset in the presets folder, with its parameters and sample, held in one index
+// file that is memory-mapped on startup and queried by binary search, so listing and
+// loading presets never touch the folder itself. A background thread watches the folder
+// and reparses only presets that were added or changed, then swaps in a new index and
+// broadcasts a change. Shared by every instance through a SharedResourcePointer.
+class PresetIndex : public juce::ChangeBroadcaster,
+                    private juce::Thread
+{
+public:
+    PresetIndex();
+    ~PresetIndex() override;
+
+    struct Preset
+    {
+        juce::String name;
+        juce::File file;
+        juce::String samplePath;
+        int sampleStorage = 0;
+        std::vector<std::pair<juce::String, float>> parameters;  // Parameter ID and plain value
+        juce::int64 modificationTime = 0;                         // Of the file when it was indexed
+        juce::int64 fileSize = 0;
+
+        // False once the file has changed since it was indexed
+        bool isCurrent() const;
+    };
+
+    const juce::File& getDirectory() const { return directory; }
+
+    // Preset names in order, optionally only those starting with the prefix (ignoring case).
+    // The first call starts the watcher, so instances that never list presets cost nothing.
+    juce::StringArray getNames(const juce::String& prefix = {});
+
+    bool findPreset(const juce::String& name, Preset& result);
+
+    // Rescans straight away, e.g. after saving a preset
+    void refresh();
+
+    // Reads a preset file the processor saved, for presets changed since they were indexed
+    static bool parsePreset(const juce::File& file, Preset& preset);
+
+private:
+    // The index file's contents, mapped from disk or built in memory
+    struct Snapshot
+    {
+        std::unique_ptr<juce::MemoryMappedFile> mapping;
+        juce::MemoryBlock block;
+        const char* data = nullptr;
+        size_t size = 0;
+        int numEntries = 0;
+
+        bool attach(const char* newData, size_t newSize);
+        juce::String getString(size_t recordOffset) const;
+        juce::String getName(int index) const;
+        juce::String getFileName(int index) const;
+        Preset getPreset(int index, const juce::File& directory) const;
+        int lowerBound(const juce::String& name) const;
+    };
+
+    void run() override;
+    void ensureStarted();
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+    void scan();
+    static juce::MemoryBlock buildIndex(std::vector<Preset>& presets);
+
+    const juce::File directory;
+    const juce::File indexFile;
+
+    mutable juce::SpinLock snapshotLock;
+    std::shared_ptr<const Snapshot> snapshot;
+
+    std::atomic<bool> started { false };
+    std::atomic<bool> scanRequested { false };
+
+    static constexpr int indexMagic = 0x49504750;  // "PGPI"
+    static constexpr int indexVersion = 1;
+    static constexpr int pollIntervalMs = 1000;
+    static constexpr juce::uint32 fullScanIntervalMs = 30000;  // Catches edits that leave the folder's time alone
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PresetIndex)
+};
@@ -0,0 +1,135 @@
+#include "RenderAhead.h"
+
+RenderAhead::RenderAhead(int latencySamples, int maximumBlockSizeToUse, int numChannels, RenderFunction renderFunction)
+    : juce::Thread("PinkGrain Render Ahead"),
+      render(std::move(renderFunction)),
+      maximumBlockSize(juce::jmax(1, maximumBlockSizeToUse)),
+      outputFifo(latencySamples + 2 * maximumBlockSize + 1)
+{
+    outputRing.setSize(juce::jmax(2, numChannels), outputFifo.getTotalSize());
+    outputRing.clear();
+
+    chunk.setSize(outputRing.getNumChannels(), maximumBlockSize);
+    chunkMidi.ensureSize(maxQueuedEvents * 8);
+
+    // The first latencySamples of output are silence, which the worker renders behind
+    outputFifo.finishedWrite(latencySamples);
+
+    startThread(juce::Thread::Priority::highest);
+}
+
+RenderAhead::~RenderAhead()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(1000);
+}
+
+void RenderAhead::process(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages)
+{
+    const int numSamples = buffer.getNumSamples();
+
+    for (const auto metadata : midiMessages)
+    {
+        // Only channel messages drive the engine; anything longer is dropped, as is MIDI
+        // arriving faster than the worker takes it
+        if (metadata.numBytes > 3 || eventFifo.getFreeSpace() == 0)
+            continue;
+
+        const auto scope = eventFifo.write(1);
+        auto& event = events[static_cast<size_t>(scope.startIndex1)];
+        event.time = playedTime + metadata.samplePosition;
+        event.numBytes = metadata.numBytes;
+        std::copy(metadata.data, metadata.data + metadata.numBytes, event.data);
+    }
+
+    knownTime.store(playedTime + numSamples, std::memory_order_release);
+    notify();
+
+    const int numReady = juce::jmin(numSamples, outputFifo.getNumReady());
+    const auto scope = outputFifo.read(numReady);
+    const int numChannels = juce::jmin(buffer.getNumChannels(), outputRing.getNumChannels());
+
+    for (int ch = 0; ch < numChannels; ++ch)
+    {
+        if (scope.blockSize1 > 0)
+            buffer.copyFrom(ch, 0, outputRing, ch, scope.startIndex1, scope.blockSize1);
+        if (scope.blockSize2 > 0)
+            buffer.copyFrom(ch, scope.blockSize1, outputRing, ch, scope.startIndex2, scope.blockSize2);
+    }
+
+    // The buffer arrives cleared, so what the worker has not finished stays silent
+    if (numReady < numSamples)
+        samplesToDrop.fetch_add(numSamples - numReady);
+
+    playedTime += numSamples;
+}
+
+void RenderAhead::run()
+{
+    while (!threadShouldExit())
+    {
+        const auto endTime = knownTime.load(std::memory_order_acquire);
+
+        if (renderedTime >= endTime)
+        {
+            wait(100);
+            continue;
+        }
+
+        // Rendered no further than the audio thread has got, as later MIDI is not known yet
+        const int numSamples = static_cast<int>(juce::jmin<juce::int64>(endTime - renderedTime, maximumBlockSize));
+
+        chunk.setSize(outputRing.getNumChannels(), numSamples, false, false, true);
+        chunk.clear();
+        chunkMidi.clear();
+        takeEvents(renderedTime + numSamples);
+
+        render(chunk, chunkMidi);
+        writeOutput(numSamples);
+
+        renderedTime += numSamples;
+    }
+}
+
+void RenderAhead::takeEvents(juce::int64 endTime)
+{
+    for (;;)
+    {
+        if (!hasNextEvent)
+        {
+            if (eventFifo.getNumReady() == 0)
+                return;
+
+            const auto scope = eventFifo.read(1);
+            nextEvent = events[static_cast<size_t>(scope.startIndex1)];
+            hasNextEvent = true;
+        }
+
+        // Kept for the chunk it falls in
+        if (nextEvent.time >= endTime)
+            return;
+
+        const auto position = static_cast<int>(juce::jmax<juce::int64>(0, nextEvent.time - renderedTime));
+        chunkMidi.addEvent(nextEvent.data, nextEvent.numBytes, position);
+        hasNextEvent = false;
+    }
+}
+
+void RenderAhead::writeOutput(int numSamples)
+{
+    // Samples the audio thread already played as silence are dropped, so the output stays
+    // latencySamples behind the MIDI instead of slipping further with every overrun
+    const int start = juce::jmin(samplesToDrop.load(), numSamples);
+    samplesToDrop.fetch_sub(start);
+
+    const auto scope = outputFifo.write(numSamples - start);
+
+    for (int ch = 0; ch < outputRing.getNumChannels(); ++ch)
+    {
+        if (scope.blockSize1 > 0)
+            outputRing.copyFrom(ch, scope.startIndex1, chunk, ch, start, scope.blockSize1);
+        if (scope.blockSize2 > 0)
+            outputRing.copyFrom(ch, scope.startIndex2, chunk, ch, start + scope.blockSize1, scope.blockSize2);
+    }
+}
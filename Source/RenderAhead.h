@@ -0,0 +1,62 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Renders audio on a worker thread up to latencySamples ahead of the audio thread, which
+// only copies finished output out of a lock-free ring. A block that takes longer than the
+// host allows is absorbed by the samples rendered ahead instead of causing a dropout.
+// MIDI reaches the worker with its timestamp, so the output is the same as rendering on
+// the audio thread, just latencySamples later; the processor reports that latency.
+class RenderAhead : private juce::Thread
+{
+public:
+    // Renders the next span of output into a cleared buffer, applying MIDI at its sample
+    using RenderFunction = std::function<void(juce::AudioBuffer<float>&, const juce::MidiBuffer&)>;
+
+    RenderAhead(int latencySamples, int maximumBlockSize, int numChannels, RenderFunction render);
+    ~RenderAhead() override;
+
+    // Audio thread: queues the block's MIDI and fills the buffer with output rendered ahead.
+    // If the worker has fallen behind the rest is left silent, and the worker drops what it
+    // renders for those samples later, so the latency never changes.
+    void process(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midiMessages);
+
+private:
+    struct Event
+    {
+        juce::int64 time = 0;  // Sample on the audio thread's timeline
+        juce::uint8 data[3] {};
+        int numBytes = 0;
+    };
+
+    void run() override;
+    void takeEvents(juce::int64 endTime);
+    void writeOutput(int numSamples);
+
+    const RenderFunction render;
+    const int maximumBlockSize;
+
+    // Finished output, written by the worker and read by the audio thread
+    juce::AbstractFifo outputFifo;
+    juce::AudioBuffer<float> outputRing;
+
+    // MIDI in time order, written by the audio thread and read by the worker
+    static constexpr int maxQueuedEvents = 1024;
+    juce::AbstractFifo eventFifo { maxQueuedEvents };
+    std::array<Event, maxQueuedEvents> events;
+
+    std::atomic<juce::int64> knownTime { 0 };   // MIDI up to here has been queued
+    std::atomic<int> samplesToDrop { 0 };       // Output the audio thread went without
+
+    // Audio thread only
+    juce::int64 playedTime = 0;
+
+    // Worker only
+    juce::int64 renderedTime = 0;
+    Event nextEvent;
+    bool hasNextEvent = false;
+    juce::AudioBuffer<float> chunk;
+    juce::MidiBuffer chunkMidi;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderAhead)
+};
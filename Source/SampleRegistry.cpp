@@ -0,0 +1,135 @@
+#include "SampleRegistry.h"
+
+namespace
+{
+    // 64-bit FNV-1a, continued from the given hash
+    juce::uint64 hashBytes(const void* data, size_t numBytes, juce::uint64 hash = 0xcbf29ce484222325ull)
+    {
+        const auto* bytes = static_cast<const juce::uint8*>(data);
+
+        for (size_t i = 0; i < numBytes; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+
+        return hash;
+    }
+
+    // Hashes the start and end of the file, which any re-encode or edit will change,
+    // without reading all of a large file on every load
+    juce::uint64 hashContent(const juce::File& file, int numBytesFromEachEnd)
+    {
+        juce::FileInputStream stream(file);
+        if (!stream.openedOk())
+            return 0;
+
+        const auto length = stream.getTotalLength();
+        juce::HeapBlock<char> buffer(static_cast<size_t>(numBytesFromEachEnd));
+        juce::uint64 hash = hashBytes(&length, sizeof(length));
+
+        const int headBytes = stream.read(buffer.get(), numBytesFromEachEnd);
+        hash = hashBytes(buffer.get(), static_cast<size_t>(juce::jmax(0, headBytes)), hash);
+
+        if (length > numBytesFromEachEnd && stream.setPosition(juce::jmax(static_cast<juce::int64>(numBytesFromEachEnd), length - numBytesFromEachEnd)))
+        {
+            const int tailBytes = stream.read(buffer.get(), numBytesFromEachEnd);
+            hash = hashBytes(buffer.get(), static_cast<size_t>(juce::jmax(0, tailBytes)), hash);
+        }
+
+        return hash;
+    }
+}
+
+juce::String SampleRegistry::makeFileKey(const juce::File& file)
+{
+    const auto path = file.getLinkedTarget().getFullPathName().toUTF8();
+    const juce::int64 size = file.getSize();
+    const juce::int64 modified = file.getLastModificationTime().toMilliseconds();
+    const juce::uint64 content = hashContent(file, hashedBytes);
+
+    juce::uint64 key = hashBytes(path.getAddress(), path.sizeInBytes());
+    key = hashBytes(&size, sizeof(size), key);
+    key = hashBytes(&modified, sizeof(modified), key);
+    key = hashBytes(&content, sizeof(content), key);
+
+    return juce::String::toHexString(static_cast<juce::int64>(key)).paddedLeft('0', 16);
+}
+
+std::vector<SampleRegistry::Entry>::iterator SampleRegistry::findEntry(const juce::String& key)
+{
+    return std::find_if(entries.begin(), entries.end(), [&key](const Entry& entry) { return entry.key == key; });
+}
+
+SampleSource::Ptr SampleRegistry::findOrLoad(const juce::String& key, const std::function<SampleSource::Ptr()>& load,
+                                             const std::function<bool()>& shouldKeepWaiting)
+{
+    for (;;)
+    {
+        {
+            const juce::ScopedLock sl(lock);
+
+            const auto entry = findEntry(key);
+            if (entry == entries.end())
+            {
+                // Nobody has it, so this thread loads it
+                entries.push_back({ key, nullptr });
+                break;
+            }
+
+            if (entry->source != nullptr)
+                return entry->source;
+        }
+
+        if (!shouldKeepWaiting())
+            return nullptr;
+
+        loadFinished.wait(waitIntervalMs);
+    }
+
+    auto source = load();
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        // A failed or unshareable load leaves the key free for the next thread to try
+        const auto entry = findEntry(key);
+        jassert(entry != entries.end());
+
+        if (source != nullptr && source->isShareable())
+            entry->source = source;
+        else
+            entries.erase(entry);
+    }
+
+    loadFinished.signal();
+    return source;
+}
+
+bool SampleRegistry::contains(const SampleSource* source) const
+{
+    const juce::ScopedLock sl(lock);
+
+    return std::any_of(entries.begin(), entries.end(), [source](const Entry& entry) { return entry.source.get() == source; });
+}
+
+void SampleRegistry::prune()
+{
+    std::vector<SampleSource::Ptr> unused;
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto entry = entries.begin(); entry != entries.end();)
+        {
+            if (entry->source != nullptr && entry->source->getReferenceCount() == 1)
+            {
+                unused.push_back(std::move(entry->source));
+                entry = entries.erase(entry);
+            }
+            else
+            {
+                ++entry;
+            }
+        }
+    }
+
+    // Freed here, outside the lock, so loading threads are not held up
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+// Every shareable source loaded in the process, so plugin instances loading the same file
+// share one decoded sample, along with its energy map and reversed copy. Entries are keyed
+// by the file's identity and how it was loaded. Hold one through a SharedResourcePointer.
+class SampleRegistry
+{
+public:
+    SampleRegistry() = default;
+
+    // Identifies a file by its canonical path, size, modification time and a hash of its content
+    static juce::String makeFileKey(const juce::File& file);
+
+    // The source registered under the key, or else the result of load(), registered if it is
+    // shareable. While another thread is loading the same key this waits for its result
+    // rather than loading again, for as long as shouldKeepWaiting() returns true.
+    SampleSource::Ptr findOrLoad(const juce::String& key, const std::function<SampleSource::Ptr()>& load,
+                                 const std::function<bool()>& shouldKeepWaiting);
+
+    bool contains(const SampleSource* source) const;
+
+    // Drops sources nothing but the registry references any more. Call on the message
+    // thread, so the last reference is never released on the audio thread.
+    void prune();
+
+private:
+    struct Entry
+    {
+        juce::String key;
+        SampleSource::Ptr source;  // Null while the first thread to ask is still loading
+    };
+
+    std::vector<Entry>::iterator findEntry(const juce::String& key);
+
+    juce::CriticalSection lock;
+    std::vector<Entry> entries;
+    juce::WaitableEvent loadFinished;
+
+    static constexpr int hashedBytes = 1 << 20;  // From each end of the file
+    static constexpr int waitIntervalMs = 20;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleRegistry)
+};
@@ -0,0 +1,281 @@
+#include "SampleSource.h"
+
+namespace
+{
+    using SampleFormat = SampleSource::SampleFormat;
+
+    // Nearest half-precision value, saturating at the largest finite one
+    juce::uint16 toHalf(float value)
+    {
+        juce::uint32 bits;
+        std::memcpy(&bits, &value, sizeof(float));
+
+        const auto sign = static_cast<juce::uint16>((bits >> 16) & 0x8000u);
+        bits &= 0x7fffffffu;
+
+        if (bits >= 0x477fe000u)  // 65520 and up would round to infinity
+            return static_cast<juce::uint16>(sign | 0x7bffu);
+
+        if (bits < 0x38800000u)   // Below the smallest normal half
+        {
+            float magnitude;
+            std::memcpy(&magnitude, &bits, sizeof(float));
+            return static_cast<juce::uint16>(sign | static_cast<juce::uint16>(std::lrint(magnitude * 16777216.0f)));
+        }
+
+        // Rebias the exponent and round the mantissa to nearest even
+        const juce::uint32 rounded = bits + 0xfffu + ((bits >> 13) & 1u);
+        return static_cast<juce::uint16>(sign | ((rounded - 0x38000000u) >> 13));
+    }
+
+    void storeSamples(SampleFormat format, const float* source, char* destination, int numSamples)
+    {
+        if (format == SampleFormat::float32)
+        {
+            std::memcpy(destination, source, static_cast<size_t>(numSamples) * sizeof(float));
+            return;
+        }
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            // Scaled like juce::AudioData, so 16-bit files round-trip exactly
+            const auto value = format == SampleFormat::int16
+                ? static_cast<juce::uint16>(static_cast<juce::int16>(juce::jlimit(-32767, 32767, juce::roundToInt(source[i] * 32768.0f))))
+                : toHalf(source[i]);
+
+            destination[2 * i] = static_cast<char>(value & 0xff);
+            destination[2 * i + 1] = static_cast<char>(value >> 8);
+        }
+    }
+
+    void loadSamples(SampleFormat format, const char* source, float* destination, int numSamples)
+    {
+        if (format == SampleFormat::float32)
+        {
+            std::memcpy(destination, source, static_cast<size_t>(numSamples) * sizeof(float));
+            return;
+        }
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            destination[i] = format == SampleFormat::int16 ? SampleSource::readSample<SampleFormat::int16>(source + 2 * i)
+                                                           : SampleSource::readSample<SampleFormat::float16>(source + 2 * i);
+        }
+    }
+}
+
+bool ReadRegions::set(const void* readerId, bool reversed, juce::int64 startSample, juce::int64 endSample, juce::int64 blockSize)
+{
+    const auto owner = reinterpret_cast<juce::pointer_sized_int>(readerId) | (reversed ? 1 : 0);
+    const auto now = juce::jmax(1u, juce::Time::getMillisecondCounter());
+
+    Slot* slot = nullptr;
+    bool claimed = false;
+
+    for (auto& candidate : slots)
+    {
+        if (candidate.owner.load() == owner)
+            slot = &candidate;
+    }
+
+    // A new reader takes a free slot, or else the one set longest ago
+    while (slot == nullptr)
+    {
+        Slot* victim = nullptr;
+        juce::pointer_sized_int victimOwner = 0;
+
+        for (auto& candidate : slots)
+        {
+            const auto candidateOwner = candidate.owner.load();
+
+            if (victim == nullptr || candidateOwner == 0
+                || (victimOwner != 0 && now - candidate.lastSet.load() > now - victim->lastSet.load()))
+            {
+                victim = &candidate;
+                victimOwner = candidateOwner;
+
+                if (candidateOwner == 0)
+                    break;
+            }
+        }
+
+        if (victim->owner.compare_exchange_strong(victimOwner, owner))
+        {
+            slot = victim;
+            claimed = true;
+        }
+    }
+
+    const bool moved = claimed
+                    || startSample / blockSize != slot->start.load() / blockSize
+                    || (endSample - 1) / blockSize != (slot->end.load() - 1) / blockSize;
+
+    slot->start = startSample;
+    slot->end = endSample;
+    slot->lastSet = now;
+    return moved;
+}
+
+int ReadRegions::get(std::array<Region, maxReaders>& regions) const
+{
+    int numRegions = 0;
+
+    for (const auto& slot : slots)
+    {
+        if (slot.owner.load() != 0)
+            regions[static_cast<size_t>(numRegions++)] = { slot.start.load(), slot.end.load() };
+    }
+
+    return numRegions;
+}
+
+SampleSource::SampleSource(juce::int64 length, int channels, double rate, const juce::String& name)
+    : lengthInSamples(length),
+      numChannels(channels),
+      sampleRate(rate),
+      fileName(name)
+{
+    peakPyramid.prepare(length, channels);
+}
+
+MemorySampleSource::MemorySampleSource(int length, int channels, double rate, const juce::String& name, SampleFormat format)
+    : SampleSource(length, channels, rate, name),
+      storageFormat(format),
+      bytesPerSample(getBytesPerSample(format)),
+      samples(static_cast<size_t>(length) * static_cast<size_t>(channels) * static_cast<size_t>(getBytesPerSample(format)), true),
+      blockValid(new std::atomic<bool>[static_cast<size_t>(getNumValidBlocks())])
+{
+    jassert(format == SampleFormat::float32 || format == SampleFormat::int16 || format == SampleFormat::float16);
+
+    for (int block = 0; block < getNumValidBlocks(); ++block)
+        blockValid[static_cast<size_t>(block)] = false;
+
+    energyMap.prepare(length);
+}
+
+size_t MemorySampleSource::getChannelOffset(int channel) const
+{
+    return static_cast<size_t>(channel) * static_cast<size_t>(getLengthInSamples()) * static_cast<size_t>(bytesPerSample);
+}
+
+void MemorySampleSource::addChunk(int startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples)
+{
+    for (int channel = 0; channel < getNumChannels(); ++channel)
+    {
+        char* destination = samples.get() + getChannelOffset(channel) + static_cast<size_t>(startSample) * static_cast<size_t>(bytesPerSample);
+        storeSamples(storageFormat, chunk.getReadPointer(juce::jmin(channel, chunk.getNumChannels() - 1)), destination, numChunkSamples);
+    }
+
+    energyMap.addChunk(startSample, chunk, numChunkSamples);
+
+    if (!peakPyramid.isReady())
+        peakPyramid.addChunk(startSample, chunk, numChunkSamples);
+
+    // Blocks the chunk covers completely are now readable
+    const int endSample = startSample + numChunkSamples;
+    const int firstBlock = (startSample + validBlockSize - 1) / validBlockSize;
+    const int endBlock = endSample == getLengthInSamples() ? getNumValidBlocks() : endSample / validBlockSize;
+
+    for (int block = firstBlock; block < endBlock; ++block)
+        blockValid[static_cast<size_t>(block)].store(true, std::memory_order_release);
+}
+
+void MemorySampleSource::readChunk(int startSample, juce::AudioBuffer<float>& chunk, int numChunkSamples) const
+{
+    for (int channel = 0; channel < juce::jmin(getNumChannels(), chunk.getNumChannels()); ++channel)
+    {
+        const char* source = samples.get() + getChannelOffset(channel) + static_cast<size_t>(startSample) * static_cast<size_t>(bytesPerSample);
+        loadSamples(storageFormat, source, chunk.getWritePointer(channel), numChunkSamples);
+    }
+}
+
+void MemorySampleSource::finishLoading()
+{
+    energyMap.finish();
+
+    if (!peakPyramid.isReady())
+        peakPyramid.finish();
+
+    fullyLoaded = true;
+
+    if (reversedWanted.load())
+        buildReversed();
+}
+
+void MemorySampleSource::prepareReversed()
+{
+    reversedWanted = true;
+
+    // finishLoading() builds it otherwise, having seen the request above
+    if (fullyLoaded.load())
+        buildReversed();
+}
+
+void MemorySampleSource::buildReversed()
+{
+    const juce::ScopedLock lock(reverseLock);
+
+    if (reversedReady.load())
+        return;
+
+    const auto length = static_cast<size_t>(getLengthInSamples());
+    const auto sampleBytes = static_cast<size_t>(bytesPerSample);
+    reversedSamples.allocate(length * static_cast<size_t>(getNumChannels()) * sampleBytes, false);
+
+    for (int channel = 0; channel < getNumChannels(); ++channel)
+    {
+        const char* source = samples.get() + getChannelOffset(channel);
+        char* destination = reversedSamples.get() + getChannelOffset(channel);
+
+        for (size_t i = 0; i < length; ++i)
+            std::memcpy(destination + (length - 1 - i) * sampleBytes, source + i * sampleBytes, sampleBytes);
+    }
+
+    reversedReady = true;
+}
+
+bool MemorySampleSource::isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    if (reversed)
+        return canReadReversed();
+
+    if (fullyLoaded.load())
+        return true;
+
+    const juce::int64 first = juce::jmax(static_cast<juce::int64>(0), startSample);
+    const juce::int64 end = juce::jmin(getLengthInSamples(), endSample);
+
+    for (juce::int64 block = first / validBlockSize; block < (end + validBlockSize - 1) / validBlockSize; ++block)
+    {
+        if (!blockValid[static_cast<size_t>(block)].load(std::memory_order_acquire))
+            return false;
+    }
+
+    return true;
+}
+
+bool MemorySampleSource::acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const
+{
+    if (!isResident(startSample, endSample, reversed))
+        return false;
+
+    if (getNumChannels() == 0)
+        return false;
+
+    // The whole sample is one window
+    const char* data = reversed ? reversedSamples.get() : samples.get();
+    window.left = data;
+    window.right = data + getChannelOffset(getNumChannels() > 1 ? 1 : 0);
+    window.frameBytes = bytesPerSample;
+    window.format = storageFormat;
+    window.start = 0;
+    window.length = static_cast<int>(getLengthInSamples());
+    window.slot = -1;
+    return true;
+}
+
+void MemorySampleSource::setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    const juce::int64 length = getLengthInSamples();
+    readRegions.set(readerId, reversed, reversed ? length - endSample : startSample, reversed ? length - startSample : endSample, validBlockSize);
+}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "EnergyMap.h"
+#include "PeakPyramid.h"
+
+// The spans the engines reading a shared source are about to spawn grains in, one per
+// engine and direction, in forward samples. An engine keeps its slot, even while it is
+// idle, until every slot is taken and its own is the one set longest ago. Several audio
+// threads may set regions at once.
+class ReadRegions
+{
+public:
+    struct Region
+    {
+        juce::int64 start = 0;
+        juce::int64 end = 0;
+    };
+
+    static constexpr int maxReaders = 8;
+
+    // Returns true when the reader's region is new or now reaches other multiples of
+    // blockSize than before
+    bool set(const void* readerId, bool reversed, juce::int64 startSample, juce::int64 endSample, juce::int64 blockSize);
+
+    // Copies out every region, returning how many there are
+    int get(std::array<Region, maxReaders>& regions) const;
+
+private:
+    struct Slot
+    {
+        std::atomic<juce::pointer_sized_int> owner { 0 };  // Reader address, low bit set for reversed
+        std::atomic<juce::int64> start { 0 };
+        std::atomic<juce::int64> end { 0 };
+        std::atomic<juce::uint32> lastSet { 0 };
+    };
+
+    std::array<Slot, maxReaders> slots;
+};
+
+// A sample shared by the loader, the grain engine and the texture freezer. Grains never
+// index the audio directly; for each tile they pin a window of evenly spaced frames that
+// covers the span they are about to read. Reverse grains read a time-reversed view
+// forwards, with positions in reversed coordinates.
+class SampleSource : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<SampleSource>;
+
+    // How one sample is stored; the grain kernel converts to float as it reads
+    enum class SampleFormat
+    {
+        float32,
+        int16,
+        int24,
+        int16BigEndian,
+        int24BigEndian,
+        float16
+    };
+
+    struct Window
+    {
+        const void* left = nullptr;   // Sample of each channel in the window's first frame
+        const void* right = nullptr;
+        int frameBytes = 0;           // Distance between frames; negative when the data runs backwards
+        SampleFormat format = SampleFormat::float32;
+        juce::int64 start = 0;        // Source sample of the first frame
+        int length = 0;
+        int slot = -1;                // Cache slot pinned by a streaming source
+    };
+
+    static int getBytesPerSample(SampleFormat format)
+    {
+        switch (format)
+        {
+            case SampleFormat::int24:
+            case SampleFormat::int24BigEndian:  return 3;
+            case SampleFormat::float32:         return 4;
+            default:                            return 2;
+        }
+    }
+
+    // One stored sample as float, scaled like juce::AudioData
+    template <SampleFormat format>
+    static float readSample(const char* data)
+    {
+        const auto* bytes = reinterpret_cast<const juce::uint8*>(data);
+
+        if constexpr (format == SampleFormat::int16)
+            return static_cast<float>(static_cast<juce::int16>(bytes[0] | (bytes[1] << 8))) * (1.0f / 32768.0f);
+        else if constexpr (format == SampleFormat::int16BigEndian)
+            return static_cast<float>(static_cast<juce::int16>(bytes[1] | (bytes[0] << 8))) * (1.0f / 32768.0f);
+        else if constexpr (format == SampleFormat::int24)
+            return static_cast<float>(static_cast<juce::int32>((static_cast<juce::uint32>(bytes[0]) << 8)
+                                                               | (static_cast<juce::uint32>(bytes[1]) << 16)
+                                                               | (static_cast<juce::uint32>(bytes[2]) << 24)) >> 8) * (1.0f / 8388608.0f);
+        else if constexpr (format == SampleFormat::int24BigEndian)
+            return static_cast<float>(static_cast<juce::int32>((static_cast<juce::uint32>(bytes[2]) << 8)
+                                                               | (static_cast<juce::uint32>(bytes[1]) << 16)
+                                                               | (static_cast<juce::uint32>(bytes[0]) << 24)) >> 8) * (1.0f / 8388608.0f);
+        else if constexpr (format == SampleFormat::float16)
+        {
+            // Normal halves are rebiased into a float; subnormals are scaled, so no float denormals appear
+            const juce::uint32 half = static_cast<juce::uint32>(bytes[0]) | (static_cast<juce::uint32>(bytes[1]) << 8);
+            const juce::uint32 normalBits = ((half & 0x7fffu) << 13) + 0x38000000u;
+            float normal;
+            std::memcpy(&normal, &normalBits, sizeof(float));
+
+            const float subnormal = static_cast<float>(half & 0x3ffu) * (1.0f / 16777216.0f);
+            const float magnitude = (half & 0x7c00u) != 0 ? normal : subnormal;
+            return (half & 0x8000u) != 0 ? -magnitude : magnitude;
+        }
+        else
+        {
+            float value;
+            std::memcpy(&value, data, sizeof(float));
+            return value;
+        }
+    }
+
+    // The same, for a format only known at run time
+    static float readSample(SampleFormat format, const char* data)
+    {
+        switch (format)
+        {
+            case SampleFormat::int16:           return readSample<SampleFormat::int16>(data);
+            case SampleFormat::int24:           return readSample<SampleFormat::int24>(data);
+            case SampleFormat::int16BigEndian:  return readSample<SampleFormat::int16BigEndian>(data);
+            case SampleFormat::int24BigEndian:  return readSample<SampleFormat::int24BigEndian>(data);
+            case SampleFormat::float16:         return readSample<SampleFormat::float16>(data);
+            case SampleFormat::float32:
+            default:                            return readSample<SampleFormat::float32>(data);
+        }
+    }
+
+    SampleSource(juce::int64 lengthInSamples, int numChannels, double sampleRate, const juce::String& fileName);
+
+    juce::int64 getLengthInSamples() const { return lengthInSamples; }
+    int getNumChannels() const { return numChannels; }
+    double getSampleRate() const { return sampleRate; }
+    const juce::String& getFileName() const { return fileName; }
+
+    // Per-block levels for silence culling; empty (never silent) when not analysed
+    const EnergyMap& getEnergyMap() const { return energyMap; }
+
+    // Min/max peaks for drawing; not ready until the loader has seen every sample
+    const PeakPyramid& getPeakPyramid() const { return peakPyramid; }
+    PeakPyramid& getPeakPyramid() { return peakPyramid; }
+
+    virtual bool isStreaming() const = 0;
+
+    // Live sources keep capturing while they are read, so the getLengthInSamples() samples
+    // that can be read start here and move on with the capture. Files start at 0.
+    virtual bool isLive() const { return false; }
+    virtual juce::int64 getFirstSample() const { return 0; }
+
+    // False when the source keeps only one engine's read region resident, so plugin
+    // instances cannot share it through the SampleRegistry
+    virtual bool isShareable() const { return true; }
+
+    // Shared sources may have this called by several instances at once
+    virtual void prepareReversed() = 0;
+    virtual bool canReadReversed() const = 0;
+
+    // True when [startSample, endSample) can be read without waiting for the disk
+    virtual bool isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const = 0;
+
+    // Pins a window covering [startSample, endSample), or returns false when the data is not
+    // resident. Every acquired window must be released. Safe to call from the audio thread.
+    virtual bool acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const = 0;
+    virtual void releaseWindow(const Window& window) const { juce::ignoreUnused(window); }
+
+    // The span the reader's grains are about to be spawned in, so streaming sources can keep
+    // it resident. Shareable sources keep a region per reader (see ReadRegions).
+    virtual void setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const
+    {
+        juce::ignoreUnused(readerId, startSample, endSample, reversed);
+    }
+
+protected:
+    EnergyMap energyMap;
+    PeakPyramid peakPyramid;
+
+private:
+    const juce::int64 lengthInSamples;
+    const int numChannels;
+    const double sampleRate;
+    const juce::String fileName;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SampleSource)
+};
+
+// A sample decoded entirely into memory, stored as float32, int16 or float16. It may be
+// shared while it is still being filled: spans not decoded yet are not resident, and the
+// energy map and reversed copy follow once the last chunk is in.
+class MemorySampleSource : public SampleSource
+{
+public:
+    // Allocates the sample, which is then filled with addChunk()
+    MemorySampleSource(int lengthInSamples, int numChannels, double sampleRate, const juce::String& fileName,
+                       SampleFormat storageFormat);
+
+    // Converts decoded audio to the storage format and adds it to the energy map and, unless
+    // it was read from the peak cache, the peak pyramid. Chunks
+    // follow the EnergyMap::addChunk() rules, so several threads may decode at once;
+    // call finishLoading() once every chunk is in.
+    void addChunk(int startSample, const juce::AudioBuffer<float>& chunk, int numChunkSamples);
+    void finishLoading();
+    bool isFullyLoaded() const { return fullyLoaded.load(); }
+
+    // The regions passed to setReadRegion(), for ordering decoding
+    int getReadRegions(std::array<ReadRegions::Region, ReadRegions::maxReaders>& regions) const { return readRegions.get(regions); }
+
+    // Converts stored samples back to float
+    void readChunk(int startSample, juce::AudioBuffer<float>& chunk, int numChunkSamples) const;
+
+    SampleFormat getStorageFormat() const { return storageFormat; }
+
+    bool isStreaming() const override { return false; }
+
+    // Builds a time-reversed copy of the samples, deferred until they are all loaded.
+    // May be called while finishLoading() runs on another thread.
+    void prepareReversed() override;
+    bool canReadReversed() const override { return reversedReady.load(); }
+
+    bool isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+    bool acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const override;
+    void setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+
+    // Granularity of the loaded flags
+    static constexpr int validBlockSize = 65536;
+
+private:
+    size_t getChannelOffset(int channel) const;
+    int getNumValidBlocks() const { return static_cast<int>((getLengthInSamples() + validBlockSize - 1) / validBlockSize); }
+    void buildReversed();
+
+    const SampleFormat storageFormat;
+    const int bytesPerSample;
+
+    // Planar, one channel after another
+    juce::HeapBlock<char> samples;
+    juce::HeapBlock<char> reversedSamples;
+    std::atomic<bool> reversedReady { false };
+    std::atomic<bool> reversedWanted { false };
+    juce::CriticalSection reverseLock;
+
+    // Set per block once its samples are stored, then for the whole sample
+    std::unique_ptr<std::atomic<bool>[]> blockValid;
+    std::atomic<bool> fullyLoaded { false };
+
+    // Read regions, written by the engines
+    mutable ReadRegions readRegions;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MemorySampleSource)
+};
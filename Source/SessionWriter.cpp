@@ -0,0 +1,172 @@
+#include "SessionWriter.h"
+
+SessionWriter::SessionWriter()
+    : juce::Thread("PinkGrain Session Writer"),
+      directory(juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                    .getChildFile("PinkGrain")
+                    .getChildFile("Sessions"))
+{
+}
+
+SessionWriter::~SessionWriter()
+{
+    // Instances going away hand over urgent sessions, which the thread writes as soon as
+    // they arrive, so by now there is at most the last one left to finish. Never left
+    // running, as the module may be unloaded once the last instance is gone.
+    signalThreadShouldExit();
+    notify();
+    stopThread(-1);
+}
+
+int SessionWriter::claimSlot()
+{
+    const juce::ScopedLock scopedLock(lock);
+
+    for (size_t i = 0;; ++i)
+    {
+        if (i == slots.size())
+            slots.emplace_back();
+
+        auto& slot = slots[i];
+        if (slot.claimed)
+            continue;
+
+        // A slot this process still holds the lock for is free to claim again
+        if (slot.fileLock == nullptr)
+            slot.fileLock = lockSlot(static_cast<int>(i));
+
+        // Should the locks fail altogether, slots further on go by this process alone
+        if (slot.fileLock != nullptr || i >= maxLockedSlots)
+        {
+            slot.claimed = true;
+            return static_cast<int>(i);
+        }
+    }
+}
+
+void SessionWriter::releaseSlot(int slot)
+{
+    // Instances that never claimed a slot release none
+    if (slot < 0)
+        return;
+
+    // Anything still pending is written all the same, and the slot stays locked until it is
+    const juce::ScopedLock scopedLock(lock);
+    auto& entry = slots[static_cast<size_t>(slot)];
+
+    entry.claimed = false;
+
+    if (!entry.pending)
+        entry.fileLock = nullptr;
+}
+
+SessionWriter::SlotLock SessionWriter::lockSlot(int slot)
+{
+    auto fileLock = std::make_unique<juce::InterProcessLock>("PinkGrainSession" + juce::String(slot + 1));
+    if (!fileLock->enter(0))
+        return nullptr;
+
+    return fileLock;
+}
+
+juce::File SessionWriter::getSlotFile(int slot) const
+{
+    return directory.getChildFile("Session" + juce::String(slot + 1) + ".dat");
+}
+
+void SessionWriter::submit(int slot, juce::MemoryBlock session, bool urgent)
+{
+    {
+        const juce::ScopedLock scopedLock(lock);
+        auto& entry = slots[static_cast<size_t>(slot)];
+
+        entry.session = std::move(session);
+        entry.pending = true;
+        entry.urgent = entry.urgent || urgent;
+        entry.changeTime = juce::Time::getMillisecondCounter();
+    }
+
+    // Started by the first session, so instances that never get that far (plugin scans) cost nothing
+    if (!started.exchange(true))
+        startThread(juce::Thread::Priority::background);
+
+    notify();
+}
+
+void SessionWriter::run()
+{
+    while (!threadShouldExit())
+        wait(writeDueSessions());
+
+    // Urgent sessions handed over while the thread was being stopped
+    writeDueSessions();
+}
+
+int SessionWriter::writeDueSessions()
+{
+    int nextDueMs = -1;
+
+    for (size_t i = 0;; ++i)
+    {
+        juce::MemoryBlock session;
+        {
+            const juce::ScopedLock scopedLock(lock);
+
+            if (i >= slots.size())
+                break;
+
+            auto& entry = slots[i];
+            if (!entry.pending)
+                continue;
+
+            const auto elapsed = juce::Time::getMillisecondCounter() - entry.changeTime;
+            if (!entry.urgent && elapsed < settleTimeMs)
+            {
+                const int dueMs = static_cast<int>(settleTimeMs - elapsed);
+                nextDueMs = nextDueMs < 0 ? dueMs : juce::jmin(nextDueMs, dueMs);
+                continue;
+            }
+
+            entry.pending = false;
+            entry.urgent = false;
+
+            // Sessions that went back to what was written, or never changed, are not written again
+            if (entry.session == entry.written)
+            {
+                if (!entry.claimed)
+                    entry.fileLock = nullptr;
+
+                continue;
+            }
+
+            session = entry.session;
+        }
+
+        // Written outside the lock, so instances handing over sessions never wait on the disk
+        const bool written = writeSession(getSlotFile(static_cast<int>(i)), session);
+
+        const juce::ScopedLock scopedLock(lock);
+        auto& entry = slots[i];
+
+        if (written)
+            entry.written = std::move(session);
+
+        // A released slot is free for other processes once its last session is out
+        if (!entry.claimed && !entry.pending)
+            entry.fileLock = nullptr;
+    }
+
+    return nextDueMs;
+}
+
+bool SessionWriter::writeSession(const juce::File& file, const juce::MemoryBlock& session)
+{
+    if (!file.getParentDirectory().createDirectory().wasOk())
+        return false;
+
+    // Renamed over the slot file only once it is complete
+    juce::TemporaryFile temporary(file);
+
+    return temporary.getFile().appendData(session.getData(), session.getSize())
+        && temporary.overwriteTargetFileWithTemporary();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// Saves each instance's session on a background thread, to a slot file of its own, so
+// instances never race for one file and closing a project never waits on the disk. Slots
+// are locked across processes, so hosts that run plugins out of process do not share them
+// either. A session is written once it has stopped changing for a moment, only if it
+// differs from what that slot last wrote, and into a temporary file that is then renamed
+// over the slot, so a crash mid-write leaves the previous session intact. Shared by every
+// instance through a SharedResourcePointer.
+class SessionWriter : private juce::Thread
+{
+public:
+    SessionWriter();
+    ~SessionWriter() override;  // Joins the thread, which writes urgent sessions as they arrive
+
+    // The lowest slot no other instance holds, in this process or any other
+    int claimSlot();
+    void releaseSlot(int slot);  // Does nothing for -1, a slot never claimed
+
+    juce::File getSlotFile(int slot) const;
+
+    // Replaces the session waiting to be written to the slot. Urgent sessions, such as
+    // those of instances going away, skip the wait for changes to settle.
+    void submit(int slot, juce::MemoryBlock session, bool urgent);
+
+private:
+    // Held while a slot is claimed and until its last session is written
+    using SlotLock = std::unique_ptr<juce::InterProcessLock>;
+
+    struct Slot
+    {
+        bool claimed = false;
+        SlotLock fileLock;
+        bool pending = false;
+        bool urgent = false;
+        juce::uint32 changeTime = 0;
+        juce::MemoryBlock session;
+        juce::MemoryBlock written;  // What the slot file holds, as far as this process knows
+    };
+
+    void run() override;
+    int writeDueSessions();  // Returns the milliseconds until the next one is due, or -1
+    static bool writeSession(const juce::File& file, const juce::MemoryBlock& session);
+    static SlotLock lockSlot(int slot);
+
+    const juce::File directory;
+
+    juce::CriticalSection lock;
+    std::vector<Slot> slots;
+
+    std::atomic<bool> started { false };
+
+    static constexpr juce::uint32 settleTimeMs = 1000;
+    static constexpr size_t maxLockedSlots = 256;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SessionWriter)
+};
@@ -0,0 +1,192 @@
+#include "StreamingSampleSource.h"
+
+StreamingSampleSource::StreamingSampleSource(std::unique_ptr<juce::AudioFormatReader> formatReader, const juce::String& name)
+    : SampleSource(formatReader->lengthInSamples, static_cast<int>(formatReader->numChannels), formatReader->sampleRate, name),
+      juce::Thread("PinkGrain Sample Streamer"),
+      reader(std::move(formatReader)),
+      slots(new Slot[numCacheSlots]),
+      slotForKey(new std::atomic<int>[static_cast<size_t>(getNumBlocks() * 2)])
+{
+    for (juce::int64 key = 0; key < getNumBlocks() * 2; ++key)
+        slotForKey[static_cast<size_t>(key)] = -1;
+
+    for (int s = 0; s < numCacheSlots; ++s)
+        slots[s].data.setSize(2, blockSize + blockOverlap);
+
+    startThread(juce::Thread::Priority::normal);
+}
+
+StreamingSampleSource::~StreamingSampleSource()
+{
+    stopThread(4000);
+}
+
+int StreamingSampleSource::findSlot(juce::int64 startSample, juce::int64 endSample, bool reversed, juce::int64& key) const
+{
+    const juce::int64 length = getLengthInSamples();
+    if (length <= 0)
+        return -1;
+
+    // Reads past the end land in the last block, whose window ends with the source
+    const juce::int64 block = juce::jlimit(static_cast<juce::int64>(0), getNumBlocks() - 1, startSample / blockSize);
+    const juce::int64 windowEnd = juce::jmin(length, block * blockSize + blockSize + blockOverlap);
+
+    if (endSample > windowEnd && windowEnd < length)
+        return -1;
+
+    key = makeKey(block, reversed);
+    return slotForKey[static_cast<size_t>(key)].load();
+}
+
+bool StreamingSampleSource::isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    juce::int64 key = -1;
+    return findSlot(startSample, endSample, reversed, key) >= 0;
+}
+
+bool StreamingSampleSource::acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const
+{
+    juce::int64 key = -1;
+    const int s = findSlot(startSample, endSample, reversed, key);
+    if (s < 0)
+        return false;
+
+    // Pin first, then confirm the slot still holds the block; the prefetch thread
+    // unmaps a slot before it waits for the pins to drop and refills it
+    auto& slot = slots[s];
+    ++slot.pins;
+
+    if (slot.key.load() != key)
+    {
+        --slot.pins;
+        return false;
+    }
+
+    slot.lastUsed.store(++useCounter, std::memory_order_relaxed);
+
+    const juce::int64 blockStart = (key / 2) * blockSize;
+    window.left = slot.data.getReadPointer(0);
+    window.right = slot.data.getReadPointer(1);
+    window.frameBytes = static_cast<int>(sizeof(float));
+    window.format = SampleFormat::float32;
+    window.start = blockStart;
+    window.length = static_cast<int>(juce::jmin(getLengthInSamples() - blockStart, static_cast<juce::int64>(blockSize + blockOverlap)));
+    window.slot = s;
+    return true;
+}
+
+void StreamingSampleSource::releaseWindow(const Window& window) const
+{
+    if (window.slot >= 0)
+        --slots[window.slot].pins;
+}
+
+void StreamingSampleSource::setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const
+{
+    // Not shareable, so one region is kept whichever engine sets it
+    juce::ignoreUnused(readerId);
+    regionStart = startSample;
+    regionEnd = endSample;
+    regionReversed = reversed;
+}
+
+void StreamingSampleSource::run()
+{
+    while (!threadShouldExit())
+    {
+        const bool reversed = regionReversed.load();
+        const juce::int64 lastBlock = getNumBlocks() - 1;
+        const juce::int64 first = juce::jlimit(static_cast<juce::int64>(0), lastBlock, regionStart.load() / blockSize);
+        const juce::int64 last = juce::jlimit(first, lastBlock, (regionEnd.load() - 1) / blockSize);
+
+        // Fill outwards from the middle of the region, so the most likely blocks come first
+        // and a region larger than the cache keeps its centre resident
+        const juce::int64 centre = (first + last) / 2;
+        const juce::int64 numWanted = juce::jmin(last - first + 1, static_cast<juce::int64>(numCacheSlots));
+        const juce::int64 wantedFirst = juce::jlimit(first, last - numWanted + 1, centre - numWanted / 2);
+        const juce::int64 wantedLast = wantedFirst + numWanted - 1;
+
+        for (juce::int64 i = 0; i < 2 * numWanted && !threadShouldExit(); ++i)
+        {
+            const juce::int64 block = (i % 2 == 0) ? centre + i / 2 : centre - (i + 1) / 2;
+            if (block < wantedFirst || block > wantedLast)
+                continue;
+
+            const juce::int64 key = makeKey(block, reversed);
+            if (slotForKey[static_cast<size_t>(key)].load() < 0 && !fillBlock(key, wantedFirst, wantedLast))
+                break;
+        }
+
+        wait(prefetchIntervalMs);
+    }
+}
+
+int StreamingSampleSource::findSlotToEvict(juce::int64 firstWanted, juce::int64 lastWanted, bool reversed) const
+{
+    int oldest = -1;
+    juce::uint32 oldestUse = 0;
+    const juce::uint32 now = useCounter.load(std::memory_order_relaxed);
+
+    for (int s = 0; s < numCacheSlots; ++s)
+    {
+        const juce::int64 key = slots[s].key.load();
+        if (key < 0)
+            return s;
+
+        // Blocks of the region being filled are never evicted for each other
+        const juce::int64 block = key / 2;
+        if ((key % 2 == 1) == reversed && block >= firstWanted && block <= lastWanted)
+            continue;
+
+        const juce::uint32 age = now - slots[s].lastUsed.load(std::memory_order_relaxed);
+        if (oldest < 0 || age > oldestUse)
+        {
+            oldest = s;
+            oldestUse = age;
+        }
+    }
+
+    return oldest;
+}
+
+bool StreamingSampleSource::fillBlock(juce::int64 key, juce::int64 firstWanted, juce::int64 lastWanted)
+{
+    const juce::int64 block = key / 2;
+    const bool reversed = (key % 2) == 1;
+
+    const int s = findSlotToEvict(firstWanted, lastWanted, reversed);
+    if (s < 0)
+        return false;
+
+    auto& slot = slots[s];
+
+    // Unmap, then wait for readers that pinned the slot before the unmap to let go
+    const juce::int64 previousKey = slot.key.exchange(-1);
+    if (previousKey >= 0)
+        slotForKey[static_cast<size_t>(previousKey)] = -1;
+
+    while (slot.pins.load() > 0)
+    {
+        if (threadShouldExit())
+            return false;
+
+        juce::Thread::yield();
+    }
+
+    // In reversed coordinates block b covers forward samples [L - end, L - start)
+    const juce::int64 length = getLengthInSamples();
+    const juce::int64 blockStart = block * blockSize;
+    const int numSamples = static_cast<int>(juce::jmin(length - blockStart, static_cast<juce::int64>(blockSize + blockOverlap)));
+    const juce::int64 readStart = reversed ? length - blockStart - numSamples : blockStart;
+
+    if (!reader->read(&slot.data, 0, numSamples, readStart, true, true))
+        return false;
+
+    if (reversed)
+        slot.data.reverse(0, numSamples);
+
+    slot.lastUsed.store(useCounter.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.key = key;
+    slotForKey[static_cast<size_t>(key)] = s;
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+// A sample streamed from disk through a fixed cache of decoded blocks. A prefetch thread
+// keeps the blocks around the current read region resident; reads that miss the cache
+// fail instead of waiting, so the audio thread never blocks on the disk.
+class StreamingSampleSource : public SampleSource,
+                              private juce::Thread
+{
+public:
+    StreamingSampleSource(std::unique_ptr<juce::AudioFormatReader> reader, const juce::String& fileName);
+    ~StreamingSampleSource() override;
+
+    bool isStreaming() const override { return true; }
+    bool isShareable() const override { return false; }
+
+    // Reversed blocks are decoded on demand, so there is nothing to prepare
+    void prepareReversed() override {}
+    bool canReadReversed() const override { return true; }
+
+    bool isResident(juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+    bool acquireWindow(juce::int64 startSample, juce::int64 endSample, bool reversed, Window& window) const override;
+    void releaseWindow(const Window& window) const override;
+    void setReadRegion(const void* readerId, juce::int64 startSample, juce::int64 endSample, bool reversed) const override;
+
+    // Each block carries the start of the next one, so any span shorter than the
+    // overlap that starts inside a block can be read from that block alone
+    static constexpr int blockSize = 65536;
+    static constexpr int blockOverlap = 16384;
+    static constexpr int numCacheSlots = 96;  // About 60 MB of stereo blocks
+
+private:
+    struct Slot
+    {
+        juce::AudioBuffer<float> data;
+        std::atomic<juce::int64> key { -1 };  // Block key, or -1 while empty or being refilled
+        std::atomic<int> pins { 0 };
+        std::atomic<juce::uint32> lastUsed { 0 };
+    };
+
+    void run() override;
+    bool fillBlock(juce::int64 key, juce::int64 firstWanted, juce::int64 lastWanted);
+    int findSlotToEvict(juce::int64 firstWanted, juce::int64 lastWanted, bool reversed) const;
+    int findSlot(juce::int64 startSample, juce::int64 endSample, bool reversed, juce::int64& key) const;
+
+    juce::int64 getNumBlocks() const { return (getLengthInSamples() + blockSize - 1) / blockSize; }
+    static juce::int64 makeKey(juce::int64 block, bool reversed) { return block * 2 + (reversed ? 1 : 0); }
+
+    std::unique_ptr<juce::AudioFormatReader> reader;  // Prefetch thread only
+
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<std::atomic<int>[]> slotForKey;  // Block key -> slot, or -1
+    mutable std::atomic<juce::uint32> useCounter { 0 };
+
+    // Read region, written by the engine
+    mutable std::atomic<juce::int64> regionStart { 0 };
+    mutable std::atomic<juce::int64> regionEnd { 0 };
+    mutable std::atomic<bool> regionReversed { false };
+
+    static constexpr int prefetchIntervalMs = 10;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(StreamingSampleSource)
+};
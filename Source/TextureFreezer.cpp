@@ -0,0 +1,267 @@
+#include "TextureFreezer.h"
+
+TextureFreezer::TextureFreezer()
+    : juce::Thread("PinkGrain Texture Freezer")
+{
+    startThread(juce::Thread::Priority::low);
+}
+
+TextureFreezer::~TextureFreezer()
+{
+    stopThread(4000);
+}
+
+void TextureFreezer::prepare(double sampleRate)
+{
+    if (sampleRate == outputSampleRate.load())
+        return;
+
+    outputSampleRate = sampleRate;
+
+    // Loops rendered at the old rate are no longer usable
+    for (auto& slot : slots)
+    {
+        int expected = requested;
+        if (slot.state.compare_exchange_strong(expected, idle))
+            continue;
+
+        if (expected == rendering && slot.state.compare_exchange_strong(expected, cancelled))
+            continue;
+
+        if (expected == ready || expected == playing)
+            slot.state = retired;
+    }
+
+    notify();
+}
+
+void TextureFreezer::requestLoop(int midiNote, float velocity, const GrainParameters& params,
+                                 const SampleSource::Ptr& source, const ZoneMap::Ptr& zones, int maxGrains)
+{
+    auto& slot = slots[static_cast<size_t>(midiNote)];
+
+    if (slot.state.load() != idle)
+        return;
+
+    slot.velocity = velocity;
+    slot.params = params;
+    slot.source = source;
+    slot.zones = zones;
+    slot.maxGrains = maxGrains;
+
+    slot.state = requested;
+    notify();
+}
+
+bool TextureFreezer::startLoopIfReady(int midiNote, int fadeSamples)
+{
+    auto& slot = slots[static_cast<size_t>(midiNote)];
+
+    if (slot.state.load() != ready)
+        return false;
+
+    slot.readPosition = 0;
+    slot.gain = 0.0f;
+    slot.gainStep = 1.0f / static_cast<float>(juce::jmax(1, fadeSamples));
+    slot.releasing = false;
+    slot.state = playing;
+    return true;
+}
+
+bool TextureFreezer::isLoopPlaying(int midiNote) const
+{
+    const auto& slot = slots[static_cast<size_t>(midiNote)];
+    return slot.state.load() == playing && !slot.releasing;
+}
+
+bool TextureFreezer::isPlayingAnyLoop() const
+{
+    return std::any_of(slots.begin(), slots.end(), [](const Slot& slot) { return slot.state.load() == playing; });
+}
+
+void TextureFreezer::releaseLoop(int midiNote, int fadeSamples)
+{
+    auto& slot = slots[static_cast<size_t>(midiNote)];
+
+    // Not picked up by the worker yet, just withdraw the request
+    int expected = requested;
+    if (slot.state.compare_exchange_strong(expected, idle))
+        return;
+
+    // The worker notices the cancellation and throws the render away
+    if (expected == rendering && slot.state.compare_exchange_strong(expected, cancelled))
+        return;
+
+    if (expected == ready)
+    {
+        slot.state = retired;
+        notify();
+        return;
+    }
+
+    if (expected == playing && !slot.releasing)
+    {
+        if (slot.gain <= 0.0f)
+        {
+            slot.state = retired;
+            notify();
+            return;
+        }
+
+        const int minimumFadeSamples = static_cast<int>(minimumFadeSeconds * outputSampleRate.load());
+        slot.releasing = true;
+        slot.gainStep = -slot.gain / static_cast<float>(juce::jmax(minimumFadeSamples, fadeSamples, 1));
+    }
+}
+
+void TextureFreezer::releaseAll(int fadeSamples)
+{
+    for (int note = 0; note < static_cast<int>(slots.size()); ++note)
+    {
+        releaseLoop(note, fadeSamples);
+    }
+}
+
+void TextureFreezer::process(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples, float gain)
+{
+    for (auto& slot : slots)
+    {
+        if (slot.state.load() != playing)
+            continue;
+
+        const int loopLength = slot.loop.getNumSamples();
+        const float* loopLeft = slot.loop.getReadPointer(0);
+        const float* loopRight = slot.loop.getReadPointer(1);
+        float* outLeft = outputBuffer.getWritePointer(0, startSample);
+        float* outRight = outputBuffer.getWritePointer(1, startSample);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            slot.gain = juce::jlimit(0.0f, 1.0f, slot.gain + slot.gainStep);
+
+            const float loopGain = slot.gain * gain;
+            outLeft[i] += loopLeft[slot.readPosition] * loopGain;
+            outRight[i] += loopRight[slot.readPosition] * loopGain;
+
+            if (++slot.readPosition >= loopLength)
+                slot.readPosition = 0;
+        }
+
+        if (slot.releasing && slot.gain <= 0.0f)
+        {
+            slot.state = retired;
+            notify();
+        }
+    }
+}
+
+void TextureFreezer::run()
+{
+    while (!threadShouldExit())
+    {
+        for (int note = 0; note < static_cast<int>(slots.size()); ++note)
+        {
+            auto& slot = slots[static_cast<size_t>(note)];
+
+            int expected = requested;
+            if (slot.state.compare_exchange_strong(expected, rendering))
+            {
+                const bool finished = renderLoop(note, slot);
+
+                // Let go of the samples so the loaders can free them after a swap
+                renderer->setZones(nullptr);
+                renderer->setSource(nullptr);
+                slot.source = nullptr;
+                slot.zones = nullptr;
+
+                expected = rendering;
+                if (finished && slot.state.compare_exchange_strong(expected, ready))
+                    continue;
+
+                slot.loop.setSize(0, 0);
+                slot.state = idle;
+            }
+            else if (expected == retired)
+            {
+                slot.loop.setSize(0, 0);
+                slot.state = idle;
+            }
+        }
+
+        wait(-1);
+    }
+}
+
+bool TextureFreezer::renderLoop(int midiNote, Slot& slot)
+{
+    const double sampleRate = outputSampleRate.load();
+
+    if (renderer == nullptr)
+        renderer = std::make_unique<GrainEngine>(false, false);
+
+    // Render with unity volume, master volume is applied by the live engine
+    auto renderParams = slot.params;
+    renderParams.volume = 1.0f;
+
+    renderer->reset();
+    renderer->prepare(sampleRate, renderBlockSize);
+    renderer->setParameters(renderParams);
+    renderer->setMaxActiveGrains(slot.maxGrains);
+    renderer->setSource(slot.source);
+    renderer->setZones(slot.zones);
+    renderer->noteOn(midiNote, slot.velocity);
+
+    // Let the cloud build up to its steady state before capturing it
+    const double grainSeconds = renderParams.grainSizeMs / 1000.0;
+    const int preRollSamples = static_cast<int>(juce::jmin(grainSeconds, 10.0) * sampleRate);
+    const int loopSamples = static_cast<int>(juce::jlimit(4.0, 8.0, 2.0 * grainSeconds) * sampleRate);
+    const int seamSamples = static_cast<int>(loopCrossfadeSeconds * sampleRate);
+    const int totalSamples = preRollSamples + loopSamples + seamSamples;
+
+    rendered.setSize(2, loopSamples + seamSamples, false, false, true);
+
+    for (int blockStart = 0; blockStart < totalSamples; blockStart += renderBlockSize)
+    {
+        if (threadShouldExit() || slot.state.load() == cancelled)
+            return false;
+
+        const int blockLength = juce::jmin(renderBlockSize, totalSamples - blockStart);
+        const int blockEnd = blockStart + blockLength;
+
+        renderBlock.setSize(2, blockLength, false, false, true);
+        renderBlock.clear();
+        renderer->process(renderBlock);
+
+        // Keep everything after the pre-roll
+        const int captureStart = juce::jmax(blockStart, preRollSamples);
+        if (blockEnd > captureStart)
+        {
+            for (int channel = 0; channel < 2; ++channel)
+            {
+                rendered.copyFrom(channel, captureStart - preRollSamples,
+                                  renderBlock, channel, captureStart - blockStart, blockEnd - captureStart);
+            }
+        }
+    }
+
+    // Fold the extra tail over the start with an equal-power crossfade so the loop is seamless
+    slot.loop.setSize(2, loopSamples);
+
+    for (int channel = 0; channel < 2; ++channel)
+    {
+        const float* source = rendered.getReadPointer(channel);
+        float* loop = slot.loop.getWritePointer(channel);
+
+        for (int i = 0; i < seamSamples; ++i)
+        {
+            const float t = (static_cast<float>(i) + 0.5f) / static_cast<float>(seamSamples);
+            const float fadeIn = std::sin(t * juce::MathConstants<float>::halfPi);
+            const float fadeOut = std::cos(t * juce::MathConstants<float>::halfPi);
+            loop[i] = source[i] * fadeIn + source[loopSamples + i] * fadeOut;
+        }
+
+        std::copy(source + seamSamples, source + loopSamples, loop + seamSamples);
+    }
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "GrainEngine.h"
+
+// Bounces the grain cloud of each held note into a seamless loop on a background
+// thread, so sustained textures can be played back without running the grain pool.
+// All public methods except prepare() are called from the audio thread.
+class TextureFreezer : private juce::Thread
+{
+public:
+    TextureFreezer();
+    ~TextureFreezer() override;
+
+    void prepare(double sampleRate);
+
+    // Queue a loop render for this note unless one already exists
+    void requestLoop(int midiNote, float velocity, const GrainParameters& params,
+                     const SampleSource::Ptr& source, const ZoneMap::Ptr& zones, int maxGrains);
+
+    // Start playback of a finished loop, fading in over the given length
+    bool startLoopIfReady(int midiNote, int fadeSamples);
+    bool isLoopPlaying(int midiNote) const;
+
+    // True while any loop is audible, including ones fading out
+    bool isPlayingAnyLoop() const;
+
+    // Fade out (or cancel) the loop for one note or for all notes
+    void releaseLoop(int midiNote, int fadeSamples);
+    void releaseAll(int fadeSamples);
+
+    // Mix all playing loops into the output buffer, scaled by gain
+    void process(juce::AudioBuffer<float>& outputBuffer, int startSample, int numSamples, float gain);
+
+    static constexpr double crossfadeSeconds = 0.25;     // Live cloud <-> loop handover
+    static constexpr double loopCrossfadeSeconds = 0.5;  // Seam of the loop itself
+
+private:
+    enum SlotState
+    {
+        idle,
+        requested,   // Audio thread filled in the request, waiting for the worker
+        rendering,   // Worker is rendering
+        cancelled,   // Note released while rendering, worker discards the result
+        ready,       // Loop rendered, waiting for the audio thread to pick it up
+        playing,     // Audio thread is playing the loop
+        retired      // Audio thread is done with the loop, worker frees it
+    };
+
+    struct Slot
+    {
+        std::atomic<int> state { idle };
+
+        // Request, written by the audio thread before publishing 'requested'
+        float velocity = 1.0f;
+        GrainParameters params;
+        SampleSource::Ptr source;  // Dropped by the worker once the render is finished, as are the zones
+        ZoneMap::Ptr zones;
+        int maxGrains = 512;
+
+        // Written by the worker before publishing 'ready'
+        juce::AudioBuffer<float> loop;
+
+        // Playback state, audio thread only
+        int readPosition = 0;
+        float gain = 0.0f;
+        float gainStep = 0.0f;
+        bool releasing = false;
+    };
+
+    void run() override;
+    bool renderLoop(int midiNote, Slot& slot);
+
+    std::array<Slot, 128> slots;
+    std::atomic<double> outputSampleRate { 44100.0 };
+
+    // Worker-thread state
+    std::unique_ptr<GrainEngine> renderer;
+    juce::AudioBuffer<float> renderBlock;
+    juce::AudioBuffer<float> rendered;
+
+    static constexpr int renderBlockSize = 512;
+    static constexpr double minimumFadeSeconds = 0.005;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TextureFreezer)
+};
@@ -1,6 +1,42 @@
 #include "WaveformDisplay.h"
 #include "LookAndFeel.h"
 
+namespace
+{
+    // One line through the samples, for views where each is wider than a peak pyramid peak
+    void drawSampleLine(juce::Graphics& g, const SampleSource& source, int channel,
+                        double startSample, double endSample, juce::Rectangle<float> band)
+    {
+        const auto first = juce::jmax(static_cast<juce::int64>(0), static_cast<juce::int64>(std::floor(startSample)));
+        const auto end = juce::jmin(source.getLengthInSamples(), static_cast<juce::int64>(std::ceil(endSample)) + 1);
+
+        // Spans a streamed file has not paged in are left blank rather than waited for
+        SampleSource::Window window;
+        if (first >= end || !source.acquireWindow(first, end, false, window))
+            return;
+
+        const char* data = static_cast<const char*>(channel == 0 ? window.left : window.right);
+        const auto last = juce::jmin(end, window.start + window.length);
+        const double pixelsPerSample = band.getWidth() / (endSample - startSample);
+        juce::Path line;
+
+        for (auto i = juce::jmax(first, window.start); i < last; ++i)
+        {
+            const float sample = SampleSource::readSample(window.format, data + (i - window.start) * window.frameBytes);
+            const float x = band.getX() + static_cast<float>((static_cast<double>(i) - startSample) * pixelsPerSample);
+            const float y = band.getCentreY() - juce::jlimit(-1.0f, 1.0f, sample) * band.getHeight() * 0.5f;
+
+            if (line.isEmpty())
+                line.startNewSubPath(x, y);
+            else
+                line.lineTo(x, y);
+        }
+
+        source.releaseWindow(window);
+        g.strokePath(line, juce::PathStrokeType(1.0f));
+    }
+}
+
 WaveformDisplay::WaveformDisplay(AudioFileLoader& loader, GrainEngine& /*engine*/)
     : audioFileLoader(loader),
       vBlankAttachment(this, [this] { onVBlank(); })
@@ -30,13 +66,16 @@ void WaveformDisplay::paint(juce::Graphics& g)
         drawWaveform(g, innerBounds);
         drawGrainWindow(g, innerBounds);
     }
-    else
+    else if (!audioFileLoader.isLoading())
     {
         // No file loaded message
         g.setColour(PinkGrainLookAndFeel::textColour.withAlpha(0.5f));
         g.setFont(16.0f);
         g.drawText("Drop a WAV file or click Load", innerBounds, juce::Justification::centred);
     }
+
+    if (audioFileLoader.isLoading())
+        drawLoadProgress(g, innerBounds);
 }
 
 void WaveformDisplay::resized()
@@ -183,21 +222,73 @@ void WaveformDisplay::setSourceSampleRate(double sampleRate)
     sourceSampleRate = sampleRate;
 }
 
-void WaveformDisplay::setSourceLengthSamples(int lengthSamples)
+void WaveformDisplay::setSourceLengthSamples(juce::int64 lengthSamples)
 {
     sourceLengthSamples = lengthSamples;
 }
 
+void WaveformDisplay::drawSource(juce::Graphics& g, juce::Rectangle<int> bounds, const SampleSource& source,
+                                 double startSample, double endSample)
+{
+    const int width = bounds.getWidth();
+    const int numChannels = juce::jmin(2, source.getNumChannels());  // The channels grains play
+
+    if (width <= 0 || numChannels <= 0 || endSample <= startSample)
+        return;
+
+    const juce::Graphics::ScopedSaveState state(g);
+    g.reduceClipRegion(bounds);
+
+    const float bandHeight = static_cast<float>(bounds.getHeight()) / static_cast<float>(numChannels);
+    std::vector<float> minima(static_cast<size_t>(width));
+    std::vector<float> maxima(static_cast<size_t>(width));
+
+    for (int channel = 0; channel < numChannels; ++channel)
+    {
+        const juce::Rectangle<float> band(static_cast<float>(bounds.getX()), static_cast<float>(bounds.getY()) + bandHeight * static_cast<float>(channel),
+                                          static_cast<float>(width), bandHeight);
+
+        if (!source.getPeakPyramid().getPeaks(channel, startSample, endSample, minima.data(), maxima.data(), width))
+        {
+            drawSampleLine(g, source, channel, startSample, endSample, band);
+            continue;
+        }
+
+        // A line per pixel from its lowest to its highest peak
+        for (int x = 0; x < width; ++x)
+        {
+            const float top = band.getCentreY() - juce::jlimit(-1.0f, 1.0f, maxima[static_cast<size_t>(x)]) * band.getHeight() * 0.5f;
+            const float bottom = band.getCentreY() - juce::jlimit(-1.0f, 1.0f, minima[static_cast<size_t>(x)]) * band.getHeight() * 0.5f;
+            g.drawVerticalLine(bounds.getX() + x, top, juce::jmax(bottom, top + 1.0f));
+        }
+    }
+}
+
 void WaveformDisplay::drawWaveform(juce::Graphics& g, juce::Rectangle<int> bounds)
 {
-    auto& thumbnail = audioFileLoader.getThumbnail();
+    auto source = audioFileLoader.getSource();
 
-    if (thumbnail.getNumChannels() == 0)
+    if (source == nullptr)
         return;
 
     // Draw waveform in a dimmer color
     g.setColour(PinkGrainLookAndFeel::primaryColour.withAlpha(0.4f));
-    thumbnail.drawChannels(g, bounds, 0.0, thumbnail.getTotalLength(), 1.0f);
+    drawSource(g, bounds, *source, 0.0, static_cast<double>(source->getLengthInSamples()));
+}
+
+void WaveformDisplay::drawLoadProgress(juce::Graphics& g, juce::Rectangle<int> bounds)
+{
+    // The previous sample keeps playing (and showing) until the new one is decoded
+    const float progress = audioFileLoader.getLoadProgress();
+
+    g.setColour(PinkGrainLookAndFeel::textColour.withAlpha(0.7f));
+    g.setFont(14.0f);
+    g.drawText("Loading... " + juce::String(juce::roundToInt(progress * 100.0f)) + "%",
+               bounds.reduced(6, 4), juce::Justification::topLeft);
+
+    auto bar = bounds.removeFromBottom(3).toFloat();
+    g.setColour(PinkGrainLookAndFeel::primaryColour);
+    g.fillRect(bar.withWidth(bar.getWidth() * progress));
 }
 
 void WaveformDisplay::drawGrainWindow(juce::Graphics& g, juce::Rectangle<int> bounds)
@@ -234,19 +325,18 @@ void WaveformDisplay::drawGrainWindow(juce::Graphics& g, juce::Rectangle<int> bo
     g.fillRect(windowRect);
 
     // Brighter waveform within the window
-    auto& thumbnail = audioFileLoader.getThumbnail();
-    if (thumbnail.getNumChannels() > 0)
+    if (auto source = audioFileLoader.getSource())
     {
         g.setColour(PinkGrainLookAndFeel::primaryColour.withAlpha(0.7f));
 
-        // Calculate time range for the window
-        double totalLength = thumbnail.getTotalLength();
-        double startTime = position * totalLength;
-        double endTime = (position + windowWidth) * totalLength;
+        // Calculate sample range for the window
+        double totalLength = static_cast<double>(source->getLengthInSamples());
+        double startSample = position * totalLength;
+        double endSample = (position + windowWidth) * totalLength;
 
         // Clip to visible area
         g.reduceClipRegion(windowRect.toNearestInt());
-        thumbnail.drawChannels(g, bounds, startTime, endTime, 1.0f);
+        drawSource(g, bounds, *source, startSample, endSample);
         g.resetToDefaultState();
 
         // Restore clip region for rest of painting
@@ -22,7 +22,13 @@ public:
     void setPositionParameter(std::atomic<float>* positionParam);
     void setGrainSizeParameter(std::atomic<float>* grainSizeParam);
     void setSourceSampleRate(double sampleRate);
-    void setSourceLengthSamples(int lengthSamples);
+    void setSourceLengthSamples(juce::int64 lengthSamples);
+
+    // Draws [startSample, endSample) of the source across the bounds, one channel above the
+    // other, from the peak pyramid level that matches the zoom or, zoomed in past its finest
+    // level, from the samples themselves
+    static void drawSource(juce::Graphics& g, juce::Rectangle<int> bounds, const SampleSource& source,
+                           double startSample, double endSample);
 
     // Callback for position changes from mouse drag
     std::function<void(float)> onPositionChanged;
@@ -32,6 +38,7 @@ private:
     void onVBlank();
     void drawWaveform(juce::Graphics& g, juce::Rectangle<int> bounds);
     void drawGrainWindow(juce::Graphics& g, juce::Rectangle<int> bounds);
+    void drawLoadProgress(juce::Graphics& g, juce::Rectangle<int> bounds);
 
     void updatePositionFromMouse(const juce::MouseEvent& event);
     void updateSizeFromMouse(const juce::MouseEvent& event);
@@ -41,7 +48,7 @@ private:
     std::atomic<float>* positionParameter = nullptr;
     std::atomic<float>* grainSizeParameter = nullptr;
     double sourceSampleRate = 44100.0;
-    int sourceLengthSamples = 0;
+    juce::int64 sourceLengthSamples = 0;
 
     // Mouse drag state
     enum class DragMode { None, LeftHandle, RightHandle, ClickPosition };
@@ -1,5 +1,6 @@
 #include "ZoomedWaveformDisplay.h"
 #include "LookAndFeel.h"
+#include "WaveformDisplay.h"
 
 ZoomedWaveformDisplay::ZoomedWaveformDisplay(AudioFileLoader& loader, GrainEngine& engine)
     : audioFileLoader(loader),
@@ -61,16 +62,16 @@ void ZoomedWaveformDisplay::setGrainSizeParameter(std::atomic<float>* grainSizeP
 
 void ZoomedWaveformDisplay::drawZoomedWaveform(juce::Graphics& g, juce::Rectangle<int> bounds)
 {
-    auto& thumbnail = audioFileLoader.getThumbnail();
+    auto source = audioFileLoader.getSource();
 
-    if (thumbnail.getNumChannels() == 0)
+    if (source == nullptr)
         return;
 
     float position = positionParameter->load();
     float grainSizeMs = grainSizeParameter->load();
 
     double sourceSampleRate = audioFileLoader.getSampleRate();
-    int sourceLengthSamples = audioFileLoader.getNumSamples();
+    juce::int64 sourceLengthSamples = audioFileLoader.getNumSamples();
 
     if (sourceLengthSamples <= 0 || sourceSampleRate <= 0.0)
         return;
@@ -85,7 +86,7 @@ void ZoomedWaveformDisplay::drawZoomedWaveform(juce::Graphics& g, juce::Rectangl
 
     // Draw the zoomed waveform
     g.setColour(PinkGrainLookAndFeel::primaryColour.withAlpha(0.7f));
-    thumbnail.drawChannels(g, bounds, startTime, endTime, 1.0f);
+    WaveformDisplay::drawSource(g, bounds, *source, startTime * sourceSampleRate, endTime * sourceSampleRate);
 }
 
 void ZoomedWaveformDisplay::drawGrains(juce::Graphics& g, juce::Rectangle<int> bounds)
@@ -97,7 +98,7 @@ void ZoomedWaveformDisplay::drawGrains(juce::Graphics& g, juce::Rectangle<int> b
     float grainSizeMs = grainSizeParameter->load();
 
     double sourceSampleRate = audioFileLoader.getSampleRate();
-    int sourceLengthSamples = audioFileLoader.getNumSamples();
+    juce::int64 sourceLengthSamples = audioFileLoader.getNumSamples();
 
     if (sourceLengthSamples <= 0 || sourceSampleRate <= 0.0)
         return;
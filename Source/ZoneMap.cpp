@@ -0,0 +1,23 @@
+#include "ZoneMap.h"
+
+ZoneMap::ZoneMap(std::vector<Zone> zonesToUse)
+    : zones(std::move(zonesToUse))
+{
+    jassert(zones.size() <= static_cast<size_t>(maxZones));
+    table.fill(-1);
+
+    for (size_t i = 0; i < zones.size() && i < static_cast<size_t>(maxZones); ++i)
+    {
+        const auto& zone = zones[i];
+
+        for (int key = juce::jmax(0, zone.lowKey); key <= juce::jmin(127, zone.highKey); ++key)
+            for (int velocity = juce::jmax(0, zone.lowVelocity); velocity <= juce::jmin(127, zone.highVelocity); ++velocity)
+                table[static_cast<size_t>((key << 7) | velocity)] = static_cast<juce::int8>(i);
+    }
+}
+
+bool ZoneMap::uses(const SampleSource* source) const
+{
+    return source != nullptr
+        && std::any_of(zones.begin(), zones.end(), [source](const Zone& zone) { return zone.source.get() == source; });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "SampleSource.h"
+
+// The samples of a multi-sampled instrument, each played over a range of keys and
+// velocities and transposed from its own root note. Which zone plays a key at a velocity
+// is worked out for all of them when the map is built, so finding it costs one lookup.
+// Maps are built on the message thread and never change once shared with the engine.
+class ZoneMap : public juce::ReferenceCountedObject
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<ZoneMap>;
+
+    struct Zone
+    {
+        SampleSource::Ptr source;  // Null while the zone's sample is loading
+        int lowKey = 0;
+        int highKey = 127;
+        int lowVelocity = 1;
+        int highVelocity = 127;
+        int rootNote = 60;
+    };
+
+    // Where zones overlap, the later one plays
+    explicit ZoneMap(std::vector<Zone> zonesToUse);
+
+    // The zone playing this key at this velocity (0 to 1), or nullptr where none does
+    const Zone* find(int midiNote, float velocity) const
+    {
+        const int velocityIndex = juce::jlimit(1, 127, juce::roundToInt(velocity * 127.0f));
+        const int zone = table[static_cast<size_t>((juce::jlimit(0, 127, midiNote) << 7) | velocityIndex)];
+        return zone >= 0 ? &zones[static_cast<size_t>(zone)] : nullptr;
+    }
+
+    const std::vector<Zone>& getZones() const { return zones; }
+    bool uses(const SampleSource* source) const;
+
+    static constexpr int maxZones = 127;
+
+private:
+    const std::vector<Zone> zones;
+    std::array<juce::int8, 128 * 128> table;  // Zone index per key and velocity, or -1
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ZoneMap)
+};